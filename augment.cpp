@@ -0,0 +1,317 @@
+/*
+ * Implementation of the augmentation stage - worker threads pull training sets
+ * from the wrapped dataset, make randomized copies of the input images and put them
+ * in a bounded queue that the trainer drains in order.
+ *
+ * Each copy is the input image shifted by up to maxShift pixels, rotated by up to
+ * maxRotate degrees and scaled by up to maxScale (as a fraction) about its center,
+ * resampled bilinearly, and then has its brightness multiplied by up to 1 +/- maxBrightness.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/6/20
+ */
+
+
+#include <iostream>
+#include <algorithm>
+#include <math.h>
+
+#include "augment.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include "random.hpp"
+
+using namespace std;
+
+/*
+ * Default augmentation options (can be overridden in the config file)
+ */
+int augment = 0;
+int augmentCopies = 1;
+int augmentThreads = 2;
+int augmentQueue = 64;
+int augmentSeed = 1;
+double maxShift = 2.0;
+double maxRotate = 10.0;
+double maxScale = 0.1;
+double maxBrightness = 0.1;
+
+
+/*
+ * Constructor for the augmented dataset. Workers are not started until
+ * the first epoch is started.
+ * @param sourceSets the dataset to make augmented copies of (not owned)
+ * @param numIn the number of input activations per set (a square image)
+ * @param numOut the number of truth values per set
+ */
+AugmentedDataset::AugmentedDataset(Dataset* sourceSets, int numIn, int numOut)
+{
+   source = sourceSets;
+   numInputs = numIn;
+   numOutputs = numOut;
+   copies = max(augmentCopies, 1);
+   numWorkers = max(augmentThreads, 1);
+   capacity = max(augmentQueue, 1);
+
+   /*
+    * Geometric transforms only make sense for square images - otherwise
+    * only the brightness is jittered
+    */
+   side = (int) (sqrt((double) numInputs) + 0.5);
+   if (side*side != numInputs)
+   {
+      cout << "Inputs are not a square image - only brightness will be augmented" << endl;
+      side = 0;
+   }
+
+   slotInputs.resize((long) capacity*numInputs);
+   slotTruths.resize((long) capacity*numOutputs);
+   slotIndex.resize(capacity);
+   slotSequence.assign(capacity, -1);
+   trackAlloc(MEM_DATASET, (slotInputs.size() + slotTruths.size())*sizeof(double));
+
+   nextSequence = 0;
+   consumed = 0;
+   total = -1;
+   stopping = false;
+   currentEpoch = 0;
+
+}  //AugmentedDataset constructor
+
+long AugmentedDataset::size()
+{
+   return source->size()*copies;
+}
+
+/*
+ * Makes one randomized copy of the given input image. The copy gets its own stream
+ * of the run seed (with augmentSeed in the high half of the key), picked by the epoch
+ * and the position of the copy, so the result does not depend on which worker makes it.
+ * @param in the original input activations
+ * @param out where the augmented input activations are written
+ * @param sequence the position of the copy in the epoch
+ */
+void AugmentedDataset::transform(double* in, double* out, long sequence)
+{
+   TraceScope scope("augment");
+   Philox generator(runSeed() + ((unsigned long) augmentSeed << 32), RNG_AUGMENT,
+                    currentEpoch, (uint32_t) sequence);
+
+   double dx = generator.uniform(-1.0, 1.0)*maxShift;
+   double dy = generator.uniform(-1.0, 1.0)*maxShift;
+   double angle = generator.uniform(-1.0, 1.0)*maxRotate*M_PI/180.0;
+   double scale = 1.0 + generator.uniform(-1.0, 1.0)*maxScale;
+   double brightness = 1.0 + generator.uniform(-1.0, 1.0)*maxBrightness;
+
+   if (side == 0)
+   {
+      for (int k = 0; k < numInputs; k++)
+      {
+         out[k] = min(max(in[k]*brightness, 0.0), 1.0);
+      }
+      return;
+   }
+
+   double c = (side - 1)/2.0;
+   double cosA = cos(angle);
+   double sinA = sin(angle);
+
+   /*
+    * Inverse mapping - for every output pixel, find where it came from in the
+    * original image (undo the shift, then the rotation, then the scale) and sample
+    * it bilinearly, clamping at the borders
+    */
+   for (int y = 0; y < side; y++)
+   {
+      for (int x = 0; x < side; x++)
+      {
+         double u = x - c - dx;
+         double v = y - c - dy;
+         double sx = ( cosA*u + sinA*v)/scale + c;
+         double sy = (-sinA*u + cosA*v)/scale + c;
+
+         sx = min(max(sx, 0.0), side - 1.0);
+         sy = min(max(sy, 0.0), side - 1.0);
+         int x0 = (int) sx;
+         int y0 = (int) sy;
+         int x1 = min(x0 + 1, side - 1);
+         int y1 = min(y0 + 1, side - 1);
+         double fx = sx - x0;
+         double fy = sy - y0;
+
+         double top = in[y0*side + x0]*(1.0 - fx) + in[y0*side + x1]*fx;
+         double bottom = in[y1*side + x0]*(1.0 - fx) + in[y1*side + x1]*fx;
+         double value = (top*(1.0 - fy) + bottom*fy)*brightness;
+
+         out[y*side + x] = min(max(value, 0.0), 1.0);
+      }
+   }
+   return;
+
+}  //void AugmentedDataset::transform(double* in, double* out, long sequence)
+
+/*
+ * Body of a worker thread. Takes the next training set from the source, then makes
+ * each of its copies as soon as the copy's slot in the queue is free. Exits when the
+ * source runs out or the dataset is stopped.
+ */
+void AugmentedDataset::work()
+{
+   vector<double> input(numInputs);
+   vector<double> truth(numOutputs);
+
+   while (true)
+   {
+      long first;
+      long index;
+
+      {
+         unique_lock<mutex> guard(lock);
+         Sample sample;
+         if (stopping)
+         {
+            return;
+         }
+         if (!source->next(sample))
+         {
+            total = nextSequence;      //Nothing more will be handed out this epoch
+            slotFilled.notify_all();
+            return;
+         }
+         copy(sample.input, sample.input + numInputs, input.begin());
+         copy(sample.truth, sample.truth + numOutputs, truth.begin());
+         index = sample.index;
+         first = nextSequence;
+         nextSequence += copies;
+      }
+
+      for (int c = 0; c < copies; c++)
+      {
+         long sequence = first + c;
+         int slot = sequence % capacity;
+
+         /*
+          * A slot is free for this copy once the copy "capacity" positions before it
+          * has been taken by the trainer
+          */
+         {
+            unique_lock<mutex> guard(lock);
+            slotFreed.wait(guard, [&] { return stopping ||
+                                   (slotSequence[slot] == -1 && sequence - consumed < capacity); });
+            if (stopping)
+            {
+               return;
+            }
+         }
+
+         transform(input.data(), &slotInputs[(long) slot*numInputs], sequence);
+         copy(truth.begin(), truth.end(), slotTruths.begin() + (long) slot*numOutputs);
+
+         {
+            lock_guard<mutex> guard(lock);
+            slotIndex[slot] = index;
+            slotSequence[slot] = sequence;
+         }
+         slotFilled.notify_all();
+      }
+   }
+
+}  //void AugmentedDataset::work()
+
+/*
+ * Stops and joins the workers of the current epoch (if any)
+ */
+void AugmentedDataset::stopWorkers()
+{
+   {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+   }
+   slotFreed.notify_all();
+
+   for (int w = 0; w < workers.size(); w++)
+   {
+      workers[w].join();
+   }
+   workers.clear();
+   stopping = false;
+
+   return;
+}
+
+/*
+ * Starts a new epoch - stops any workers still running from the last one,
+ * rewinds the source and the queue and starts the workers
+ * @param epoch the index of the epoch being started
+ */
+void AugmentedDataset::startEpoch(int epoch)
+{
+   stopWorkers();
+
+   source->startEpoch(epoch);
+   currentEpoch = epoch;
+   nextSequence = 0;
+   consumed = 0;
+   total = -1;
+   fill(slotSequence.begin(), slotSequence.end(), -1);
+
+   for (int w = 0; w < numWorkers; w++)
+   {
+      workers.push_back(thread(&AugmentedDataset::work, this));
+   }
+   return;
+}
+
+/*
+ * Hands the trainer the next augmented copy. The slot of the copy handed out
+ * by the previous call is given back to the workers first.
+ * @param sample filled in with the next augmented training set
+ * @return false if the epoch is finished
+ */
+bool AugmentedDataset::next(Sample& sample)
+{
+   unique_lock<mutex> guard(lock);
+
+   if (consumed > 0 && slotSequence[(consumed - 1) % capacity] == consumed - 1)
+   {
+      slotSequence[(consumed - 1) % capacity] = -1;
+      slotFreed.notify_all();
+   }
+
+   int slot = consumed % capacity;
+   slotFilled.wait(guard, [&] { return slotSequence[slot] == consumed ||
+                               (total >= 0 && consumed >= total); });
+   if (slotSequence[slot] != consumed)
+   {
+      return false;
+   }
+
+   sample.input = &slotInputs[(long) slot*numInputs];
+   sample.truth = &slotTruths[(long) slot*numOutputs];
+   sample.index = slotIndex[slot];
+   sample.layer = 0;
+   sample.bits = NULL;
+   consumed++;
+
+   return true;
+
+}  //bool AugmentedDataset::next(Sample& sample)
+
+/*
+ * Stops the workers when an epoch is left unfinished (training stopped early), so the
+ * source can be used again right away
+ */
+void AugmentedDataset::stop()
+{
+   stopWorkers();
+   return;
+}
+
+/*
+ * Destructor - stops the workers (the source dataset is not owned)
+ */
+AugmentedDataset::~AugmentedDataset()
+{
+   stopWorkers();
+   trackFree(MEM_DATASET, (slotInputs.size() + slotTruths.size())*sizeof(double));
+}
@@ -0,0 +1,93 @@
+/*
+ * Header file for the augmentation stage - Contains the declaration of a
+ * dataset that wraps another dataset and hands out randomly shifted, rotated,
+ * scaled and brightness-jittered copies of its (square) input images.
+ *
+ * The copies are made by worker threads ahead of the trainer and handed over
+ * through a bounded queue, so the cost of augmenting is hidden behind training.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/6/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef AUGMENT_H
+#define AUGMENT_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "dataset.hpp"
+
+using namespace std;
+
+/*
+ * Global variables storing the augmentation options (can be overridden in the config file)
+ */
+extern int augment;
+extern int augmentCopies;
+extern int augmentThreads;
+extern int augmentQueue;
+extern int augmentSeed;
+extern double maxShift;
+extern double maxRotate;
+extern double maxScale;
+extern double maxBrightness;
+
+/*
+ * Dataset that hands out augmented copies of the training sets of another dataset.
+ * Every training set of the wrapped dataset turns into augmentCopies randomized copies
+ * per epoch. The randomness of each copy only depends on the seed, the epoch and
+ * the position of the copy in the epoch, so runs are repeatable no matter how the
+ * worker threads are scheduled.
+ *
+ * The queue is a ring of slots indexed by the position of the copy in the epoch -
+ * workers fill slots out of order but the trainer always takes them in order.
+ */
+class AugmentedDataset : public Dataset
+{
+   Dataset* source;
+   int numInputs;
+   int numOutputs;
+   int side;                        //Width (and height) of the square input image
+   int copies;
+   int numWorkers;
+   int capacity;                    //Number of slots in the queue
+
+   vector<double> slotInputs;
+   vector<double> slotTruths;
+   vector<long> slotIndex;
+   vector<long> slotSequence;       //Which copy each slot holds (-1 for empty)
+
+   long nextSequence;               //Next copy position handed to a worker
+   long consumed;                   //Next copy position the trainer takes
+   long total;                      //Number of copies this epoch (known once the source runs out)
+   bool stopping;
+   int currentEpoch;
+
+   mutex lock;
+   condition_variable slotFilled;
+   condition_variable slotFreed;
+   vector<thread> workers;
+
+   private:
+      void work();
+      void transform(double* in, double* out, long sequence);
+      void stopWorkers();
+
+   public:
+      AugmentedDataset(Dataset* sourceSets, int numIn, int numOut);
+      long size();
+      void startEpoch(int epoch);
+      bool next(Sample& sample);
+      void stop();
+      ~AugmentedDataset();
+
+};    //class AugmentedDataset
+
+
+#endif /* AUGMENT_H */
@@ -0,0 +1,468 @@
+/*
+ * Microbenchmarks for the Network operations. Times run(), error(), updateWeights()
+ * and a full epoch (run + error + updateWeights over every set) over a matrix of
+ * topologies, batch sizes (number of training sets per timed pass) and thread counts
+ * (number of networks training at once, one per thread).
+ *
+ * For every combination it reports the time per training set, the floating point
+ * throughput and the number of bytes of weights moved, both to the console and as
+ * JSON so runs on different machines or with different kernels can be compared.
+ *
+ * It also measures the latency of single requests - run() on one input at a time, with the
+ * large layers split across a work pool of 1, 2 and 4 threads - as the median and 99th
+ * percentile time per request.
+ *
+ * Usage: ./bench (jsonfile) (--quick)
+ * jsonfile defaults to bench.json, --quick runs fewer repetitions
+ *
+ * @author Kailash Ranganathan
+ * @version 4/9/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+
+#include "network.hpp"
+#include "random.hpp"
+#include "pool.hpp"
+
+using namespace std;
+
+/*
+ * The operations that are timed
+ */
+enum Operation {OP_RUN, OP_ERROR, OP_UPDATE, OP_EPOCH};
+const char* operationNames[] = {"run", "error", "updateWeights", "epoch"};
+
+/*
+ * One row of the results
+ */
+struct BenchResult
+{
+   string topology;
+   int operation;
+   int batch;
+   int threads;
+   double nsPerSample;
+   double gflops;
+   double bytesPerSample;
+};
+
+/*
+ * One row of the latency results
+ */
+struct LatencyResult
+{
+   string topology;
+   int threads;
+   double p50Ns;
+   double p99Ns;
+};
+
+
+/*
+ * Counts the floating point operations and the bytes of weights touched by
+ * one training set for the given operation. These are estimates from the loop
+ * structure of the kernels, not hardware counts.
+ *
+ * run():           one multiply and one add per weight plus the activation of every neuron
+ * error():         a handful of operations per output
+ * updateWeights(): omega (2 per weight above the first layer), deltaWeights (2 per weight)
+ *                  and the weight increment (1 per weight); reads the weight once and
+ *                  writes both the delta and the weight
+ */
+void countWork(vector<int>& sizes, int operation, double& flops, double& bytes)
+{
+   double numWeights = 0.0;
+   double upperWeights = 0.0;       //Weights above the first layer (these also feed omega)
+   double neurons = 0.0;
+   for (int n = 0; n < sizes.size() - 1; n++)
+   {
+      numWeights += 1.0*sizes[n]*sizes[n+1];
+      if (n > 0)
+      {
+         upperWeights += 1.0*sizes[n]*sizes[n+1];
+      }
+      neurons += sizes[n+1];
+   }
+
+   double runFlops = 2.0*numWeights + 4.0*neurons;
+   double errorFlops = 8.0*sizes.back();
+   double updateFlops = 2.0*upperWeights + 3.0*numWeights + 8.0*neurons;
+
+   flops = 0.0;
+   bytes = 0.0;
+   if (operation == OP_RUN || operation == OP_EPOCH)
+   {
+      flops += runFlops;
+      bytes += sizeof(double)*numWeights;
+   }
+   if (operation == OP_ERROR || operation == OP_EPOCH)
+   {
+      flops += errorFlops;
+   }
+   if (operation == OP_UPDATE || operation == OP_EPOCH)
+   {
+      flops += updateFlops;
+      bytes += 3.0*sizeof(double)*numWeights;
+   }
+   return;
+
+}  //void countWork(vector<int>& sizes, int operation, double& flops, double& bytes)
+
+/*
+ * Builds a randomly initialized network with the given layer sizes
+ */
+Network* makeNetwork(vector<int>& sizes)
+{
+   int numLayers = sizes.size();
+
+   vector<vector<vector<double> > > weights(numLayers - 1);
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      weights[n].assign(sizes[n], vector<double>(sizes[n+1]));
+   }
+   return new Network(numLayers, sizes.data(), 0, move(weights));
+}
+
+/*
+ * Times the given operation on one network for the given number of passes over
+ * a batch of training sets. For error() and updateWeights() the forward pass (and
+ * for updateWeights the error) still has to happen first, so only the operation
+ * itself is inside the timed region.
+ * @return the number of nanoseconds spent in the operation
+ */
+double timeOperation(Network* net, int operation, vector<double*>& inputs,
+                     vector<double*>& truths, int passes)
+{
+   typedef chrono::steady_clock Clock;
+   double total = 0.0;
+   double sink = 0.0;
+
+   for (int p = 0; p < passes; p++)
+   {
+      if (operation == OP_RUN || operation == OP_EPOCH)
+      {
+         Clock::time_point start = Clock::now();
+         for (int s = 0; s < inputs.size(); s++)
+         {
+            net->setTruth(truths[s]);
+            sink += net->run(inputs[s])[0];
+            if (operation == OP_EPOCH)
+            {
+               sink += net->error();
+               net->updateWeights();
+            }
+         }
+         total += chrono::duration<double, nano>(Clock::now() - start).count();
+      }
+      else
+      {
+         for (int s = 0; s < inputs.size(); s++)
+         {
+            net->setTruth(truths[s]);
+            net->run(inputs[s]);
+            if (operation == OP_UPDATE)
+            {
+               net->error();
+            }
+
+            Clock::time_point start = Clock::now();
+            if (operation == OP_ERROR)
+            {
+               sink += net->error();
+            }
+            else
+            {
+               net->updateWeights();
+            }
+            total += chrono::duration<double, nano>(Clock::now() - start).count();
+         }
+      }
+   }
+
+   if (sink == 12345.6789)          //Keeps the compiler from dropping the work
+   {
+      cout << "";
+   }
+   return total;
+
+}  //double timeOperation(...)
+
+/*
+ * The topology written as in the results ("625-40-5")
+ */
+string topologyName(vector<int>& sizes)
+{
+   stringstream topology;
+   for (int n = 0; n < sizes.size(); n++)
+   {
+      topology << (n > 0 ? "-" : "") << sizes[n];
+   }
+   return topology.str();
+}
+
+/*
+ * Runs one cell of the matrix - the given number of threads each time the operation
+ * on their own network and batch, and the throughput is the aggregate over threads.
+ */
+BenchResult benchmark(vector<int>& sizes, int operation, int batch, int numThreads, int passes)
+{
+   int numIn = sizes.front();
+   int numOut = sizes.back();
+
+   /*
+    * Networks and data are built up front on the main thread, so the inputs come from
+    * one stream of the seed and do not depend on how many threads are benchmarked
+    */
+   vector<Network*> nets(numThreads);
+   vector<vector<double> > data(numThreads);
+   vector<vector<double*> > inputs(numThreads);
+   vector<vector<double*> > truths(numThreads);
+   for (int t = 0; t < numThreads; t++)
+   {
+      nets[t] = makeNetwork(sizes);
+      data[t].resize((long) batch*(numIn + numOut));
+      for (int s = 0; s < batch; s++)
+      {
+         double* in = &data[t][(long) s*(numIn + numOut)];
+         double* truth = in + numIn;
+         for (int k = 0; k < numIn; k++)
+         {
+            in[k] = randomGenerator(0.0, 1.0);
+         }
+         for (int k = 0; k < numOut; k++)
+         {
+            truth[k] = (k == s % numOut) ? 1.0 : 0.0;
+         }
+         inputs[t].push_back(in);
+         truths[t].push_back(truth);
+      }
+   }
+
+   /*
+    * One untimed pass to warm up the caches, then the timed passes
+    */
+   vector<double> elapsed(numThreads);
+   vector<thread> workers;
+   for (int t = 0; t < numThreads; t++)
+   {
+      workers.push_back(thread([&, t] {
+         timeOperation(nets[t], operation, inputs[t], truths[t], 1);
+         elapsed[t] = timeOperation(nets[t], operation, inputs[t], truths[t], passes);
+      }));
+   }
+   for (int t = 0; t < numThreads; t++)
+   {
+      workers[t].join();
+   }
+
+   for (int t = 0; t < numThreads; t++)
+   {
+      delete nets[t];
+   }
+
+   /*
+    * The slowest thread bounds the aggregate throughput
+    */
+   double slowest = *max_element(elapsed.begin(), elapsed.end());
+   double samples = 1.0*batch*passes*numThreads;
+   double flops, bytes;
+   countWork(sizes, operation, flops, bytes);
+
+   BenchResult result;
+   result.topology = topologyName(sizes);
+   result.operation = operation;
+   result.batch = batch;
+   result.threads = numThreads;
+   result.nsPerSample = slowest/samples;
+   result.gflops = flops*samples/slowest;
+   result.bytesPerSample = bytes;
+
+   return result;
+
+}  //BenchResult benchmark(...)
+
+/*
+ * Times the given number of single requests - run() on one input, the large layers split
+ * across a work pool of numThreads threads - after a few untimed ones
+ * @return the median and 99th percentile of the request times
+ */
+LatencyResult latency(vector<int>& sizes, int numThreads, int requests)
+{
+   typedef chrono::steady_clock Clock;
+   Network* net = makeNetwork(sizes);
+   WorkPool pool(numThreads);
+   net->setPool(&pool);
+
+   vector<double> input(sizes.front());
+   for (int k = 0; k < input.size(); k++)
+   {
+      input[k] = randomGenerator(0.0, 1.0);
+   }
+
+   double sink = 0.0;
+   vector<double> times(requests);
+   for (int r = -10; r < requests; r++)
+   {
+      Clock::time_point start = Clock::now();
+      sink += net->run(input.data())[0];
+      if (r >= 0)
+      {
+         times[r] = chrono::duration<double, nano>(Clock::now() - start).count();
+      }
+   }
+   if (sink == 12345.6789)          //Keeps the compiler from dropping the work
+   {
+      cout << "";
+   }
+   net->setPool(NULL);
+   delete net;
+
+   sort(times.begin(), times.end());
+   LatencyResult result;
+   result.topology = topologyName(sizes);
+   result.threads = pool.size();
+   result.p50Ns = times[requests/2];
+   result.p99Ns = times[min(requests - 1, requests*99/100)];
+   return result;
+
+}  //LatencyResult latency(...)
+
+/*
+ * Writes the results as JSON along with a description of the machine
+ */
+void writeJson(vector<BenchResult>& results, vector<LatencyResult>& latencies, string fileName)
+{
+   ofstream fout(fileName);
+
+   fout << "{" << endl;
+   fout << "  \"compiler\": \"" << __VERSION__ << "\"," << endl;
+   fout << "  \"hardwareThreads\": " << thread::hardware_concurrency() << "," << endl;
+   fout << "  \"results\": [" << endl;
+   for (int r = 0; r < results.size(); r++)
+   {
+      BenchResult& res = results[r];
+      fout << "    {\"topology\": \"" << res.topology << "\", \"op\": \"" << operationNames[res.operation]
+           << "\", \"batch\": " << res.batch << ", \"threads\": " << res.threads
+           << ", \"nsPerSample\": " << res.nsPerSample << ", \"gflops\": " << res.gflops
+           << ", \"bytesPerSample\": " << res.bytesPerSample
+           << ", \"gbPerSec\": " << res.bytesPerSample/res.nsPerSample << "}"
+           << (r + 1 < results.size() ? "," : "") << endl;
+   }
+   fout << "  ]," << endl;
+   fout << "  \"latency\": [" << endl;
+   for (int r = 0; r < latencies.size(); r++)
+   {
+      LatencyResult& res = latencies[r];
+      fout << "    {\"topology\": \"" << res.topology << "\", \"threads\": " << res.threads
+           << ", \"p50Ns\": " << res.p50Ns << ", \"p99Ns\": " << res.p99Ns << "}"
+           << (r + 1 < latencies.size() ? "," : "") << endl;
+   }
+   fout << "  ]" << endl;
+   fout << "}" << endl;
+   fout.close();
+
+   return;
+}
+
+/*
+ * Runs the whole matrix and writes the results
+ */
+int main(int argc, char* argv[])
+{
+   string jsonFile = "bench.json";
+   bool quick = false;
+   for (int a = 1; a < argc; a++)
+   {
+      string arg = argv[a];
+      if (arg == "--quick")
+      {
+         quick = true;
+      }
+      else
+      {
+         jsonFile = arg;
+      }
+   }
+
+   randomSeed = 1;
+
+   int topologyData[][8] = {
+      {625, 400, 200, 70, 40, 20, 5, 0},
+      {625, 100, 5, 0},
+      {625, 40, 5, 0},
+      {2, 5, 1, 0},
+   };
+   int batchSizes[] = {1, 15, 64};
+   int threadCounts[] = {1, 2, 4};
+
+   vector<BenchResult> results;
+   for (int t = 0; t < sizeof(topologyData)/sizeof(topologyData[0]); t++)
+   {
+      vector<int> sizes;
+      for (int n = 0; topologyData[t][n] != 0; n++)
+      {
+         sizes.push_back(topologyData[t][n]);
+      }
+
+      /*
+       * Aim for roughly the same amount of work per cell whatever the size of the network
+       */
+      double flops, bytes;
+      countWork(sizes, OP_EPOCH, flops, bytes);
+      double budget = quick ? 2.0e7 : 4.0e8;
+
+      for (int b = 0; b < sizeof(batchSizes)/sizeof(int); b++)
+      {
+         int passes = max(1, (int) (budget/(flops*batchSizes[b])));
+         for (int h = 0; h < sizeof(threadCounts)/sizeof(int); h++)
+         {
+            for (int op = OP_RUN; op <= OP_EPOCH; op++)
+            {
+               BenchResult res = benchmark(sizes, op, batchSizes[b], threadCounts[h], passes);
+               results.push_back(res);
+
+               cout << res.topology << " " << operationNames[op] << " batch " << res.batch
+                    << " threads " << res.threads << ": " << res.nsPerSample << " ns/sample, "
+                    << res.gflops << " GFLOP/s, " << res.bytesPerSample << " bytes/sample" << "\n";
+            }
+         }
+      }
+   }
+
+   /*
+    * Single-request latency of the two largest topologies
+    */
+   vector<LatencyResult> latencies;
+   int requests = quick ? 200 : 2000;
+   for (int t = 0; t < 2; t++)
+   {
+      vector<int> sizes;
+      for (int n = 0; topologyData[t][n] != 0; n++)
+      {
+         sizes.push_back(topologyData[t][n]);
+      }
+      for (int h = 0; h < sizeof(threadCounts)/sizeof(int); h++)
+      {
+         LatencyResult res = latency(sizes, threadCounts[h], requests);
+         latencies.push_back(res);
+         cout << res.topology << " latency threads " << res.threads << ": p50 " << res.p50Ns/1000.0
+              << " us, p99 " << res.p99Ns/1000.0 << " us" << "\n";
+      }
+   }
+
+   writeJson(results, latencies, jsonFile);
+   cout << "Results saved to \"" << jsonFile << "\"" << endl;
+
+   return 0;
+
+}  //int main()
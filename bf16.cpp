@@ -0,0 +1,99 @@
+/*
+ * Implementation of the bf16 dot product. The AVX-512 BF16 version is compiled for
+ * that instruction set only (through a target attribute, so the rest of the program keeps
+ * the default flags) and chosen at run time if the CPU supports it.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/28/20
+ */
+
+
+#include "bf16.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Default storage (double - can be overridden in the config file)
+ */
+int bf16Storage = 0;
+
+/*
+ * Widens to float and multiplies in 8 independent sums so the loop can be vectorized
+ * (one running sum would force the additions into order)
+ */
+static float dotEmulated(const bf16* a, const bf16* b, int length)
+{
+   float sums[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+   int j = 0;
+   for (; j + 8 <= length; j += 8)
+   {
+      for (int k = 0; k < 8; k++)
+      {
+         sums[k] += fromBf16(a[j + k])*fromBf16(b[j + k]);
+      }
+   }
+   float total = 0.0f;
+   for (int k = 0; k < 8; k++)
+   {
+      total += sums[k];
+   }
+   for (; j < length; j++)
+   {
+      total += fromBf16(a[j])*fromBf16(b[j]);
+   }
+   return total;
+}
+
+#if defined(__x86_64__)
+/*
+ * vdpbf16ps multiplies 32 pairs of bf16 values and adds them into 16 float sums per instruction
+ */
+__attribute__((target("avx512f,avx512bf16")))
+static float dotNative(const bf16* a, const bf16* b, int length)
+{
+   __m512 sums = _mm512_setzero_ps();
+   int j = 0;
+   for (; j + 32 <= length; j += 32)
+   {
+      __m512bh va = (__m512bh) _mm512_loadu_si512(a + j);
+      __m512bh vb = (__m512bh) _mm512_loadu_si512(b + j);
+      sums = _mm512_dpbf16_ps(sums, va, vb);
+   }
+   float total = _mm512_reduce_add_ps(sums);
+   for (; j < length; j++)
+   {
+      total += fromBf16(a[j])*fromBf16(b[j]);
+   }
+   return total;
+}
+#endif
+
+bool hasNativeBf16()
+{
+#if defined(__x86_64__)
+   static bool native = __builtin_cpu_supports("avx512bf16");
+   return native;
+#else
+   return false;
+#endif
+}
+
+/*
+ * Dot product of two bf16 arrays
+ * @param a the first array
+ * @param b the second array
+ * @param length the number of values in each
+ * @return the sum of the products, accumulated in float
+ */
+float dotBf16(const bf16* a, const bf16* b, int length)
+{
+#if defined(__x86_64__)
+   if (hasNativeBf16())
+   {
+      return dotNative(a, b, length);
+   }
+#endif
+   return dotEmulated(a, b, length);
+}
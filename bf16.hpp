@@ -0,0 +1,68 @@
+/*
+ * Header file for bfloat16 storage - Contains declarations for converting between
+ * doubles/floats and bfloat16 (the top 16 bits of a float: same range, 8 bits of mantissa)
+ * and for the dot product the bf16 forward pass is built on.
+ *
+ * Values are only stored in bf16 - every product and sum is done in float. The dot
+ * product uses the AVX-512 BF16 instructions when the CPU has them and otherwise
+ * widens the bf16 values to float (a 16 bit shift) in plain loops.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/28/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef BF16_H
+#define BF16_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Whether the network stores its weights and activations in bf16 for run() and exports
+ * a bf16 weights file (can be set in the config file)
+ */
+extern int bf16Storage;
+
+typedef uint16_t bf16;
+
+/*
+ * Rounds a float to the nearest bf16 (ties to even)
+ */
+inline bf16 toBf16(float value)
+{
+   uint32_t bits;
+   memcpy(&bits, &value, sizeof(bits));
+   if ((bits & 0x7fffffff) > 0x7f800000)     //NaN stays a (quiet) NaN
+   {
+      return (bf16) ((bits >> 16) | 0x40);
+   }
+   bits += 0x7fff + ((bits >> 16) & 1);
+   return (bf16) (bits >> 16);
+}
+
+/*
+ * Widens a bf16 to a float (exact)
+ */
+inline float fromBf16(bf16 value)
+{
+   uint32_t bits = (uint32_t) value << 16;
+   float result;
+   memcpy(&result, &bits, sizeof(result));
+   return result;
+}
+
+/*
+ * Dot product of two bf16 arrays accumulated in float
+ */
+float dotBf16(const bf16* a, const bf16* b, int length);
+
+/*
+ * Whether dotBf16 runs on the AVX-512 BF16 instructions
+ */
+bool hasNativeBf16();
+
+
+#endif /* BF16_H */
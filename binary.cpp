@@ -0,0 +1,137 @@
+/*
+ * Implementation of the binarized input kernels. Set bits are found with count trailing
+ * zeros (the compiler builtin) and counted with popcount - the popcnt instruction when the
+ * CPU has it (compiled for it through a target attribute and chosen at run time, like the
+ * bf16 kernels), otherwise the compiler's portable popcount.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/8/20
+ */
+
+
+#include "binary.hpp"
+
+#include <string.h>
+
+/*
+ * Default binarized input options (off, threshold halfway up the 0-1 scale, full
+ * precision first layer weights - can be overridden in the config file)
+ */
+int binarizeInputs = 0;
+double binaryThreshold = 0.5;
+int binaryWeights = 0;
+
+/*
+ * Thresholds the values into bits (the unused bits of the last word stay 0)
+ */
+void packBits(const double* values, int count, double threshold, uint64_t* bits)
+{
+   memset(bits, 0, bitWords(count)*sizeof(uint64_t));
+   for (int k = 0; k < count; k++)
+   {
+      if (values[k] >= threshold)
+      {
+         bits[k/64] |= (uint64_t) 1 << (k % 64);
+      }
+   }
+   return;
+}
+
+/*
+ * Expands the bits back into activations
+ */
+void unpackBits(const uint64_t* bits, int count, double* values)
+{
+   for (int k = 0; k < count; k++)
+   {
+      values[k] = (double) ((bits[k/64] >> (k % 64)) & 1);
+   }
+   return;
+}
+
+/*
+ * Adds the weights row of every set bit - the rows are contiguous, so each is a plain
+ * vectorized add, and the unset bits (inputs of 0) cost nothing
+ */
+void selectForward(const uint64_t* bits, int numWords, vector<vector<double> >& weights, int numOut, double* out)
+{
+   memset(out, 0, numOut*sizeof(double));
+   for (int w = 0; w < numWords; w++)
+   {
+      uint64_t word = bits[w];
+      while (word != 0)
+      {
+         int k = 64*w + __builtin_ctzll(word);
+         word &= word - 1;                      //Clears the lowest set bit
+         const double* row = weights[k].data();
+         for (int i = 0; i < numOut; i++)
+         {
+            out[i] += row[i];
+         }
+      }
+   }
+   return;
+
+}  //void selectForward(...)
+
+/*
+ * Sum over the set bits of +-1 - the bits under a set sign bit minus the rest. The same
+ * code is compiled twice (with and without popcnt) from this template.
+ */
+template <typename Popcount>
+__attribute__((always_inline))          //So the popcounts are compiled for the caller's target
+static inline void popcountLayer(const uint64_t* bits, int numWords, const uint64_t* signs, const double* scales,
+                                 int numOut, double* out, Popcount popcount)
+{
+   int numSet = 0;
+   for (int w = 0; w < numWords; w++)
+   {
+      numSet += popcount(bits[w]);
+   }
+   for (int i = 0; i < numOut; i++)
+   {
+      const uint64_t* row = signs + (long) i*numWords;
+      int positive = 0;
+      for (int w = 0; w < numWords; w++)
+      {
+         positive += popcount(bits[w] & row[w]);
+      }
+      out[i] = scales[i]*(2*positive - numSet);
+   }
+   return;
+}
+
+static void popcountPortable(const uint64_t* bits, int numWords, const uint64_t* signs, const double* scales,
+                             int numOut, double* out)
+{
+   popcountLayer(bits, numWords, signs, scales, numOut, out, [](uint64_t word) { return __builtin_popcountll(word); });
+}
+
+#if defined(__x86_64__)
+__attribute__((target("popcnt")))
+static void popcountNative(const uint64_t* bits, int numWords, const uint64_t* signs, const double* scales,
+                           int numOut, double* out)
+{
+   popcountLayer(bits, numWords, signs, scales, numOut, out,
+                 [](uint64_t word) __attribute__((target("popcnt"))) { return __builtin_popcountll(word); });
+}
+#endif
+
+/*
+ * The binarized weights layer - on the popcnt instruction if the CPU has it
+ */
+void popcountForward(const uint64_t* bits, int numWords, const uint64_t* signs, const double* scales, int numOut,
+                     double* out)
+{
+#if defined(__x86_64__)
+   static bool native = __builtin_cpu_supports("popcnt");
+   if (native)
+   {
+      popcountNative(bits, numWords, signs, scales, numOut, out);
+      return;
+   }
+#endif
+   popcountPortable(bits, numWords, signs, scales, numOut, out);
+   return;
+
+}  //void popcountForward(...)
@@ -0,0 +1,66 @@
+/*
+ * Header file for the binarized input kernels - Contains declarations for thresholding
+ * input activations into bits and for the first layer kernels that work on the bits.
+ *
+ * A binarized input is one bit per activation (1 for a pixel at or above the threshold),
+ * packed 64 to a word, so a 625 pixel image takes 10 words instead of 625 doubles. With
+ * inputs of 0 or 1, the first layer's sums need no multiplies: each one is the sum of the
+ * weights of the set bits (bitmask select - the same sums as the double path, in the same
+ * order), and with the weights binarized too (the sign of each weight, times the mean
+ * magnitude of its destination's weights) it is two popcounts per destination.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/8/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Global variables storing the binarized input options (can be set in the config file)
+ */
+extern int binarizeInputs;
+extern double binaryThreshold;
+extern int binaryWeights;
+
+/*
+ * The number of 64 bit words holding numBits bits
+ */
+inline int bitWords(int numBits)
+{
+   return (numBits + 63)/64;
+}
+
+/*
+ * Sets bit k of bits if values[k] is at least the threshold (bits has bitWords(count) words)
+ */
+void packBits(const double* values, int count, double threshold, uint64_t* bits);
+
+/*
+ * values[k] = bit k of bits (0.0 or 1.0)
+ */
+void unpackBits(const uint64_t* bits, int count, double* values);
+
+/*
+ * out[i] = sum over the set bits k of weights[k][i] - a fully connected layer
+ * ([source][destination] weights) fed with inputs of 0 or 1
+ */
+void selectForward(const uint64_t* bits, int numWords, vector<vector<double> >& weights, int numOut, double* out);
+
+/*
+ * out[i] = scales[i]*(2*popcount(bits & signs[i]) - popcount(bits)) - the same layer with
+ * weights of +scales[i] (sign bit set) or -scales[i], signs holding numWords words per destination
+ */
+void popcountForward(const uint64_t* bits, int numWords, const uint64_t* signs, const double* scales, int numOut,
+                     double* out);
+
+
+#endif /* BINARY_H */
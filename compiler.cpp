@@ -0,0 +1,270 @@
+/*
+ * Ahead-of-time model compiler. Reads a trained network (the input file's topology with
+ * hasWeights set, and the weights in the file it names) and writes a standalone C++ header and
+ * source file that compute the same forward pass without the Network class:
+ *
+ *    - every layer size is a compile-time constant and every weights layer a constexpr,
+ *      64 byte aligned float array stored [destination][source] so each output is a dot
+ *      product over contiguous memory
+ *    - the layers are unrolled into straight-line calls of a template specialized on the
+ *      layer sizes (no loop over layerSizes), and the dot products keep 8 partial sums over
+ *      sources padded to a multiple of 8 so they vectorize without -ffast-math
+ *    - the entry point has a C ABI: void infer(const float* input, float* output)
+ *
+ * "make libmodel.so" builds the generated model.cpp into a shared library with -O3 and the
+ * host's vector instructions. Only fully connected networks can be compiled.
+ *
+ * Usage: ./compiler inputfile (configs) (--name model)
+ * The input is taken as run() takes it (already scaled to 0-1).
+ *
+ * @author Kailash Ranganathan
+ * @version 5/5/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+#include "network.hpp"
+#include "reader.hpp"
+
+using namespace std;
+
+/*
+ * Defined by the driver of every program that links the Reader (not used here)
+ */
+string outputFile = "finalweights";
+
+extern int streamData;
+
+static const int PAD = 8;        //Sources are padded to a multiple of this many floats
+
+
+static int padded(int size)
+{
+   return (size + PAD - 1)/PAD*PAD;
+}
+
+/*
+ * Prints a float so that reading it back gives the same float
+ */
+static string floatLiteral(double value)
+{
+   char text[32];
+   snprintf(text, sizeof(text), "%.9gf", (float) value);
+   string literal = text;
+   if (literal.find_first_of(".eni") == string::npos)      //"3f" is not a float literal
+   {
+      literal.insert(literal.size() - 1, ".0");
+   }
+   return literal;
+}
+
+/*
+ * Writes the header - the C ABI and the sizes of the input and output
+ */
+static void writeHeader(string name, int numInputs, int numOutputs)
+{
+   ofstream out(name + ".hpp");
+   string guard = name;
+   for (int c = 0; c < guard.size(); c++)
+   {
+      guard[c] = isalnum(guard[c]) ? toupper(guard[c]) : '_';
+   }
+
+   out << "/*\n"
+       << " * Generated by the model compiler - forward pass of a trained network\n"
+       << " */\n\n"
+       << "#pragma once\n\n"
+       << "#ifndef " << guard << "_H\n"
+       << "#define " << guard << "_H\n\n"
+       << "#define " << guard << "_INPUTS " << numInputs << "\n"
+       << "#define " << guard << "_OUTPUTS " << numOutputs << "\n\n"
+       << "#ifdef __cplusplus\n"
+       << "extern \"C\" {\n"
+       << "#endif\n\n"
+       << "/*\n"
+       << " * Runs the network on " << numInputs << " inputs (scaled to 0-1) and writes its "
+       << numOutputs << " outputs\n"
+       << " */\n"
+       << "void infer(const float* input, float* output);\n\n"
+       << "#ifdef __cplusplus\n"
+       << "}\n"
+       << "#endif\n\n"
+       << "#endif\n";
+   out.close();
+   return;
+}
+
+/*
+ * Writes the source - the weights as constexpr arrays, the layer template and infer()
+ */
+static void writeSource(string name, int numLayers, int* layerSizes, LayerSpec* specs, WeightsView weights)
+{
+   ofstream out(name + ".cpp");
+
+   out << "/*\n"
+       << " * Generated by the model compiler - forward pass of the network";
+   for (int n = 0; n < numLayers; n++)
+   {
+      out << (n == 0 ? " " : "-") << layerSizes[n];
+   }
+   out << "\n"
+       << " * Build with: g++ -O3 -march=native -shared -fPIC " << name << ".cpp -o lib" << name << ".so\n"
+       << " */\n\n"
+       << "#include <math.h>\n"
+       << "#include \"" << name << ".hpp\"\n\n"
+       << "namespace\n"
+       << "{\n\n";
+
+   for (int n = 0; n < numLayers; n++)
+   {
+      out << "constexpr int SIZE" << n << " = " << layerSizes[n] << ";\n";
+      out << "constexpr int PADDED" << n << " = " << padded(layerSizes[n]) << ";\n";
+   }
+   out << "\n";
+
+   /*
+    * Weights layer n as [destination][padded source], the padding zero
+    */
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      out << "alignas(64) constexpr float WEIGHTS" << n << "[SIZE" << n+1 << "][PADDED" << n << "] = {\n";
+      for (int i = 0; i < layerSizes[n+1]; i++)
+      {
+         out << "   {";
+         for (int j = 0; j < padded(layerSizes[n]); j++)
+         {
+            out << (j > 0 ? (j % 8 == 0 ? ",\n    " : ", ") : "")
+                << (j < layerSizes[n] ? floatLiteral(weights.at(n, j, i)) : "0.0f");
+         }
+         out << "},\n";
+      }
+      out << "};\n\n";
+   }
+
+   out << "/*\n"
+       << " * One fully connected layer (sigmoid, or linear in the middle of a factored layer) -\n"
+       << " * the sizes are template arguments, so every layer gets its own fully unrollable loops.\n"
+       << " * The 8 partial sums keep the additions independent so the compiler can put them in\n"
+       << " * vector lanes.\n"
+       << " */\n"
+       << "template <int IN, int OUT, bool SIGMOID>\n"
+       << "inline void dense(const float (&weights)[OUT][IN], const float* in, float* out)\n"
+       << "{\n"
+       << "   for (int i = 0; i < OUT; i++)\n"
+       << "   {\n"
+       << "      float sums[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};\n"
+       << "      for (int j = 0; j < IN; j += 8)\n"
+       << "      {\n"
+       << "         for (int k = 0; k < 8; k++)\n"
+       << "         {\n"
+       << "            sums[k] += weights[i][j + k]*in[j + k];\n"
+       << "         }\n"
+       << "      }\n"
+       << "      float theta = ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));\n"
+       << "      out[i] = SIGMOID ? 1.0f/(1.0f + expf(-theta)) : theta;\n"
+       << "   }\n"
+       << "   for (int i = OUT; i < (OUT + 7)/8*8; i++)\n"
+       << "   {\n"
+       << "      out[i] = 0.0f;            //Padding of the next layer's input\n"
+       << "   }\n"
+       << "}\n\n"
+       << "}  //namespace\n\n";
+
+   out << "extern \"C\" void infer(const float* input, float* output)\n"
+       << "{\n";
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      out << "   alignas(64) float layer" << n << "[PADDED" << n << "];\n";
+   }
+   out << "   alignas(64) float layer" << numLayers - 1 << "[PADDED" << numLayers - 1 << "];\n\n"
+       << "   for (int k = 0; k < PADDED0; k++)\n"
+       << "   {\n"
+       << "      layer0[k] = k < SIZE0 ? input[k] : 0.0f;\n"
+       << "   }\n";
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      out << "   dense<PADDED" << n << ", SIZE" << n+1 << ", " << (specs[n+1].type == LAYER_LINEAR ? "false" : "true")
+          << ">(WEIGHTS" << n << ", layer" << n << ", layer" << n+1 << ");\n";
+   }
+   out << "   for (int k = 0; k < SIZE" << numLayers - 1 << "; k++)\n"
+       << "   {\n"
+       << "      output[k] = layer" << numLayers - 1 << "[k];\n"
+       << "   }\n"
+       << "}\n";
+   out.close();
+   return;
+
+}  //static void writeSource(...)
+
+
+/*
+ * Reads the network and writes name.hpp and name.cpp
+ */
+int main(int argc, char* argv[])
+{
+   string file = "inputs";
+   string configFile = "";
+   string name = "model";
+   vector<string> positional;
+   for (int a = 1; a < argc; a++)
+   {
+      string arg = argv[a];
+      if (arg == "--name" && a + 1 < argc)
+      {
+         name = argv[++a];
+      }
+      else
+      {
+         positional.push_back(arg);
+      }
+   }
+   if (positional.size() > 0)
+   {
+      file = positional[0];
+   }
+   if (positional.size() > 1)
+   {
+      configFile = positional[1];
+   }
+
+   streamData = 1;                     //Only the weights are needed, not the training sets
+   Reader reader = Reader(file, configFile, "");
+   int* metadata = reader.getMetaData();
+   int numLayers = metadata[2];
+   int* layerSizes = reader.getLayerSizes();
+   LayerSpec* specs = reader.getLayerSpecs();
+
+   if (metadata[1] != 1)
+   {
+      cout << "The input file has no weights (hasWeights must be 1) - nothing to compile" << endl;
+      return 1;
+   }
+   for (int n = 0; n < numLayers; n++)
+   {
+      if (specs[n].type != LAYER_FULL && specs[n].type != LAYER_LINEAR)
+      {
+         cout << "Only fully connected networks can be compiled (layer " << n << " is "
+              << layerName(specs[n]) << ")" << endl;
+         return 1;
+      }
+   }
+
+   if (reader.getProjection() != NULL)
+   {
+      cout << "Note - the compiled model takes the inputs projected with " << reader.getWeightsFile() << ".proj" << endl;
+   }
+
+   vector<vector<vector<double> > > weights = reader.takeWeights();
+   writeHeader(name, layerSizes[0], layerSizes[numLayers - 1]);
+   writeSource(name, numLayers, layerSizes, specs, WeightsView(weights));
+
+   cout << "Wrote " << name << ".hpp and " << name << ".cpp (" << countWeights(numLayers, specs)
+        << " weights) - build with \"make lib" << name << ".so\"" << endl;
+   return 0;
+
+}  //int main(int argc, char* argv[])
@@ -0,0 +1,242 @@
+/*
+ * Implementation of the convolution and pooling kernels. Convolutions are
+ * "valid" (no padding) with a stride of 1, pooling windows do not overlap.
+ *
+ * All the matrix products keep the output pixel index p innermost, so the inner loops
+ * run over contiguous memory and the compiler can vectorize them.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/25/20
+ */
+
+
+#include <string.h>
+
+#include "conv.hpp"
+
+using namespace std;
+
+
+/*
+ * Unrolls the input patches into columns - row (c, ky, kx) of columns holds, for every
+ * output pixel (y, x), the input value at channel c, row y+ky, column x+kx
+ */
+void im2col(const double* in, int channels, int height, int width, int kernel, double* columns)
+{
+   int outHeight = height - kernel + 1;
+   int outWidth = width - kernel + 1;
+
+   for (int c = 0; c < channels; c++)
+   {
+      for (int ky = 0; ky < kernel; ky++)
+      {
+         for (int kx = 0; kx < kernel; kx++)
+         {
+            double* row = columns + ((c*kernel + ky)*kernel + kx)*outHeight*outWidth;
+            for (int y = 0; y < outHeight; y++)
+            {
+               const double* src = in + (c*height + y + ky)*width + kx;
+               memcpy(row + y*outWidth, src, outWidth*sizeof(double));
+            }
+         }
+      }
+   }
+   return;
+
+}  //void im2col(...)
+
+/*
+ * Adds every entry of the columns back onto the input position it was copied from
+ */
+void col2imAdd(const double* columns, int channels, int height, int width, int kernel, double* out)
+{
+   int outHeight = height - kernel + 1;
+   int outWidth = width - kernel + 1;
+
+   for (int c = 0; c < channels; c++)
+   {
+      for (int ky = 0; ky < kernel; ky++)
+      {
+         for (int kx = 0; kx < kernel; kx++)
+         {
+            const double* row = columns + ((c*kernel + ky)*kernel + kx)*outHeight*outWidth;
+            for (int y = 0; y < outHeight; y++)
+            {
+               double* dst = out + (c*height + y + ky)*width + kx;
+               for (int x = 0; x < outWidth; x++)
+               {
+                  dst[x] += row[y*outWidth + x];
+               }
+            }
+         }
+      }
+   }
+   return;
+
+}  //void col2imAdd(...)
+
+/*
+ * Forward pass of a convolution as a matrix product
+ * @param filters the weights, one row of channels*kernel*kernel values per filter
+ * @param columns the unrolled input patches
+ * @param numPixels the number of output pixels per filter
+ * @param out the pre-activation outputs, numPixels per filter
+ */
+void convForward(vector<vector<double> >& filters, const double* columns, int numPixels, double* out)
+{
+   for (int f = 0; f < filters.size(); f++)
+   {
+      double* outRow = out + f*numPixels;
+      memset(outRow, 0, numPixels*sizeof(double));
+
+      for (int k = 0; k < filters[f].size(); k++)
+      {
+         double w = filters[f][k];
+         const double* column = columns + k*numPixels;
+         for (int p = 0; p < numPixels; p++)
+         {
+            outRow[p] += w*column[p];
+         }
+      }
+   }
+   return;
+
+}  //void convForward(...)
+
+/*
+ * Backward pass of a convolution - the column gradient is computed with the old
+ * weights, then the weights are updated (the same order the fully connected layers use)
+ */
+void convBackward(vector<vector<double> >& filters, vector<vector<double> >& deltas,
+                  const double* columns, const double* psi, int numPixels, double lambdaValue,
+                  double* columnGrads, bool apply)
+{
+   int numFilters = filters.size();
+   int patchSize = numFilters > 0 ? filters[0].size() : 0;
+
+   if (columnGrads != NULL)
+   {
+      memset(columnGrads, 0, (long) patchSize*numPixels*sizeof(double));
+      for (int f = 0; f < numFilters; f++)
+      {
+         const double* psiRow = psi + f*numPixels;
+         for (int k = 0; k < patchSize; k++)
+         {
+            double w = filters[f][k];
+            double* gradRow = columnGrads + k*numPixels;
+            for (int p = 0; p < numPixels; p++)
+            {
+               gradRow[p] += w*psiRow[p];
+            }
+         }
+      }
+   }
+
+   for (int f = 0; f < numFilters; f++)
+   {
+      const double* psiRow = psi + f*numPixels;
+      for (int k = 0; k < patchSize; k++)
+      {
+         const double* column = columns + k*numPixels;
+         double sum = 0.0;
+         for (int p = 0; p < numPixels; p++)
+         {
+            sum += psiRow[p]*column[p];
+         }
+         deltas[f][k] = lambdaValue*sum;
+         if (apply)
+         {
+            filters[f][k] += deltas[f][k];
+         }
+      }
+   }
+   return;
+
+}  //void convBackward(...)
+
+/*
+ * Pools every size x size window of every channel into one value
+ */
+void poolForward(const double* in, int channels, int height, int width, int size, bool isMax,
+                 double* out, int* index)
+{
+   int outHeight = height/size;
+   int outWidth = width/size;
+
+   for (int c = 0; c < channels; c++)
+   {
+      for (int y = 0; y < outHeight; y++)
+      {
+         for (int x = 0; x < outWidth; x++)
+         {
+            int best = (c*height + y*size)*width + x*size;
+            double sum = 0.0;
+            for (int dy = 0; dy < size; dy++)
+            {
+               for (int dx = 0; dx < size; dx++)
+               {
+                  int pos = (c*height + y*size + dy)*width + x*size + dx;
+                  sum += in[pos];
+                  if (in[pos] > in[best])
+                  {
+                     best = pos;
+                  }
+               }
+            }
+
+            int o = (c*outHeight + y)*outWidth + x;
+            if (isMax)
+            {
+               out[o] = in[best];
+               index[o] = best;
+            }
+            else
+            {
+               out[o] = sum/(size*size);
+            }
+         }
+      }
+   }
+   return;
+
+}  //void poolForward(...)
+
+/*
+ * Max pooling sends each gradient to the position that won the window, average
+ * pooling spreads it evenly over the window
+ */
+void poolBackward(const double* psi, int channels, int height, int width, int size, bool isMax,
+                  const int* index, double* grad)
+{
+   int outHeight = height/size;
+   int outWidth = width/size;
+   memset(grad, 0, (long) channels*height*width*sizeof(double));
+
+   for (int c = 0; c < channels; c++)
+   {
+      for (int y = 0; y < outHeight; y++)
+      {
+         for (int x = 0; x < outWidth; x++)
+         {
+            int o = (c*outHeight + y)*outWidth + x;
+            if (isMax)
+            {
+               grad[index[o]] += psi[o];
+            }
+            else
+            {
+               double share = psi[o]/(size*size);
+               for (int dy = 0; dy < size; dy++)
+               {
+                  for (int dx = 0; dx < size; dx++)
+                  {
+                     grad[(c*height + y*size + dy)*width + x*size + dx] += share;
+                  }
+               }
+            }
+         }
+      }
+   }
+   return;
+
+}  //void poolBackward(...)
@@ -0,0 +1,65 @@
+/*
+ * Header file for the convolution and pooling kernels - Contains declarations
+ * for the array-level kernels used by the convolutional and pooling layers of the Network.
+ *
+ * Activations are stored channel by channel, row by row ([channel][row][column]).
+ * Convolutions are done with im2col: the input patches are unrolled into a
+ * [channel*kernel*kernel][outputPixels] matrix so that the forward pass, the weight
+ * gradient and the input gradient are all plain matrix products with contiguous inner loops.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/25/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef CONV_H
+#define CONV_H
+
+#include <vector>
+
+using namespace std;
+
+/*
+ * Unrolls the kernel x kernel patches of the input into columns
+ * (columns has channels*kernel*kernel rows of outHeight*outWidth values)
+ */
+void im2col(const double* in, int channels, int height, int width, int kernel, double* columns);
+
+/*
+ * The reverse of im2col - adds every column entry back onto the input position it came from
+ */
+void col2imAdd(const double* columns, int channels, int height, int width, int kernel, double* out);
+
+/*
+ * out[f][p] = sum over k of filters[f][k]*columns[k][p]
+ */
+void convForward(vector<vector<double> >& filters, const double* columns, int numPixels, double* out);
+
+/*
+ * Backpropagates through a convolution given psi (gradient at its pre-activation outputs).
+ * If columnGrads is not NULL, it is set to the gradient at the columns (using the weights
+ * before the update); then the increments lambda*(psi x columns) are stored in deltas and,
+ * if apply is set, added to the filter weights.
+ */
+void convBackward(vector<vector<double> >& filters, vector<vector<double> >& deltas,
+                  const double* columns, const double* psi, int numPixels, double lambdaValue,
+                  double* columnGrads, bool apply = true);
+
+/*
+ * Max or average pooling over non-overlapping size x size windows. For max pooling
+ * the position of the max of each window is stored in index for the backward pass.
+ */
+void poolForward(const double* in, int channels, int height, int width, int size, bool isMax,
+                 double* out, int* index);
+
+/*
+ * Sends the gradient at the pooled outputs back to the inputs
+ * (grad is overwritten - positions outside every window get 0)
+ */
+void poolBackward(const double* psi, int channels, int height, int width, int size, bool isMax,
+                  const int* index, double* grad);
+
+
+#endif /* CONV_H */
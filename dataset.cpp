@@ -0,0 +1,641 @@
+/*
+ * Implementation of the dataset classes - a resident dataset that walks the
+ * arrays read in by the Reader, a streaming dataset that reads training sets
+ * from disk in chunks with read-ahead on a background thread, and a feature cache
+ * that holds the outputs of the frozen layers of a network for every training set, and
+ * a scheduler that skips the training sets the network has already learned.
+ *
+ * Dataset services:
+ * long size() gives the number of training sets per epoch, void startEpoch(int epoch)
+ * rewinds (and optionally reshuffles) the dataset, bool next(Sample& sample) hands out
+ * the next training set and returns false at the end of the epoch.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/2/20
+ */
+
+
+#include <iostream>
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "dataset.hpp"
+#include "reader.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include "random.hpp"
+#include "binary.hpp"
+
+using namespace std;
+
+/*
+ * Default dataset options (can be overridden in the config file)
+ */
+int streamData = 0;
+int chunkSize = 1024;
+int shuffleData = 0;
+string cacheFile = "";         //Empty keeps the feature cache in memory
+int scheduleSamples = 0;       //1 skips most of the training sets that are already learned
+double easyRate = 0.1;         //Fraction of the learned sets still trained on each epoch
+int fullErrorInterval = 10;    //Epochs between the ones that train on every set
+
+
+/*
+ * Constructor for the resident dataset
+ * @param inputArr the input activations of each training set
+ * @param truthArr the truth values of each training set
+ * @param numSets the number of training sets in the arrays
+ */
+ResidentDataset::ResidentDataset(double** inputArr, double** truthArr, long numSets)
+{
+   inputs = inputArr;
+   truths = truthArr;
+   numSamples = numSets;
+   cursor = 0;
+
+   order.resize(numSamples);
+   for (long i = 0; i < numSamples; i++)
+   {
+      order[i] = i;
+   }
+}
+
+long ResidentDataset::size()
+{
+   return numSamples;
+}
+
+/*
+ * Rewinds the dataset. If shuffling is on, the order of the training sets
+ * is reshuffled with the epoch's stream of the run seed so runs are repeatable.
+ * @param epoch the index of the epoch being started
+ */
+void ResidentDataset::startEpoch(int epoch)
+{
+   cursor = 0;
+   if (shuffleData)
+   {
+      Philox generator(runSeed(), RNG_SHUFFLE, epoch);
+      shuffle(order.begin(), order.end(), generator);
+   }
+   return;
+}
+
+/*
+ * Hands out the next training set of the epoch
+ * @param sample filled in with the next training set
+ * @return false if the epoch is finished
+ */
+bool ResidentDataset::next(Sample& sample)
+{
+   if (cursor >= numSamples)
+   {
+      return false;
+   }
+   long i = order[cursor++];
+   sample.input = inputs[i];
+   sample.truth = truths[i];
+   sample.index = i;
+   sample.layer = 0;
+   sample.bits = NULL;
+
+   return true;
+}
+
+
+/*
+ * Constructor for the binarized dataset
+ * @param packedInputs the input bits of every training set, one after another
+ * @param truthArr the truth values of every training set
+ * @param numSets the number of training sets
+ * @param numIn the number of input activations (bits) per set
+ */
+BinaryDataset::BinaryDataset(const uint64_t* packedInputs, double** truthArr, long numSets, int numIn)
+{
+   bits = packedInputs;
+   truths = truthArr;
+   numSamples = numSets;
+   numInputs = numIn;
+   numWords = bitWords(numIn);
+   cursor = 0;
+   unpacked.resize(numIn);
+   order.resize(numSets);
+   for (long i = 0; i < numSets; i++)
+   {
+      order[i] = i;
+   }
+}
+
+long BinaryDataset::size()
+{
+   return numSamples;
+}
+
+/*
+ * Rewinds the dataset (reshuffled like the resident dataset if shuffling is on)
+ * @param epoch the index of the epoch being started
+ */
+void BinaryDataset::startEpoch(int epoch)
+{
+   cursor = 0;
+   if (shuffleData)
+   {
+      Philox generator(runSeed(), RNG_SHUFFLE, epoch);
+      shuffle(order.begin(), order.end(), generator);
+   }
+   return;
+}
+
+/*
+ * Hands out the bits of the next training set of the epoch (and its unpacked inputs)
+ * @param sample filled in with the next training set
+ * @return false if the epoch is finished
+ */
+bool BinaryDataset::next(Sample& sample)
+{
+   if (cursor >= numSamples)
+   {
+      return false;
+   }
+   long i = order[cursor++];
+   sample.bits = bits + i*numWords;
+   unpackBits(sample.bits, numInputs, unpacked.data());
+   sample.input = unpacked.data();
+   sample.truth = truths[i];
+   sample.index = i;
+   sample.layer = 0;
+
+   return true;
+}
+
+
+/*
+ * Constructor for the streaming dataset - allocates the two chunk buffers
+ * but does not read anything until the first epoch is started.
+ * @param numSets the number of training sets on disk
+ * @param numIn the number of input activations per set
+ * @param numOut the number of truth values per set
+ * @param chunkSets the number of training sets per chunk
+ * @param shuffleSets 1 to shuffle chunks (and sets within chunks) every epoch
+ */
+StreamingDataset::StreamingDataset(long numSets, int numIn, int numOut, long chunkSets, int shuffleSets)
+{
+   numSamples = numSets;
+   numInputs = numIn;
+   numOutputs = numOut;
+   chunkLength = chunkSets > 0 ? chunkSets : 1;
+   numChunks = (numSamples + chunkLength - 1)/chunkLength;
+   shuffle = shuffleSets;
+
+   for (int b = 0; b < 2; b++)
+   {
+      inputBuffer[b] = new double[chunkLength*numInputs];
+      truthBuffer[b] = new double[chunkLength*numOutputs];
+      bufferCount[b] = 0;
+      bufferChunk[b] = -1;
+   }
+   trackAlloc(MEM_DATASET, 2*chunkLength*(numInputs + numOutputs)*sizeof(double));
+
+   chunkOrder.resize(numChunks);
+   for (long c = 0; c < numChunks; c++)
+   {
+      chunkOrder[c] = c;
+   }
+
+   currentBuffer = 0;
+   chunkCursor = 0;
+   setCursor = 0;
+   currentEpoch = 0;
+
+}  //StreamingDataset constructor
+
+long StreamingDataset::size()
+{
+   return numSamples;
+}
+
+/*
+ * Reads the given chunk from disk into the given buffer. Runs on the
+ * loader thread, so it only touches that buffer.
+ * @param buffer the buffer (0 or 1) to read into
+ * @param chunk the index of the chunk to read
+ */
+void StreamingDataset::loadChunk(int buffer, long chunk)
+{
+   TraceScope scope("load chunk");
+   long first = chunk*chunkLength;
+   long count = min(chunkLength, numSamples - first);
+
+   for (long s = 0; s < count; s++)
+   {
+      readSample(first + s, numInputs, numOutputs,
+                 inputBuffer[buffer] + s*numInputs, truthBuffer[buffer] + s*numOutputs);
+   }
+   bufferCount[buffer] = count;
+   bufferChunk[buffer] = chunk;
+
+   return;
+}
+
+/*
+ * Starts reading the chunk at the given position of this epoch's chunk order
+ * into the given buffer on the loader thread. Does nothing past the last chunk.
+ */
+void StreamingDataset::startLoad(int buffer, long orderPos)
+{
+   if (orderPos < numChunks)
+   {
+      loader = thread(&StreamingDataset::loadChunk, this, buffer, chunkOrder[orderPos]);
+   }
+   return;
+}
+
+/*
+ * Blocks until the chunk being read ahead (if any) is in memory
+ */
+void StreamingDataset::waitLoad()
+{
+   if (loader.joinable())
+   {
+      loader.join();
+   }
+   return;
+}
+
+/*
+ * Makes the given (already loaded) buffer the one being handed out
+ * and lays out the order of its training sets
+ */
+void StreamingDataset::useChunk(int buffer)
+{
+   currentBuffer = buffer;
+   setCursor = 0;
+   setOrder.resize(bufferCount[buffer]);
+   for (long s = 0; s < bufferCount[buffer]; s++)
+   {
+      setOrder[s] = s;
+   }
+   if (shuffle)
+   {
+      Philox generator(runSeed(), RNG_SHUFFLE, currentEpoch, bufferChunk[buffer] + 1);
+      std::shuffle(setOrder.begin(), setOrder.end(), generator);
+   }
+   return;
+}
+
+/*
+ * Rewinds the dataset, reshuffles the chunk order if needed, reads the first
+ * chunk and starts reading ahead the second.
+ * @param epoch the index of the epoch being started
+ */
+void StreamingDataset::startEpoch(int epoch)
+{
+   waitLoad();
+   currentEpoch = epoch;
+
+   for (long c = 0; c < numChunks; c++)
+   {
+      chunkOrder[c] = c;
+   }
+   if (shuffle)
+   {
+      Philox generator(runSeed(), RNG_SHUFFLE, epoch);
+      std::shuffle(chunkOrder.begin(), chunkOrder.end(), generator);
+   }
+
+   chunkCursor = 0;
+   bufferCount[0] = bufferCount[1] = 0;
+   if (numChunks > 0)
+   {
+      /*
+       * Only one chunk fits in the set when it is the whole dataset, so it
+       * can stay resident between epochs instead of being read again
+       */
+      if (bufferChunk[0] != chunkOrder[0] || numChunks > 1)
+      {
+         loadChunk(0, chunkOrder[0]);
+      }
+      else
+      {
+         bufferCount[0] = numSamples;
+      }
+      useChunk(0);
+      startLoad(1, 1);
+   }
+   return;
+
+}  //void StreamingDataset::startEpoch(int epoch)
+
+/*
+ * Hands out the next training set of the epoch. When the chunk in use runs out,
+ * waits for the read-ahead chunk, switches to it and starts reading the one after.
+ * @param sample filled in with the next training set
+ * @return false if the epoch is finished
+ */
+bool StreamingDataset::next(Sample& sample)
+{
+   if (setCursor >= bufferCount[currentBuffer])
+   {
+      if (chunkCursor + 1 >= numChunks)
+      {
+         return false;
+      }
+      waitLoad();
+      chunkCursor++;
+      useChunk(1 - currentBuffer);
+      startLoad(1 - currentBuffer, chunkCursor + 1);
+   }
+
+   long s = setOrder[setCursor++];
+   sample.input = inputBuffer[currentBuffer] + s*numInputs;
+   sample.truth = truthBuffer[currentBuffer] + s*numOutputs;
+   sample.index = bufferChunk[currentBuffer]*chunkLength + s;
+   sample.layer = 0;
+   sample.bits = NULL;
+
+   return true;
+
+}  //bool StreamingDataset::next(Sample& sample)
+
+/*
+ * Destructor - finishes any read in flight and frees the chunk buffers
+ */
+StreamingDataset::~StreamingDataset()
+{
+   waitLoad();
+   for (int b = 0; b < 2; b++)
+   {
+      delete[] inputBuffer[b];
+      delete[] truthBuffer[b];
+   }
+   trackFree(MEM_DATASET, 2*chunkLength*(numInputs + numOutputs)*sizeof(double));
+}
+
+
+/*
+ * Constructor for the feature cache - runs every training set of the source through
+ * the network up to the given layer and keeps the activations with the truth values
+ * @param source the training sets (only read here)
+ * @param net the network whose weights below layer are frozen
+ * @param layer the first layer whose activations are cached
+ * @param layerSize the size of that layer
+ * @param numOut the number of truth values per set
+ */
+FeatureCacheDataset::FeatureCacheDataset(Dataset* source, Network& net, int layer, int layerSize, int numOut)
+{
+   TraceScope scope("build feature cache");
+   numSamples = source->size();
+   featureLayer = layer;
+   featureSize = layerSize;
+   numOutputs = numOut;
+   stride = featureSize + numOutputs;
+   cacheBytes = numSamples*stride*sizeof(double);
+   cursor = 0;
+
+   /*
+    * A mapped file is backed by the disk, so only the pages in use count against memory
+    */
+   cache = NULL;
+   mapped = false;
+   if (cacheFile != "")
+   {
+      int fd = open(cacheFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd >= 0 && ftruncate(fd, cacheBytes) == 0)
+      {
+         void* address = mmap(NULL, cacheBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+         if (address != MAP_FAILED)
+         {
+            cache = (double*) address;
+            mapped = true;
+         }
+      }
+      if (fd >= 0)
+      {
+         close(fd);
+      }
+      if (!mapped)
+      {
+         cout << "Could not map the feature cache to \"" << cacheFile << "\" - keeping it in memory" << endl;
+      }
+   }
+   if (!mapped)
+   {
+      cache = new double[numSamples*stride];
+      trackAlloc(MEM_DATASET, cacheBytes);
+   }
+
+   Sample sample;
+   long count = 0;
+   source->startEpoch(0);
+   while (count < numSamples && source->next(sample))
+   {
+      double* entry = cache + count*stride;
+      memcpy(entry, net.features(sample.input, featureLayer), featureSize*sizeof(double));
+      memcpy(entry + featureSize, sample.truth, numOutputs*sizeof(double));
+      indices.push_back(sample.index);
+      count++;
+   }
+   numSamples = count;
+
+   order.resize(numSamples);
+   for (long i = 0; i < numSamples; i++)
+   {
+      order[i] = i;
+   }
+   cout << "Cached layer " << featureLayer << " activations of " << numSamples << " training sets ("
+        << cacheBytes/(1024.0*1024.0) << " MB" << (mapped ? " mapped from \"" + cacheFile + "\"" : "")
+        << ")" << endl;
+
+}  //FeatureCacheDataset::FeatureCacheDataset(...)
+
+long FeatureCacheDataset::size()
+{
+   return numSamples;
+}
+
+/*
+ * Rewinds the cache, reshuffling with the same stream as the resident dataset
+ * if shuffling is on
+ */
+void FeatureCacheDataset::startEpoch(int epoch)
+{
+   cursor = 0;
+   if (shuffleData)
+   {
+      Philox generator(runSeed(), RNG_SHUFFLE, epoch);
+      shuffle(order.begin(), order.end(), generator);
+   }
+   return;
+}
+
+/*
+ * Hands out the cached activations of the next training set
+ */
+bool FeatureCacheDataset::next(Sample& sample)
+{
+   if (cursor >= numSamples)
+   {
+      return false;
+   }
+   long i = order[cursor++];
+   sample.input = cache + i*stride;
+   sample.truth = cache + i*stride + featureSize;
+   sample.index = indices[i];
+   sample.layer = featureLayer;
+   sample.bits = NULL;
+
+   return true;
+}
+
+/*
+ * Destructor - frees or unmaps the cache (a mapped cache file is deleted, it is only
+ * valid for the weights it was built with)
+ */
+FeatureCacheDataset::~FeatureCacheDataset()
+{
+   if (mapped)
+   {
+      munmap(cache, cacheBytes);
+      unlink(cacheFile.c_str());
+   }
+   else
+   {
+      delete[] cache;
+      trackFree(MEM_DATASET, cacheBytes);
+   }
+}
+
+
+/*
+ * Constructor for the scheduled dataset - every set is trained on until its error is known
+ * @param sourceSets the dataset whose training sets are scheduled
+ * @param minLoss the error below which a training set counts as learned (the minError of
+ * the network, which the mean error has to go below)
+ */
+ScheduledDataset::ScheduledDataset(Dataset* sourceSets, double minLoss)
+{
+   source = sourceSets;
+   easyLoss = minLoss;
+   full = true;
+   currentEpoch = 0;
+   epochSets = 0;
+   totalSets = 0;
+   offeredSets = 0;
+}
+
+long ScheduledDataset::size()
+{
+   return source->size();
+}
+
+/*
+ * Starts an epoch - a full one every fullErrorInterval epochs, or when the estimated error
+ * went below easyLoss in the last one (only an exact error can end the training)
+ * @param epoch the index of the epoch being started
+ */
+void ScheduledDataset::startEpoch(int epoch)
+{
+   bool converging = epoch > 0 && !full && epochError(0.0) < easyLoss;
+   full = epoch == 0 || fullErrorInterval <= 1 || epoch % fullErrorInterval == 0 || converging;
+   currentEpoch = epoch;
+   epochSets = 0;
+   source->startEpoch(epoch);
+   return;
+}
+
+/*
+ * Whether a training set is trained on this epoch - always if its error is unknown or at
+ * least easyLoss, otherwise with probability easyRate (decided by the set's own random
+ * stream for the epoch, so runs are repeatable)
+ */
+bool ScheduledDataset::wanted(Sample& sample)
+{
+   if (full || sample.index >= losses.size() || losses[sample.index] < 0.0 || losses[sample.index] >= easyLoss)
+   {
+      return true;
+   }
+   Philox generator(runSeed(), RNG_SCHEDULE, currentEpoch, sample.index);
+   return generator.uniform() < easyRate;
+}
+
+/*
+ * Hands out the next training set of the epoch that is trained on
+ * @param sample filled in with the next training set
+ * @return false if the epoch is finished
+ */
+bool ScheduledDataset::next(Sample& sample)
+{
+   while (source->next(sample))
+   {
+      offeredSets++;
+      if (wanted(sample))
+      {
+         epochSets++;
+         totalSets++;
+         return true;
+      }
+   }
+   return false;
+}
+
+/*
+ * Records the error of a training set that was just trained on
+ */
+void ScheduledDataset::reportLoss(Sample& sample, double loss)
+{
+   if (sample.index >= losses.size())
+   {
+      losses.resize(sample.index + 1, -1.0);
+   }
+   losses[sample.index] = loss;
+   return;
+}
+
+/*
+ * The error of the epoch - exact in a full epoch, otherwise the mean of the last error of
+ * every training set (the sets that were skipped keep the error they had when last seen)
+ * @param sumError the sum of the errors of the sets handed out this epoch
+ */
+double ScheduledDataset::epochError(double sumError)
+{
+   if (full)
+   {
+      return sumError/(1.0*size());
+   }
+   double lossSum = 0.0;
+   long known = 0;
+   for (long i = 0; i < losses.size(); i++)
+   {
+      if (losses[i] >= 0.0)
+      {
+         lossSum += losses[i];
+         known++;
+      }
+   }
+   return known == 0 ? 0.0 : lossSum/known;
+}
+
+bool ScheduledDataset::exactError()
+{
+   return full;
+}
+
+/*
+ * Stops the source's work for the unfinished epoch
+ */
+void ScheduledDataset::stop()
+{
+   source->stop();
+   return;
+}
+
+/*
+ * The fraction of the training sets handed out by the source that were trained on
+ */
+double ScheduledDataset::trainedFraction()
+{
+   return offeredSets == 0 ? 1.0 : totalSets/(1.0*offeredSets);
+}
@@ -0,0 +1,243 @@
+/*
+ * Header file for the dataset classes - Contains declarations for the
+ * sources of training sets that the train() loop consumes.
+ *
+ * A Dataset hands out one training set (input activations + truth values) at
+ * a time, so the trainer never has to know whether the data is resident in memory
+ * or being streamed from disk in chunks.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/2/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <stdint.h>
+
+#include "network.hpp"
+
+using namespace std;
+
+/*
+ * Global variables storing the dataset options (can be overridden in the config file)
+ */
+extern int streamData;
+extern int chunkSize;
+extern int shuffleData;
+extern string cacheFile;
+extern int scheduleSamples;
+extern double easyRate;
+extern int fullErrorInterval;
+
+/*
+ * A single training set handed out by a dataset. The pointers stay valid
+ * until the next call to next() on the dataset that produced them.
+ * index is the position of the training set in the file numbering (train/trainN)
+ * layer is the network layer the input activations belong to (0 unless they are cached
+ * outputs of frozen layers)
+ * bits are the input activations packed into bits if the inputs are binarized (NULL otherwise)
+ */
+struct Sample
+{
+   double* input;
+   double* truth;
+   long index;
+   int layer;
+   const uint64_t* bits;
+};
+
+/*
+ * Interface for a source of training sets. An epoch is started with startEpoch()
+ * and then next() is called until it returns false. The trainer reports the error of
+ * every training set it handed out with reportLoss() and asks epochError() for the error
+ * of the epoch - only a dataset that skips training sets needs to do anything with them.
+ */
+class Dataset
+{
+   public:
+      virtual long size() = 0;
+      virtual void startEpoch(int epoch) = 0;
+      virtual bool next(Sample& sample) = 0;
+      virtual void reportLoss(Sample& sample, double loss) {}
+      virtual double epochError(double sumError) { return sumError/(1.0*size()); }
+      virtual bool exactError() { return true; }      //False if epochError() is an estimate
+      virtual void stop() {}                          //Stops any work still running for the epoch
+      virtual ~Dataset() {}
+
+};    //class Dataset
+
+
+/*
+ * Dataset over training sets that are already fully in memory (the arrays
+ * read in by the Reader). The arrays are not copied or owned.
+ */
+class ResidentDataset : public Dataset
+{
+   double** inputs;
+   double** truths;
+   long numSamples;
+   long cursor;
+   vector<long> order;
+
+   public:
+      ResidentDataset(double** inputArr, double** truthArr, long numSets);
+      long size();
+      void startEpoch(int epoch);
+      bool next(Sample& sample);
+
+};    //class ResidentDataset
+
+
+/*
+ * Dataset over binarized training sets (see binary.hpp) that are already in memory - the
+ * Reader's input bits, bitWords(numIn) words per set. Each set is handed out as its bits,
+ * which the trainer runs with runBits(), and also unpacked into 0s and 1s for anything
+ * else that reads the input activations. The arrays are not copied or owned.
+ */
+class BinaryDataset : public Dataset
+{
+   const uint64_t* bits;
+   double** truths;
+   long numSamples;
+   int numInputs;
+   int numWords;
+   long cursor;
+   vector<long> order;
+   vector<double> unpacked;      //Input activations of the set handed out last
+
+   public:
+      BinaryDataset(const uint64_t* packedInputs, double** truthArr, long numSets, int numIn);
+      long size();
+      void startEpoch(int epoch);
+      bool next(Sample& sample);
+
+};    //class BinaryDataset
+
+
+/*
+ * Dataset that streams training sets from disk in fixed-size chunks. Only two
+ * chunks are ever resident - the one being consumed and the one being read ahead
+ * on a background thread - so memory is bounded by the chunk size rather than by
+ * the number of training sets.
+ *
+ * With shuffleData set, the chunk order is shuffled every epoch and so is the order
+ * of the training sets inside each chunk (block shuffling), which keeps disk reads
+ * sequential within a chunk.
+ */
+class StreamingDataset : public Dataset
+{
+   long numSamples;
+   int numInputs;
+   int numOutputs;
+   long chunkLength;
+   long numChunks;
+   int shuffle;
+
+   double* inputBuffer[2];       //Double buffered - one chunk in use, one loading
+   double* truthBuffer[2];
+   long bufferCount[2];          //Number of sets in each buffer
+   long bufferChunk[2];          //Which chunk each buffer holds
+
+   int currentBuffer;
+   long chunkCursor;             //Position in chunkOrder of the chunk in use
+   long setCursor;               //Position of the next set within the chunk in use
+   vector<long> chunkOrder;
+   vector<long> setOrder;
+   int currentEpoch;
+
+   thread loader;
+
+   private:
+      void loadChunk(int buffer, long chunk);
+      void startLoad(int buffer, long orderPos);
+      void waitLoad();
+      void useChunk(int buffer);
+
+   public:
+      StreamingDataset(long numSets, int numIn, int numOut, long chunkSets, int shuffleSets);
+      long size();
+      void startEpoch(int epoch);
+      bool next(Sample& sample);
+      ~StreamingDataset();
+
+};    //class StreamingDataset
+
+
+/*
+ * Dataset that runs every training set of another dataset through the frozen bottom
+ * layers of a network once, and from then on hands out the cached activations of the
+ * first trained layer instead of the inputs. The cache is one block of memory, or a
+ * memory mapped file (cacheFile) so that a large cache can be paged out by the OS.
+ * The source dataset is only used while building the cache and is not owned.
+ */
+class FeatureCacheDataset : public Dataset
+{
+   long numSamples;
+   int featureLayer;
+   int featureSize;
+   int numOutputs;
+   long stride;                  //Doubles per cached set (features then truth values)
+   double* cache;
+   long cacheBytes;
+   bool mapped;
+   long cursor;
+   vector<long> order;
+   vector<long> indices;         //File numbering of each cached set
+
+   public:
+      FeatureCacheDataset(Dataset* source, Network& net, int layer, int layerSize, int numOut);
+      long size();
+      void startEpoch(int epoch);
+      bool next(Sample& sample);
+      ~FeatureCacheDataset();
+
+};    //class FeatureCacheDataset
+
+
+/*
+ * Dataset that skips the training sets the network has already learned (hard example
+ * mining). It keeps the last error of every training set of another dataset and, in most
+ * epochs, hands out only the ones whose error is at least easyLoss plus a random easyRate
+ * fraction of the others, so training time goes to the sets that still need it.
+ * Every fullErrorInterval epochs, and in the epoch after the estimated error goes below
+ * easyLoss, it hands out every set so the error of that epoch is exact. The error of the
+ * other epochs is estimated from the last error of every set.
+ * The source dataset is not owned.
+ */
+class ScheduledDataset : public Dataset
+{
+   Dataset* source;
+   double easyLoss;
+   vector<double> losses;        //Last error of each training set (by index), -1 until seen
+   bool full;                    //Whether the current epoch hands out every set
+   int currentEpoch;
+   long epochSets;               //Sets handed out in the current epoch
+   long totalSets;               //Sets handed out in all epochs
+   long offeredSets;             //Sets the source handed out in all epochs
+
+   private:
+      bool wanted(Sample& sample);
+
+   public:
+      ScheduledDataset(Dataset* sourceSets, double minLoss);
+      long size();
+      void startEpoch(int epoch);
+      bool next(Sample& sample);
+      void reportLoss(Sample& sample, double loss);
+      double epochError(double sumError);
+      bool exactError();
+      void stop();
+      double trainedFraction();
+
+};    //class ScheduledDataset
+
+
+#endif /* DATASET_H */
@@ -0,0 +1,363 @@
+/*
+ * Implementation of the L-BFGS trainer. The training sets are copied out of the dataset
+ * once (the full batch is gone over several times per iteration, and streamed or augmented
+ * sets are only valid until the next one is handed out) and split into one contiguous
+ * block per thread. The blocks' gradients are added up in thread order, so the result
+ * does not depend on which thread finishes first.
+ *
+ * The search direction is found with the two-loop recursion of Nocedal and Wright
+ * (Numerical Optimization, algorithm 7.4) and the step length by backtracking from 1
+ * until the Armijo condition holds. Curvature pairs with s.y <= 0 are skipped so the
+ * implied Hessian stays positive definite.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/4/20
+ */
+
+
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <math.h>
+
+#include "lbfgs.hpp"
+#include "trainer.hpp"
+#include "metrics.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+/*
+ * Default optimizer options (can be overridden in the config file)
+ */
+int optimizer = OPT_SGD;
+int lbfgsHistory = 10;
+int lbfgsThreads = 0;         //0 uses every hardware thread
+
+static const double ARMIJO = 1e-4;           //Fraction of the predicted decrease a step must achieve
+static const int MAX_BACKTRACKS = 30;
+
+
+/*
+ * The training sets copied out of the dataset - the inputs and truth values of each set
+ * next to each other
+ */
+struct Batch
+{
+   vector<double> values;
+   long numSets;
+   int numIn;
+   int numOut;
+   int layer;           //The layer the inputs belong to (above 0 for cached activations)
+};
+
+int lbfgsThreadCount()
+{
+   int threads = lbfgsThreads > 0 ? lbfgsThreads : (int) thread::hardware_concurrency();
+   return max(threads, 1);
+}
+
+/*
+ * The optimizer keeps x, g, d, the trial x and g, one partial gradient per thread and
+ * 2 vectors per curvature pair, and every thread but the first has a replica of the network
+ */
+long lbfgsFootprint(int numLayers, LayerSpec* specs, long* byCategory)
+{
+   long numWeights = countWeights(numLayers, specs);
+   int numThreads = lbfgsThreadCount();
+   long optimizerBytes = (5L + numThreads + 2L*max(lbfgsHistory, 1))*numWeights*sizeof(double);
+   long replicaWeights = (numThreads - 1)*numWeights*sizeof(double);
+   long replicaActivations = (numThreads - 1)*activationBytes(numLayers, specs);
+
+   byCategory[MEM_OPTIMIZER] += optimizerBytes;
+   byCategory[MEM_WEIGHTS] += replicaWeights;
+   byCategory[MEM_GRADIENTS] += replicaWeights;
+   byCategory[MEM_ACTIVATIONS] += replicaActivations;
+   return optimizerBytes + 2*replicaWeights + replicaActivations;
+}
+
+static double dot(const vector<double>& a, const vector<double>& b)
+{
+   double sum = 0.0;
+   for (long k = 0; k < a.size(); k++)
+   {
+      sum += a[k]*b[k];
+   }
+   return sum;
+}
+
+/*
+ * Computes the mean error and the mean gradient of the full batch at the weights x
+ * @param replicas one network per thread (each thread runs its own block of sets)
+ * @param partials the gradient sum of each thread's block
+ * @param gradient set to the mean gradient
+ * @return the mean error over the training sets
+ */
+static double evaluate(Batch& batch, vector<Network*>& replicas, vector<vector<double> >& partials,
+                       const vector<double>& x, vector<double>& gradient)
+{
+   TraceScope scope("full batch gradient");
+   int numThreads = replicas.size();
+   vector<double> errors(numThreads, 0.0);
+   long stride = batch.numIn + batch.numOut;
+
+   parallelFor(numThreads, numThreads, [&](int t)
+   {
+      Network& net = *replicas[t];
+      net.setParameters(x.data());
+      fill(partials[t].begin(), partials[t].end(), 0.0);
+
+      long first = batch.numSets*t/numThreads;
+      long last = batch.numSets*(t + 1)/numThreads;
+      for (long s = first; s < last; s++)
+      {
+         double* input = &batch.values[s*stride];
+         net.setTruth(input + batch.numIn);
+         net.runFrom(batch.layer, input);
+         errors[t] += net.error();
+         net.accumulateGradient(partials[t].data());
+      }
+   });
+
+   double error = 0.0;
+   fill(gradient.begin(), gradient.end(), 0.0);
+   for (int t = 0; t < numThreads; t++)
+   {
+      error += errors[t];
+      for (long k = 0; k < gradient.size(); k++)
+      {
+         gradient[k] += partials[t][k];
+      }
+   }
+   for (long k = 0; k < gradient.size(); k++)
+   {
+      gradient[k] /= batch.numSets;
+   }
+   return error/batch.numSets;
+
+}  //static double evaluate(...)
+
+/*
+ * Two-loop recursion - sets d to -H*g, where H is the inverse Hessian approximation built
+ * from the count newest pairs (scaled by s.y/y.y of the newest pair). The pairs are kept in a
+ * ring, the newest at index newest.
+ */
+static void direction(vector<vector<double> >& sHistory, vector<vector<double> >& yHistory,
+                      vector<double>& rho, int count, int newest, const vector<double>& g, vector<double>& d)
+{
+   int size = sHistory.size();
+   vector<double> alpha(size);
+   d = g;
+
+   for (int c = 0; c < count; c++)           //Newest to oldest
+   {
+      int h = (newest - c + size) % size;
+      alpha[h] = rho[h]*dot(sHistory[h], d);
+      for (long k = 0; k < d.size(); k++)
+      {
+         d[k] -= alpha[h]*yHistory[h][k];
+      }
+   }
+
+   double gamma = count > 0 ? 1.0/(rho[newest]*dot(yHistory[newest], yHistory[newest])) : 1.0;
+   for (long k = 0; k < d.size(); k++)
+   {
+      d[k] *= gamma;
+   }
+
+   for (int c = count - 1; c >= 0; c--)      //Oldest to newest
+   {
+      int h = (newest - c + size) % size;
+      double beta = rho[h]*dot(yHistory[h], d);
+      for (long k = 0; k < d.size(); k++)
+      {
+         d[k] += sHistory[h][k]*(alpha[h] - beta);
+      }
+   }
+
+   for (long k = 0; k < d.size(); k++)
+   {
+      d[k] = -d[k];
+   }
+   return;
+
+}  //static void direction(...)
+
+/*
+ * Trains the network with full-batch L-BFGS. Each iteration is logged like an epoch of
+ * train() (the step length takes the place of lambda, and all of the iteration's time is
+ * counted as update time).
+ * @param numIn the size of the layer the training sets start at
+ * @param numOut the number of truth values per set
+ * @param n the network to train (its lambda is not used)
+ * @param data the training sets (only the first epoch is used)
+ * @return 1 if the error went below minError, 3 if it was stopped early (time budget or
+ * signal - every accepted step lowers the error, so the network keeps the best weights
+ * either way), 0 otherwise
+ */
+int trainLbfgs(int numIn, int numOut, Network& n, Dataset& data)
+{
+   Hyperparameters& params = n.hyperparameters();
+
+   /*
+    * Copying the full batch out of the dataset
+    */
+   Batch batch;
+   batch.numIn = numIn;
+   batch.numOut = numOut;
+   batch.layer = 0;
+   batch.values.reserve(data.size()*(numIn + numOut));
+   Sample sample;
+   data.startEpoch(0);
+   while (data.next(sample))
+   {
+      batch.values.insert(batch.values.end(), sample.input, sample.input + numIn);
+      batch.values.insert(batch.values.end(), sample.truth, sample.truth + numOut);
+      batch.layer = sample.layer;
+   }
+   batch.numSets = batch.values.size()/(numIn + numOut);
+   trackAlloc(MEM_DATASET, batch.values.size()*sizeof(double));
+   if (batch.numSets == 0)
+   {
+      cout << "No training sets for L-BFGS" << endl;
+      trackFree(MEM_DATASET, batch.values.size()*sizeof(double));
+      return 0;
+   }
+
+   /*
+    * The network itself is the first replica
+    */
+   int numThreads = min((long) lbfgsThreadCount(), batch.numSets);
+   vector<Network*> replicas(1, &n);
+   for (int t = 1; t < numThreads; t++)
+   {
+      replicas.push_back(n.replica());
+   }
+
+   long numWeights = n.numParameters();
+   int historySize = max(lbfgsHistory, 1);
+   vector<double> x(numWeights), g(numWeights), d(numWeights), xTrial(numWeights), gTrial(numWeights);
+   vector<vector<double> > partials(numThreads, vector<double>(numWeights));
+   vector<vector<double> > sHistory(historySize, vector<double>(numWeights));
+   vector<vector<double> > yHistory(historySize, vector<double>(numWeights));
+   vector<double> rho(historySize);
+   int count = 0;
+   int newest = historySize - 1;
+   long optimizerBytes = (5L + numThreads + 2L*historySize)*numWeights*sizeof(double);
+   trackAlloc(MEM_OPTIMIZER, optimizerBytes);
+
+   cout << "Training with L-BFGS (" << historySize << " curvature pairs, " << numThreads
+        << " threads, " << batch.numSets << " training sets)" << endl;
+
+   n.getParameters(x.data());
+   double error = evaluate(batch, replicas, partials, x, g);
+   bool errorReachedThreshold = error < params.minError;
+   bool stopped = false;
+   Metrics metrics;
+   TrainingBudget budget;
+
+   for (int i = 0; i < params.maxIter && !errorReachedThreshold; i++)
+   {
+      if (!budget.allowsEpoch())
+      {
+         stopped = true;
+         break;
+      }
+      metrics.startEpoch();
+      metrics.start();
+
+      direction(sHistory, yHistory, rho, count, newest, g, d);
+      double slope = dot(g, d);
+      if (slope >= 0.0)                      //Not a descent direction - start over from -g
+      {
+         count = 0;
+         for (long k = 0; k < numWeights; k++)
+         {
+            d[k] = -g[k];
+         }
+         slope = -dot(g, g);
+      }
+
+      /*
+       * Without curvature pairs the direction is the raw gradient, so the first step is
+       * limited to a length of 1
+       */
+      double step = count > 0 ? 1.0 : min(1.0, 1.0/sqrt(-slope));
+      double trialError = error;
+      bool accepted = false;
+      for (int b = 0; b < MAX_BACKTRACKS && !accepted; b++)
+      {
+         for (long k = 0; k < numWeights; k++)
+         {
+            xTrial[k] = x[k] + step*d[k];
+         }
+         trialError = evaluate(batch, replicas, partials, xTrial, gTrial);
+         for (long s = 0; s < batch.numSets; s++)
+         {
+            metrics.countSample();
+         }
+         accepted = trialError <= error + ARMIJO*step*slope;
+         if (!accepted)
+         {
+            step *= 0.5;
+         }
+      }
+      budget.endEpoch();
+
+      if (!accepted)
+      {
+         metrics.stop(PHASE_UPDATE);
+         metrics.endEpoch(i, error, 0.0, true);
+         if (count == 0)
+         {
+            cout << "Line search failed along the gradient - stopping" << endl;
+            break;
+         }
+         count = 0;                           //Retry from the gradient without the history
+         continue;
+      }
+
+      /*
+       * Storing the curvature pair of the step if it keeps the approximation positive definite
+       */
+      double curvature = 0.0;
+      for (long k = 0; k < numWeights; k++)
+      {
+         curvature += (xTrial[k] - x[k])*(gTrial[k] - g[k]);
+      }
+      if (curvature > 1e-12)
+      {
+         newest = (newest + 1) % historySize;       //Overwrites the oldest pair once the history is full
+         for (long k = 0; k < numWeights; k++)
+         {
+            sHistory[newest][k] = xTrial[k] - x[k];
+            yHistory[newest][k] = gTrial[k] - g[k];
+         }
+         rho[newest] = 1.0/curvature;
+         count = min(count + 1, historySize);
+      }
+
+      x.swap(xTrial);
+      g.swap(gTrial);
+      error = trialError;
+      errorReachedThreshold = error < params.minError;
+
+      metrics.stop(PHASE_UPDATE);
+      metrics.endEpoch(i, error, step, errorReachedThreshold || i == params.maxIter - 1);
+
+   }  //for (int i = 0; i < params.maxIter && !errorReachedThreshold; i++)
+   metrics.summary();
+
+   n.setParameters(x.data());                //The last evaluation may have been a rejected trial
+
+   for (int t = 1; t < numThreads; t++)
+   {
+      delete replicas[t];
+   }
+   trackFree(MEM_OPTIMIZER, optimizerBytes);
+   trackFree(MEM_DATASET, batch.values.size()*sizeof(double));
+
+   return errorReachedThreshold ? 1 : (stopped ? 3 : 0);
+
+}  //int trainLbfgs(...)
@@ -0,0 +1,57 @@
+/*
+ * Header file for the L-BFGS trainer - Contains declarations for training a network
+ * with full-batch L-BFGS instead of the per-training-set updates of train().
+ *
+ * Every iteration computes the error and gradient over all of the training sets (split
+ * between threads, each with its own replica of the network), turns the gradient into a
+ * search direction with the last lbfgsHistory curvature pairs and picks the step length
+ * with a backtracking line search. With the few training sets this network is trained on,
+ * that takes far fewer iterations than stochastic gradient descent.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/4/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef LBFGS_H
+#define LBFGS_H
+
+#include "network.hpp"
+#include "dataset.hpp"
+
+using namespace std;
+
+/*
+ * The optimizers a network can be trained with
+ */
+enum Optimizer {OPT_SGD, OPT_LBFGS};
+
+/*
+ * Global variables storing the optimizer options (can be set in the config file)
+ */
+extern int optimizer;
+extern int lbfgsHistory;
+extern int lbfgsThreads;
+
+/*
+ * The number of threads (and network replicas) the gradient is computed on
+ */
+int lbfgsThreadCount();
+
+/*
+ * Adds the memory the L-BFGS trainer needs for the given topology to the estimate by
+ * category (see estimateFootprint) and returns the bytes added
+ */
+long lbfgsFootprint(int numLayers, LayerSpec* specs, long* byCategory);
+
+/*
+ * Trains the network with L-BFGS until its maxIter iterations are done or the error goes
+ * below its minError. numIn is the size of the layer the training sets start at.
+ * Returns 1 if the error went below minError, 0 otherwise.
+ */
+int trainLbfgs(int numIn, int numOut, Network& n, Dataset& data);
+
+
+#endif /* LBFGS_H */
@@ -0,0 +1,566 @@
+/*
+ * Post-training low-rank factorization. Reads a trained network (the input file's topology
+ * with hasWeights set) and replaces each large fully connected weights layer W (a x b) with
+ * its truncated SVD: W ~ U S V^T, kept to rank r, becomes two thin layers a x r and r x b
+ * with a linear layer of r neurons between them, so the forward pass does r(a + b)
+ * multiply-adds instead of ab. Each factor gets the square root of the singular values,
+ * so the two thin matrices have the same scale.
+ *
+ * For every rank asked for (and for the ranks that keep a given fraction of each layer's
+ * energy, the sum of its squared singular values) it reports the multiply-adds and weights
+ * of the factored network and its error and accuracy on the training sets (train/trainN),
+ * next to the original network's. With --finetune the factored networks are trained for a
+ * few epochs first (at --finetune-lambda, much smaller than a training run's lambda - the
+ * factored weights are already close) and are reported before and after; a network whose
+ * error goes up keeps its untuned weights.
+ * --write saves one of them as a new input file and weights file, which run like any other
+ * trained network (the linear layers show up in its topology).
+ *
+ * Usage: ./lowrank inputfile (configs) (--ranks 8,16,32,64) (--energy 0.9) (--min-weights 50000)
+ *                  (--finetune epochs) (--finetune-lambda 0.001) (--write rank|energy) (--name lowrank_net)
+ * Layers with fewer than --min-weights weights are left alone, as is a layer whose rank
+ * would not make its forward pass cheaper.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/8/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+#include "network.hpp"
+#include "reader.hpp"
+#include "dataset.hpp"
+#include "trainer.hpp"
+#include "metrics.hpp"
+#include "projection.hpp"
+#include "random.hpp"
+
+using namespace std;
+
+/*
+ * Defined by the driver of every program that links the Reader (not used here)
+ */
+string outputFile = "finalweights";
+
+/*
+ * The truncated SVD of one weights layer - the left (a long) and right (b long) singular
+ * vectors of every singular value, largest first
+ */
+struct Factors
+{
+   int layer;
+   vector<double> singular;
+   vector<vector<double> > left;
+   vector<vector<double> > right;
+};
+
+/*
+ * One network to report - the original (every rank 0) or a factored one
+ */
+struct Candidate
+{
+   string label;
+   vector<int> ranks;                  //Rank of each factored layer, 0 to leave it as it is
+   vector<LayerSpec> specs;
+   vector<vector<vector<double> > > weights;
+};
+
+
+/*
+ * Takes the SVD of the weights layer n ([source][destination], a x b) from the eigenvectors
+ * of the smaller of W^T W and W W^T - the eigenvalues are the squared singular values, and
+ * the singular vectors of the other side are W v / s (or W^T u / s)
+ */
+static Factors factorLayer(vector<vector<vector<double> > >& weights, int n)
+{
+   vector<vector<double> >& w = weights[n];
+   int a = w.size();
+   int b = w[0].size();
+   bool rightSide = b <= a;            //Diagonalize W^T W (b x b)
+   int size = min(a, b);
+
+   vector<vector<double> > gram(size, vector<double>(size, 0.0));
+   for (int p = 0; p < size; p++)
+   {
+      for (int q = 0; q <= p; q++)
+      {
+         double dot = 0.0;
+         if (rightSide)
+         {
+            for (int j = 0; j < a; j++)
+            {
+               dot += w[j][p]*w[j][q];
+            }
+         }
+         else
+         {
+            for (int i = 0; i < b; i++)
+            {
+               dot += w[p][i]*w[q][i];
+            }
+         }
+         gram[p][q] = dot;
+         gram[q][p] = dot;
+      }
+   }
+   vector<double> eigenvalues;
+   symmetricEigen(gram, eigenvalues);
+
+   Factors factors;
+   factors.layer = n;
+   for (int c = 0; c < size; c++)
+   {
+      double s = sqrt(max(eigenvalues[c], 0.0));
+      if (s <= 1e-12*sqrt(max(eigenvalues[0], 0.0)))
+      {
+         break;                        //The rest of the layer is exactly zero
+      }
+      vector<double> u(a, 0.0);
+      vector<double> v(b, 0.0);
+      if (rightSide)
+      {
+         for (int i = 0; i < b; i++)
+         {
+            v[i] = gram[i][c];
+         }
+         for (int j = 0; j < a; j++)
+         {
+            for (int i = 0; i < b; i++)
+            {
+               u[j] += w[j][i]*v[i];
+            }
+            u[j] /= s;
+         }
+      }
+      else
+      {
+         for (int j = 0; j < a; j++)
+         {
+            u[j] = gram[j][c];
+         }
+         for (int i = 0; i < b; i++)
+         {
+            for (int j = 0; j < a; j++)
+            {
+               v[i] += w[j][i]*u[j];
+            }
+            v[i] /= s;
+         }
+      }
+      factors.singular.push_back(s);
+      factors.left.push_back(u);
+      factors.right.push_back(v);
+   }
+   return factors;
+
+}  //static Factors factorLayer(...)
+
+/*
+ * The smallest rank that keeps the given fraction of a layer's energy
+ */
+static int energyRank(Factors& factors, double energy)
+{
+   double total = 0.0;
+   for (int c = 0; c < factors.singular.size(); c++)
+   {
+      total += factors.singular[c]*factors.singular[c];
+   }
+   double kept = 0.0;
+   for (int c = 0; c < factors.singular.size(); c++)
+   {
+      kept += factors.singular[c]*factors.singular[c];
+      if (kept >= energy*total)
+      {
+         return c + 1;
+      }
+   }
+   return factors.singular.size();
+}
+
+/*
+ * Whether factoring the weights layer from in to out at the given rank makes the forward
+ * pass cheaper - r(a + b) multiply-adds instead of ab, plus the new linear layer's own work
+ */
+static bool factoringPays(LayerSpec& in, LayerSpec& out, int rank)
+{
+   LayerSpec plain[] = {in, out};
+   LayerSpec factored[] = {in, {LAYER_LINEAR, rank, 1, 1, 0}, out};
+   return forwardFlops(3, factored) < forwardFlops(2, plain);
+}
+
+/*
+ * Builds the layers and weights of a candidate - each factored layer n becomes
+ * a -> linear r -> b, with weights U sqrt(S) and sqrt(S) V^T
+ */
+static void buildCandidate(Candidate& candidate, vector<LayerSpec>& specs, vector<vector<vector<double> > >& weights,
+                           vector<Factors>& factors)
+{
+   candidate.specs.clear();
+   candidate.weights.clear();
+   candidate.specs.push_back(specs[0]);
+   int f = 0;
+   for (int n = 0; n < specs.size() - 1; n++)
+   {
+      int rank = 0;
+      if (f < factors.size() && factors[f].layer == n)
+      {
+         rank = candidate.ranks[f];
+         f++;
+      }
+      if (rank == 0)
+      {
+         candidate.specs.push_back(specs[n+1]);
+         candidate.weights.push_back(weights[n]);
+         continue;
+      }
+
+      Factors& layer = factors[f - 1];
+      int a = layerSize(specs[n]);
+      int b = layerSize(specs[n+1]);
+      vector<vector<double> > first(a, vector<double>(rank));
+      vector<vector<double> > second(rank, vector<double>(b));
+      for (int c = 0; c < rank; c++)
+      {
+         double scale = sqrt(layer.singular[c]);
+         for (int j = 0; j < a; j++)
+         {
+            first[j][c] = layer.left[c][j]*scale;
+         }
+         for (int i = 0; i < b; i++)
+         {
+            second[c][i] = layer.right[c][i]*scale;
+         }
+      }
+      candidate.specs.push_back({LAYER_LINEAR, rank, 1, 1, 0});
+      candidate.specs.push_back(specs[n+1]);
+      candidate.weights.push_back(first);
+      candidate.weights.push_back(second);
+   }
+   return;
+
+}  //static void buildCandidate(...)
+
+/*
+ * The mean error and the fraction of the training sets whose largest output is their
+ * largest truth value
+ */
+static void evaluate(Network& net, double** inputs, double** truths, int numSets, int numOut,
+                     double& error, double& accuracy)
+{
+   error = 0.0;
+   int correct = 0;
+   for (int s = 0; s < numSets; s++)
+   {
+      net.run(inputs[s]);
+      net.setTruth(truths[s]);
+      error += net.error();
+      if (truths[s][net.topK(1)[0]] == *max_element(truths[s], truths[s] + numOut))
+      {
+         correct++;
+      }
+   }
+   error /= max(numSets, 1);
+   accuracy = numSets == 0 ? 0.0 : correct/(1.0*numSets);
+   return;
+}
+
+/*
+ * Makes a network of a candidate (the weights are copied, the candidate keeps them)
+ */
+static Network* makeNetwork(Candidate& candidate)
+{
+   vector<int> sizes;
+   for (int n = 0; n < candidate.specs.size(); n++)
+   {
+      sizes.push_back(layerSize(candidate.specs[n]));
+   }
+   return new Network(candidate.specs.size(), sizes.data(), 1, candidate.weights, candidate.specs.data());
+}
+
+/*
+ * Writes a candidate as an input file (name) and its weights file (name.weights), with the
+ * projection of the original network's inputs next to them (name.weights.proj) if it has one
+ */
+static void writeCandidate(Network& net, Candidate& candidate, int numSets, string name, Projection* projection)
+{
+   ofstream input(name);
+   input << numSets << " 1 " << candidate.specs.size() << " 0" << endl;
+   for (int n = 0; n < candidate.specs.size(); n++)
+   {
+      bool raw = n == 0 && projection != NULL;       //The input file gives the inputs before the projection
+      input << (raw ? to_string(projection->inputs()) : layerName(candidate.specs[n])) << " ";
+   }
+   input << endl << name << ".weights" << endl;
+   input.close();
+   exportWeights(net.getWeights(), name + ".weights");
+   exportProjection(projection, name + ".weights");
+   cout << "Wrote the " << candidate.label << " network to \"" << name << "\" (weights in \""
+        << name << ".weights\")" << endl;
+   return;
+}
+
+
+/*
+ * Factors the network at every rank asked for and reports the tradeoffs
+ */
+int main(int argc, char* argv[])
+{
+   string file = "inputs";
+   string configFile = "";
+   string rankList = "8,16,32,64";
+   double energy = 0.0;
+   long minWeights = 50000;
+   int finetune = 0;
+   double finetuneLambda = 0.001;
+   string writeChoice = "";
+   string name = "lowrank_net";
+   vector<string> positional;
+   for (int a = 1; a < argc; a++)
+   {
+      string arg = argv[a];
+      if (arg == "--ranks" && a + 1 < argc)
+      {
+         rankList = argv[++a];
+      }
+      else if (arg == "--energy" && a + 1 < argc)
+      {
+         energy = atof(argv[++a]);
+      }
+      else if (arg == "--min-weights" && a + 1 < argc)
+      {
+         minWeights = atol(argv[++a]);
+      }
+      else if (arg == "--finetune" && a + 1 < argc)
+      {
+         finetune = atoi(argv[++a]);
+      }
+      else if (arg == "--finetune-lambda" && a + 1 < argc)
+      {
+         finetuneLambda = atof(argv[++a]);
+      }
+      else if (arg == "--write" && a + 1 < argc)
+      {
+         writeChoice = argv[++a];
+      }
+      else if (arg == "--name" && a + 1 < argc)
+      {
+         name = argv[++a];
+      }
+      else
+      {
+         positional.push_back(arg);
+      }
+   }
+   if (positional.size() > 0)
+   {
+      file = positional[0];
+   }
+   if (positional.size() > 1)
+   {
+      configFile = positional[1];
+   }
+
+   streamData = 1;                     //The training sets are read below, whatever the input file's mode
+   Reader reader = Reader(file, configFile, "");
+   int* metadata = reader.getMetaData();
+   int numSets = metadata[0];
+   int numLayers = metadata[2];
+   LayerSpec* readSpecs = reader.getLayerSpecs();
+   vector<LayerSpec> specs(readSpecs, readSpecs + numLayers);
+   int numOut = layerSize(specs[numLayers - 1]);
+   if (metadata[1] != 1)
+   {
+      cout << "The input file has no weights (hasWeights must be 1) - nothing to factor" << endl;
+      return 1;
+   }
+   vector<vector<vector<double> > > weights = reader.takeWeights();
+
+   /*
+    * The training sets (projected like the network's inputs if they are)
+    */
+   Projection* projection = reader.getProjection();
+   int rawInputs = projection != NULL ? projection->inputs() : layerSize(specs[0]);
+   if (!ifstream("train/train0").good())
+   {
+      cout << "No training sets in train/ - only the sizes are reported" << endl;
+      numSets = 0;
+   }
+   vector<double*> inputs(numSets);
+   vector<double*> truths(numSets);
+   vector<double> raw(rawInputs);
+   for (int s = 0; s < numSets; s++)
+   {
+      inputs[s] = new double[layerSize(specs[0])];
+      truths[s] = new double[numOut];
+      readSample(s, rawInputs, numOut, raw.data(), truths[s]);
+      if (projection != NULL)
+      {
+         projection->apply(raw.data(), inputs[s]);
+      }
+      else
+      {
+         copy(raw.begin(), raw.end(), inputs[s]);
+      }
+   }
+
+   /*
+    * The SVD of every large fully connected layer
+    */
+   vector<Factors> factors;
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      LayerSpec& out = specs[n+1];
+      if (isFullyConnected(out) && out.type != LAYER_LINEAR && (long) layerSize(specs[n])*layerSize(out) >= minWeights)
+      {
+         factors.push_back(factorLayer(weights, n));
+         cout << "Layer " << n << " (" << layerSize(specs[n]) << " x " << layerSize(out) << "): rank "
+              << factors.back().singular.size() << ", largest singular value " << factors.back().singular[0] << endl;
+      }
+   }
+   if (factors.empty())
+   {
+      cout << "No fully connected layer has " << minWeights << " weights - nothing to factor" << endl;
+      return 1;
+   }
+
+   /*
+    * The candidates - the original, each rank of the list and the energy ranks. A rank that
+    * would not make a layer's forward pass cheaper leaves it as it is.
+    */
+   vector<Candidate> candidates(1);
+   candidates[0].label = "original";
+   candidates[0].ranks.assign(factors.size(), 0);
+   vector<int> ranks;
+   stringstream list(rankList);
+   string token;
+   while (getline(list, token, ','))
+   {
+      if (atoi(token.c_str()) > 0)
+      {
+         ranks.push_back(atoi(token.c_str()));
+      }
+   }
+   for (int r = 0; r < ranks.size() + (energy > 0.0 ? 1 : 0); r++)
+   {
+      Candidate candidate;
+      candidate.label = r < ranks.size() ? "rank " + to_string(ranks[r]) : "energy " + to_string(energy).substr(0, 5);
+      for (int f = 0; f < factors.size(); f++)
+      {
+         int n = factors[f].layer;
+         int rank = r < ranks.size() ? ranks[r] : energyRank(factors[f], energy);
+         rank = min(rank, (int) factors[f].singular.size());
+         candidate.ranks.push_back(factoringPays(specs[n], specs[n+1], rank) ? rank : 0);
+      }
+      candidates.push_back(candidate);
+   }
+
+   /*
+    * Reporting every candidate (and fine-tuning the factored ones)
+    */
+   Candidate* toWrite = NULL;
+   Network* netToWrite = NULL;
+   bool keptUntuned = false;
+   runSeed();                          //Prints a clock seed now rather than between the rows
+   cout << endl << "network           ranks          multiply-adds   weights (MB)   error        accuracy";
+   cout << (finetune > 0 ? "   tuned error  tuned accuracy" : "") << endl;
+   for (int c = 0; c < candidates.size(); c++)
+   {
+      Candidate& candidate = candidates[c];
+      buildCandidate(candidate, specs, weights, factors);
+      Network* net = makeNetwork(candidate);
+      int layers = candidate.specs.size();
+
+      string rankText = "";
+      for (int f = 0; f < candidate.ranks.size(); f++)
+      {
+         rankText += (f > 0 ? "/" : "") + (candidate.ranks[f] > 0 ? to_string(candidate.ranks[f]) : string("-"));
+      }
+      double error, accuracy;
+      evaluate(*net, inputs.data(), truths.data(), numSets, numOut, error, accuracy);
+      cout << left;
+      cout.width(18);
+      cout << candidate.label;
+      cout.width(15);
+      cout << rankText;
+      cout.width(16);
+      cout << (long) (forwardFlops(layers, candidate.specs.data())/2.0);
+      cout.width(15);
+      cout << countWeights(layers, candidate.specs.data())*sizeof(double)/(1024.0*1024.0);
+      cout.width(13);
+      cout << error;
+      cout.width(9);
+      cout << accuracy*100.0;
+
+      if (finetune > 0 && c > 0 && numSets > 0)
+      {
+         ResidentDataset data(inputs.data(), truths.data(), numSets);
+         Metrics metrics;
+         vector<double> untuned(net->numParameters());
+         net->getParameters(untuned.data());
+         double untunedError = error;
+         net->hyperparameters().lambda = finetuneLambda;
+         for (int e = 0; e < finetune; e++)
+         {
+            trainEpoch(*net, data, e, metrics);
+         }
+         evaluate(*net, inputs.data(), truths.data(), numSets, numOut, error, accuracy);
+         cout << "   ";
+         cout.width(13);
+         cout << error;
+         cout << accuracy*100.0;
+         if (error > untunedError)      //Worse than before - the untuned weights are kept (and written)
+         {
+            net->setParameters(untuned.data());
+            cout << " *";
+            keptUntuned = true;
+         }
+      }
+      cout << right << endl;
+
+      bool chosen = writeChoice != "" && c > 0 &&
+                    (candidate.label == "rank " + writeChoice || (writeChoice == "energy" && candidate.label.find("energy") == 0));
+      if (chosen)
+      {
+         toWrite = &candidate;
+         netToWrite = net;
+      }
+      else
+      {
+         delete net;
+      }
+   }  //for (int c = 0; c < candidates.size(); c++)
+   cout << "(multiply-adds per forward pass, weights as doubles, error and accuracy (%) on the "
+        << numSets << " training sets)" << endl;
+   if (keptUntuned)
+   {
+      cout << "* fine-tuning made it worse, the untuned weights are kept (try a smaller --finetune-lambda)" << endl;
+   }
+   cout << endl;
+
+   if (writeChoice != "")
+   {
+      if (toWrite == NULL)
+      {
+         cout << "No candidate \"" << writeChoice << "\" to write (give one of the --ranks, or energy with --energy)" << endl;
+         return 1;
+      }
+      writeCandidate(*netToWrite, *toWrite, metadata[0], name, projection);
+      delete netToWrite;
+   }
+
+   for (int s = 0; s < numSets; s++)
+   {
+      delete[] inputs[s];
+      delete[] truths[s];
+   }
+   return 0;
+
+}  //int main(int argc, char* argv[])
@@ -17,24 +17,33 @@
 #include <iostream>
 #include <fstream> 
 #include <string>
+#include <algorithm>
 #include <stdlib.h>
 #include "network.hpp"
 #include "reader.hpp"
+#include "dataset.hpp"
+#include "augment.hpp"
+#include "metrics.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include "perfcounters.hpp"
+#include "trainer.hpp"
+#include "sweep.hpp"
+#include "lbfgs.hpp"
+#include "online.hpp"
+#include "pipeline.hpp"
+#include "binary.hpp"
 
 
 using namespace std; 
 
-extern double lambda;
-extern int maxIter;
-extern double randomWeightMin;
-extern double randomWeightMax;
-extern double minError;
 string outputFile = "finalweights";
 
+static const int TOP_CLASSES = 3;      //Classes printed by test()
 
 
-int train(int nOut, Network &n, int numIterations, double** trainData, double** truthVals);
-int test (int nOut, Network &n, double* testData);
+
+int test (int nOut, Network &n, double* testData, const uint64_t* testBits);
 
 
 
@@ -60,22 +69,65 @@ int main(int argc, char* argv[])
    string file = "inputs";            //Creating the file - if a name was given
    string configFile = "configs";
    string testFile = "testfile";
+   long memoryBudget = 0;             //0 means no budget
+   string sweepFile = "";             //Empty means train one network
+   string onlineSource = "";          //Empty means train (or test) once
+
+   /*
+    * Options start with "--" and can appear anywhere - everything else
+    * is one of the positional file names
+    * --memory-budget bytes   fails before anything is allocated if the estimated
+    *                         peak memory of the run is over the budget (K, M, G suffixes allowed)
+    * --trace file            records a timeline of loading, every layer of run() and
+    *                         updateWeights(), error() and exporting as a Chrome/Perfetto trace
+    * --perf                  counts cycles, instructions, cache/TLB misses and FLOPs of run()
+    *                         and updateWeights() with hardware counters and reports them at the end
+    * --sweep file            trains every hyperparameter configuration in the sweep file at once
+    *                         and keeps the best one (successive halving)
+    * --online source         keeps training on the training sets arriving on stdin ("-") or a FIFO,
+    *                         publishing the weights as it goes
+    */
+   vector<string> positional; 
+   for (int a = 1; a < argc; a++)
+   {
+      string arg = argv[a];
+      if (arg == "--memory-budget" && a + 1 < argc)
+      {
+         memoryBudget = parseBytes(argv[++a]);
+      }
+      else if (arg == "--trace" && a + 1 < argc)
+      {
+         traceStart(argv[++a]);
+      }
+      else if (arg == "--perf")
+      {
+         perfStart();
+      }
+      else if (arg == "--sweep" && a + 1 < argc)
+      {
+         sweepFile = argv[++a];
+      }
+      else if (arg == "--online" && a + 1 < argc)
+      {
+         onlineSource = argv[++a];
+      }
+      else
+      {
+         positional.push_back(arg);
+      }
+   }
    
-   if (argc == 2)
+   if (positional.size() >= 1)
    {
-      file = argv[1];      //If a filename is given, then use that filename
+      file = positional[0];      //If a filename is given, then use that filename
    }
-   else if (argc == 3)
+   if (positional.size() >= 2)
    {
-      file = argv[1];
-      configFile = argv[2];
-
+      configFile = positional[1];
    }
-   else if (argc == 4)
+   if (positional.size() >= 3)
    {
-      file = argv[1];
-      configFile = argv[2];
-      testFile = argv[3];
+      testFile = positional[2];
    }
 
    ifstream temp(configFile);
@@ -94,6 +146,71 @@ int main(int argc, char* argv[])
       configFile = "\0";
 
    }
+
+   /*
+    * With a memory budget, the peak footprint of the run is estimated from the
+    * topology and dataset options before anything big is allocated
+    */
+   if (memoryBudget > 0)
+   {
+      if (configFile != "\0")
+      {
+         readConfigFile(configFile);
+      }
+      int headerTrain, headerTestOrTrain; 
+      vector<LayerSpec> headerSpecs; 
+      readHeader(file, headerTrain, headerTestOrTrain, headerSpecs);
+
+      int headerInputs = layerSize(headerSpecs.front());
+      long setBytes = sizeof(double)*(headerInputs + layerSize(headerSpecs.back()));
+      bool bits = binarizeInputs == 1 && projectDims == 0;     //The Reader does not binarize projected inputs
+      if (bits)                            //Kept in memory as bits (the Reader turns streaming and augmentation off)
+      {
+         setBytes = bitWords(headerInputs)*sizeof(uint64_t) + sizeof(double)*layerSize(headerSpecs.back());
+      }
+      long datasetBytes = headerInputs*sizeof(double);
+      if (headerTestOrTrain == 1)
+      {
+         bool streamed = streamData == 1 && !bits;
+         bool augmented = augment == 1 && !bits;
+         datasetBytes = (streamed ? 2*min((long) chunkSize, (long) headerTrain) : headerTrain)*setBytes;
+         datasetBytes += augmented ? augmentQueue*setBytes : 0;
+         if (freezeLayers > 0 && !augmented && cacheFile == "")
+         {
+            int cachedLayer = min(freezeLayers, (int) headerSpecs.size() - 1);
+            datasetBytes += (long) headerTrain*(layerSize(headerSpecs[cachedLayer]) + layerSize(headerSpecs.back()))
+                            *sizeof(double);
+         }
+         if (optimizer == OPT_LBFGS)      //L-BFGS copies the full batch (of the first trained layer)
+         {
+            int startLayer = (freezeLayers > 0 && !augmented) ? min(freezeLayers, (int) headerSpecs.size() - 1) : 0;
+            long numSets = (long) headerTrain*(augmented ? max(augmentCopies, 1) : 1);
+            datasetBytes += numSets*(layerSize(headerSpecs[startLayer]) + layerSize(headerSpecs.back()))*sizeof(double);
+         }
+      }
+
+      long byCategory[NUM_MEMORY_CATEGORIES];
+      long estimate = estimateFootprint(headerSpecs.size(), headerSpecs.data(), datasetBytes, byCategory);
+      if (headerTestOrTrain == 1 && optimizer == OPT_LBFGS)
+      {
+         estimate += lbfgsFootprint(headerSpecs.size(), headerSpecs.data(), byCategory);
+      }
+      else if (headerTestOrTrain == 1)       //The copy of the best epoch's weights
+      {
+         long bestBytes = countWeights(headerSpecs.size(), headerSpecs.data())*sizeof(double);
+         byCategory[MEM_WEIGHTS] += bestBytes;
+         estimate += bestBytes;
+      }
+      cout << "Estimated peak memory:" << endl;
+      printFootprint(byCategory, estimate);
+      if (estimate > memoryBudget)
+      {
+         cout << "Estimated peak memory is over the budget of " << memoryBudget/(1024.0*1024.0)
+              << " MB - not running" << endl;
+         return 1;
+      }
+      cout << endl;
+   }
   
    /*
     * The reader takes in a properly formatted file containing network specifications and
@@ -107,8 +224,10 @@ int main(int argc, char* argv[])
     * Getting the input data stored by the reader after reading the 
     * user's input file. 
     */
-   vector<vector<vector<double> > > weights = reader.getWeights();
+   vector<vector<vector<double> > > weights = reader.takeWeights();
+   trackAlloc(MEM_WEIGHTS, weightsBytes(weights));
    int* layerSizes = reader.getLayerSizes();
+   LayerSpec* layerSpecs = reader.getLayerSpecs();
    int* metadata = reader.getMetaData();
    double** inputs = reader.getTrainingData();
    double** truths = reader.getTruths();
@@ -122,24 +241,225 @@ int main(int argc, char* argv[])
    int numOutputs = layerSizes[numLayers-1];
    int testOrTrain = metadata[3];
    
-   Network net = Network(numLayers, layerSizes, hasWeights, weights); //Creating the network object
+   /*
+    * A sweep trains its own networks on one resident copy of the training sets
+    */
+   if (sweepFile != "" && testOrTrain == 1)
+   {
+      if (perfEnabled)
+      {
+         cout << "Note - --perf is off during a sweep (the counters belong to one thread)" << endl;
+         perfEnabled = false;
+      }
+      if (timeBudget > 0.0)
+      {
+         cout << "Note - timeBudget is not used by a sweep (maxIter bounds its last rung)" << endl;
+         timeBudget = 0.0;
+      }
+      reader.loadTrainingData();
+      int result = runSweep(sweepFile, numLayers, layerSizes, layerSpecs, hasWeights, weights,
+                            reader.getTrainingData(), reader.getTruths(), numIter);
+      if (result == 0)
+      {
+         exportProjection(reader.getProjection(), outputFile);    //The sweep exported its best weights
+      }
+      traceFinish();
+      memoryReport();
+      return result;
+   }
+
+   /*
+    * The weights are moved into the network - from here on it holds the only copy
+    */
+   trackFree(MEM_WEIGHTS, weightsBytes(weights));
+   Network net = Network(numLayers, layerSizes, hasWeights, move(weights), layerSpecs); //Creating the network object
+
+   /*
+    * Fine-tuning - the bottom freezeLayers weights layers keep their weights
+    */
+   freezeLayers = min(freezeLayers, numLayers - 1);
+   for (int n = 0; n < freezeLayers; n++)
+   {
+      net.freezeLayer(n, true);
+   }
+   if (freezeLayers > 0 && hasWeights == 0)
+   {
+      cout << "Note - freezing " << freezeLayers << " layers of random weights" << endl;
+   }
+
+   /*
+    * Online learning starts from the network as loaded and replays the input file's
+    * training sets (if it has any) alongside the new ones
+    */
+   if (onlineSource != "")
+   {
+      if (reader.getProjection() != NULL)
+      {
+         cout << "Online learning takes the inputs as they are - turn the projection off (projectDims 0)" << endl;
+         return 1;
+      }
+      if (timeBudget > 0.0)
+      {
+         cout << "Note - timeBudget is not used by online learning (it runs until the stream ends)" << endl;
+         timeBudget = 0.0;
+      }
+      if (hasWeights == 0)
+      {
+         cout << "Note - online learning from random weights (set hasWeights to start from finalweights)" << endl;
+      }
+      Dataset* seedSets = NULL;
+      if (testOrTrain == 1 && reader.getPackedInputs() != NULL)
+      {
+         seedSets = new BinaryDataset(reader.getPackedInputs(), truths, numIter, layerSizes[0]);
+      }
+      else if (testOrTrain == 1 && streamData == 1)
+      {
+         seedSets = new StreamingDataset(numIter, layerSizes[0], numOutputs, chunkSize, 0);
+      }
+      else if (testOrTrain == 1)
+      {
+         seedSets = new ResidentDataset(inputs, truths, numIter);
+      }
+      runOnline(onlineSource, net, layerSizes[0], numOutputs, seedSets);
+      delete seedSets;
+      traceFinish();
+      if (perfEnabled)
+      {
+         perfReport(numLayers, layerSpecs);
+      }
+      memoryReport();
+      return 0;
+   }
    
    
+   /*
+    * The training sets are either the arrays the reader already holds or, when
+    * streaming is on, read from disk chunk by chunk while training
+    */
+   Dataset* trainingSets = NULL; 
+   Dataset* data = NULL; 
+   ScheduledDataset* scheduled = NULL;
+   int cachedLayer = 0;                //The layer training starts from
+   if (testOrTrain == 1)
+   {
+      if (reader.getPackedInputs() != NULL)
+      {
+         trainingSets = new BinaryDataset(reader.getPackedInputs(), truths, numIter, layerSizes[0]);
+      }
+      else if (streamData == 1)
+      {
+         trainingSets = new StreamingDataset(numIter, layerSizes[0], numOutputs, chunkSize, shuffleData);
+      }
+      else
+      {
+         trainingSets = new ResidentDataset(inputs, truths, numIter);
+      }
+      data = trainingSets; 
+
+      /*
+       * With augmentation on, the network trains on randomized copies of the
+       * training sets made on worker threads instead of the sets themselves
+       */
+      if (augment == 1)
+      {
+         data = new AugmentedDataset(trainingSets, layerSizes[0], numOutputs);
+      }
+
+      /*
+       * The outputs of the frozen layers never change, so they are computed once and
+       * training starts from them (not possible when the inputs are augmented every epoch)
+       */
+      if (freezeLayers > 0 && augment == 0)
+      {
+         data = new FeatureCacheDataset(trainingSets, net, freezeLayers, layerSizes[freezeLayers], numOutputs);
+         cachedLayer = freezeLayers;
+      }
+      else if (freezeLayers > 0)
+      {
+         cout << "Feature cache is off while augmenting - only backpropagation skips the frozen layers" << endl;
+      }
+
+      /*
+       * Loss-aware scheduling - most epochs skip the sets that are already learned (only
+       * train() reports the errors of the sets back, the other trainers go over all of them)
+       */
+      if (scheduleSamples == 1 && optimizer == OPT_SGD && pipelineStages <= 1)
+      {
+         scheduled = new ScheduledDataset(data, net.hyperparameters().minError);
+         cout << "Loss-aware scheduling - sets below an error of " << net.hyperparameters().minError
+              << " are trained on at a rate of " << easyRate << ", every set every "
+              << fullErrorInterval << " epochs" << endl;
+      }
+      else if (scheduleSamples == 1)
+      {
+         cout << "Loss-aware scheduling is only used with the SGD trainer" << endl;
+      }
+   }
+
    /*
     * The network is trained using the train method
-    * successful is an integer flag (0 for not, 1 for successful)
-    * representing if the network converged or not
+    * successful is an integer flag (0 for not, 1 for successful, 3 for stopped early)
+    * representing if the network converged or not. SIGINT and SIGTERM stop training
+    * after the current step, and the best weights are still exported.
     * 
     */
    int successful = 2; 
    if (testOrTrain == 1)
    {
-      successful = train(numOutputs, net, numIter, inputs, truths);
+      installStopHandlers();
+      if (timeBudget > 0.0)
+      {
+         cout << "Time budget of " << timeBudget << " s (" << budgetReserve << " s kept for exporting)" << endl;
+      }
+   }
+   if (testOrTrain == 1 && optimizer == OPT_LBFGS)
+   {
+      /*
+       * Full-batch L-BFGS goes over a fixed copy of the training sets on several threads
+       */
+      if (augment == 1)
+      {
+         cout << "Note - L-BFGS trains on the augmented copies of the first epoch only" << endl;
+      }
+      if (perfEnabled)
+      {
+         cout << "Note - --perf is off with L-BFGS (the counters belong to one thread)" << endl;
+         perfEnabled = false;
+      }
+      successful = trainLbfgs(layerSizes[cachedLayer], numOutputs, net, *data);
+   }
+   else if (testOrTrain == 1 && pipelineStages > 1)
+   {
+      successful = trainPipeline(numLayers, layerSpecs, net, *data);
+   }
+   else if (testOrTrain == 1)
+   {
+      successful = train(numOutputs, net, scheduled != NULL ? *scheduled : *data);
 
    }
    else
    {
-      test(numOutputs, net, testSet);
+      if (bf16Storage)
+      {
+         net.packBf16();      //run() uses the bf16 weights from here on
+      }
+      if (binaryWeights == 1 && reader.getTestBits() != NULL)
+      {
+         net.packBinary();    //And the first layer counts bits against the signs of its weights
+      }
+
+      /*
+       * Latency mode - the large layers of the single forward pass are split across threads
+       */
+      WorkPool pool(latencyThreads);
+      if (pool.size() > 1)
+      {
+         net.setPool(&pool);
+         cout << "Latency mode - layers of at least " << parallelMinWork << " multiply-adds run on "
+              << pool.size() << " threads" << endl;
+      }
+      test(numOutputs, net, testSet, reader.getTestBits());
+      net.setPool(NULL);
      
    }
    
@@ -151,17 +471,22 @@ int main(int argc, char* argv[])
     */ 
    if (successful == 1)
    {
-      std::cout << "Training cut short - error went below " << minError << endl << endl; 
+      std::cout << "Training cut short - error went below " << net.hyperparameters().minError << endl << endl; 
 
    }
    else if (successful == 2)
    {
       std::cout << "Testing complete. " << endl; 
       
+   }
+   else if (successful == 3)
+   {
+      std::cout << "Training stopped early - " << (stopSignal() != 0 ? "stop signal" : "time budget") << endl << endl;
+
    }
    else
    {
-      std::cout << "Training finished. " << maxIter << " iterations complete. " << endl << endl;
+      std::cout << "Training finished. " << net.hyperparameters().maxIter << " iterations complete. " << endl << endl;
 
    }
    if (successful != 2)
@@ -172,11 +497,28 @@ int main(int argc, char* argv[])
       * Debugging output - prints the test output for each training set
       * given by the network to make sure the results are somewhat accurate. 
       */
-      for (int setNum = 0; setNum < numIter; setNum++)
+      if (bf16Storage)
+      {
+         net.packBf16();      //The trained weights are run in bf16 from here on
+      }
+      if (binaryWeights == 1 && reader.getPackedInputs() != NULL)
+      {
+         net.packBinary();    //And with a binarized first layer
+      }
+      Sample sample; 
+      int numSets = 0;
+      int numCorrect = 0;            //Sets whose largest output is their largest truth value
+      trainingSets->startEpoch(0);
+      while (stopSignal() == 0 && trainingSets->next(sample))      //Straight to exporting after a signal
       {
-         double* outputs = net.run(inputs[setNum]);
+         double* outputs = sample.bits != NULL ? net.runBits(sample.bits) : net.run(sample.input);
+         numSets++;
+         if (sample.truth[net.topK(1)[0]] == *max_element(sample.truth, sample.truth + numOutputs))
+         {
+            numCorrect++;
+         }
 
-         std::cout << "Test output for " << inputs[setNum][0] << " and " << inputs[setNum][1]; 
+         std::cout << "Test output for " << sample.input[0] << " and " << sample.input[1]; 
          std::cout << ": "; 
 
          for (int i = 0; i < numOutputs; i++)   //Prints out the "i" outputs
@@ -186,31 +528,70 @@ int main(int argc, char* argv[])
          }
          std::cout << endl; 
 
-      }  //for (int setNum = 0; setNum < numIter; setNum++)
+      }  //while (trainingSets->next(sample))
+      if (numSets > 0)
+      {
+         std::cout << "Classified correctly: " << numCorrect << " of " << numSets << endl; 
+      }
+      if (scheduled != NULL)
+      {
+         std::cout << "Trained on " << 100.0*scheduled->trainedFraction() << "% of the training sets handed out" << endl;
+      }
       std::cout << endl; 
 
       /*
       * Echoing back hyperparameter + debugging information after the network has trained
       */
-      std::cout << "Lambda: " << lambda << endl; 
-      std::cout << "Max number of iterations: " << maxIter << endl;
-      std::cout << "Weight range: " << randomWeightMin << " to " << randomWeightMax << endl;
+      Hyperparameters& params = net.hyperparameters();
+      std::cout << "Lambda: " << params.lambda << endl; 
+      std::cout << "Max number of iterations: " << params.maxIter << endl;
+      std::cout << "Weight range: " << params.randomWeightMin << " to " << params.randomWeightMax << endl;
+      std::cout << "Weight init: " << initName(params.init) << " (seed " << params.seed << ")" << endl;
       std::cout << "Network configuration: "; 
 
       for (int n = 0; n < numLayers; n++)
       {
-         std::cout << layerSizes[n] << " "; 
+         std::cout << layerName(layerSpecs[n]) << " "; 
       }
       std::cout << endl << endl; 
 
       /*
       * Exporting weights out to a file
       */
-      exportWeights(net.getWeights(), outputFile);
+      if (bf16Storage)
+      {
+         exportWeightsBf16(net.getWeights(), outputFile);
+      }
+      else
+      {
+         exportWeights(net.getWeights(), outputFile);
+      }
+      exportProjection(reader.getProjection(), outputFile);
       std::cout << "Final weights saved to output file with name \"" << outputFile << "\"" << endl << endl;  
       
    
 
+   }
+   delete scheduled; 
+   if (data != trainingSets)
+   {
+      delete data; 
+   }
+   delete trainingSets; 
+   traceFinish();
+   if (perfEnabled)
+   {
+      perfReport(numLayers - cachedLayer, layerSpecs + cachedLayer);   //Only the layers that were run
+   }
+
+   /*
+    * Reporting the peak memory of the run (checked against the budget if there is one)
+    */
+   memoryReport();
+   if (memoryBudget > 0 && peakTotalBytes() > memoryBudget)
+   {
+      cout << "Peak memory went over the budget of " << memoryBudget/(1024.0*1024.0) << " MB" << endl;
+      return 1;
    }
    
    return 0;      //completes the program and properly exits. 
@@ -220,87 +601,16 @@ int main(int argc, char* argv[])
 
 
 /*
- * Runs the training loop for the given network given the training data
- * and truth values (minimum error is a global variable)
- * 
- * @param n the network to train
- * @param numIterations the maximum number of iterations to train under
- * @param trainData the training data to train the network on
- * @param truth the truth values of the given training data
- * @return 1 if the training goes below the minimum error, 0 is the maximum
- * number of iterations is reached. 
+ * Runs the network on the test set and prints its outputs and the classes it predicts
+ * (most likely first) - on its input bits if the inputs are binarized (testBits not NULL)
  */
-int train(int nOut, Network &n, int numIterations, double** trainData, double** truthVals)
-{
-   bool errorReachedThreshold = false; 
-   int isSuccessful = 0; 
-   /*
-    * Training the network - on each iteration, the network is run
-    * on all the training data and update the weights after each
-    * input is run. The total error is calculated and displayed
-    * after each training iteration and breaks when the error
-    * goes below the threshold or the maximum amount of iterations
-    * is reached. 
-    */ 
-   double error = 0.0;
-   double previousError = 2000000.0; 
-   for (int i = 0; i < maxIter && !errorReachedThreshold; i++)
-   {
-      
-      
-      for (int currentSet = 0; currentSet < numIterations; currentSet++)
-      {
-         /*
-          * For each training set, the input values are forward propagated in the method
-          * run() and the weights are updated using whatever algorithm written in the
-          * network (currently backpropagation). Total iteration error is defined as
-          * the sum of the individual training set errors. 
-          */
-         n.setTruth(truthVals[currentSet]);
-         double* output = n.run(trainData[currentSet]);
-         error += n.error();        // The error displayed is the sum of each training set's error   
-         n.updateWeights();
-          
-
-      }
-      error = error/(1.0*numIterations);
-      if (error > previousError)
-      {
-         lambda *= 1;
-      }
-      else
-      {
-         lambda *= 1; 
-      }
-      
-      cout << "Iteration " << i << " Error: " << error << endl;
-      //cout << "Prev Iteration Error is " << previousError << endl; 
-      previousError = error; 
-      
-      
-      cout << "New lambda " << lambda << endl; 
-
-      
-      
-
-      if (error < minError)        // Break if the error goes below the threshold
-      {
-         errorReachedThreshold = true; 
-         isSuccessful = 1; 
-      }
-      
-   }  //for (int i = 0; i < maxIter && !errorReachedThreshold; i++)
-
-   return isSuccessful; 
-
-}     //int train() method
-
-
-int test (int nOut, Network &n,  double* testData)
+int test (int nOut, Network &n,  double* testData, const uint64_t* testBits)
 {
    double* output; 
    
-   output = n.run(testData);
+   perfBegin(); 
+   output = testBits != NULL ? n.runBits(testBits) : n.run(testData);     //Bits if the inputs are binarized
+   perfEnd(PERF_RUN); 
    std::cout << "Test set output: "; 
    for (int j = 0; j < nOut; j++)
    {
@@ -308,6 +618,14 @@ int test (int nOut, Network &n,  double* testData)
          
    }
    std::cout << endl; 
+
+   vector<int> classes = n.topK(TOP_CLASSES);
+   std::cout << "Predicted class: " << classes[0] << " (top " << classes.size() << ":"; 
+   for (int c = 0; c < classes.size(); c++)
+   {
+      std::cout << " " << classes[c]; 
+   }
+   std::cout << ")" << endl; 
    
    return 0; 
 }
@@ -0,0 +1,190 @@
+/*
+ * Implementation of the memory accounting. Counters are atomic so the datasets'
+ * background threads can allocate while the trainer runs. The peak total is kept
+ * separately from the per-category peaks since the categories peak at different times.
+ *
+ * The footprint estimate mirrors the allocations the program makes for a topology: the
+ * single resident weights array (moved from the Reader through the driver into the
+ * network and exported through a view), the network's deltas and the layer arrays. The
+ * training data depends on the dataset options, so the driver passes in its size.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/15/20
+ */
+
+
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "memory.hpp"
+
+using namespace std;
+
+const char* categoryNames[] = {"weights", "gradients", "optimizer state", "activations", "dataset"};
+
+static atomic<long> current[NUM_MEMORY_CATEGORIES];
+static atomic<long> peak[NUM_MEMORY_CATEGORIES];
+static atomic<long> currentTotal(0);
+static atomic<long> peakTotal(0);
+
+/*
+ * Raises the given peak to the given value if it is higher
+ */
+static void raisePeak(atomic<long>& peakValue, long value)
+{
+   long seen = peakValue.load();
+   while (value > seen && !peakValue.compare_exchange_weak(seen, value))
+   {
+      //compare_exchange_weak reloads seen on failure
+   }
+   return;
+}
+
+/*
+ * Records that the given number of bytes were allocated under the given category
+ */
+void trackAlloc(int category, long bytes)
+{
+   raisePeak(peak[category], current[category] += bytes);
+   raisePeak(peakTotal, currentTotal += bytes);
+   return;
+}
+
+/*
+ * Records that the given number of bytes under the given category were freed
+ */
+void trackFree(int category, long bytes)
+{
+   current[category] -= bytes;
+   currentTotal -= bytes;
+   return;
+}
+
+long currentBytes(int category)
+{
+   return current[category];
+}
+
+long peakBytes(int category)
+{
+   return peak[category];
+}
+
+long peakTotalBytes()
+{
+   return peakTotal;
+}
+
+/*
+ * Counts the bytes of values held by a [layer][source][destination] weights array
+ */
+long weightsBytes(const vector<vector<vector<double> > >& weights)
+{
+   long bytes = 0;
+   for (int n = 0; n < weights.size(); n++)
+   {
+      for (int j = 0; j < weights[n].size(); j++)
+      {
+         bytes += weights[n][j].size()*sizeof(double);
+      }
+   }
+   return bytes;
+}
+
+/*
+ * Estimates the peak bytes of a run of the given topology
+ * @param numLayers the number of layers
+ * @param specs the type and shape of each layer
+ * @param datasetBytes the bytes of training (or test) data that will be held at once
+ * @param byCategory filled with the estimated peak of each category
+ * @return the estimated peak total
+ */
+long estimateFootprint(int numLayers, LayerSpec* specs, long datasetBytes, long* byCategory)
+{
+   long numWeights = countWeights(numLayers, specs);
+
+   byCategory[MEM_WEIGHTS] = numWeights*sizeof(double);      //The one resident copy
+   byCategory[MEM_GRADIENTS] = numWeights*sizeof(double);
+   byCategory[MEM_OPTIMIZER] = 0;
+   byCategory[MEM_ACTIVATIONS] = activationBytes(numLayers, specs);
+
+   /*
+    * The bf16 copy of the fully connected weights and the bf16 copy of the largest layer
+    */
+   if (bf16Storage)
+   {
+      long largest = 0;
+      for (int n = 0; n < numLayers; n++)
+      {
+         largest = max(largest, (long) layerSize(specs[n]));
+         if (n < numLayers - 1 && isFullyConnected(specs[n+1]))
+         {
+            byCategory[MEM_WEIGHTS] += (long) layerSize(specs[n])*layerSize(specs[n+1])*sizeof(bf16);
+         }
+      }
+      byCategory[MEM_ACTIVATIONS] += largest*sizeof(bf16);
+   }
+   byCategory[MEM_DATASET] = datasetBytes;
+
+   long total = 0;
+   for (int c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+   {
+      total += byCategory[c];
+   }
+   return total;
+
+}  //long estimateFootprint(...)
+
+/*
+ * Parses a byte count with an optional K, M or G suffix (powers of 1024)
+ */
+long parseBytes(string text)
+{
+   double value = atof(text.c_str());
+   char suffix = text.empty() ? ' ' : toupper(text[text.size() - 1]);
+   if (suffix == 'K')
+   {
+      value *= 1024.0;
+   }
+   else if (suffix == 'M')
+   {
+      value *= 1024.0*1024.0;
+   }
+   else if (suffix == 'G')
+   {
+      value *= 1024.0*1024.0*1024.0;
+   }
+   return (long) value;
+}
+
+/*
+ * Prints the bytes of every category and the total in MB
+ */
+void printFootprint(long* byCategory, long total)
+{
+   for (int c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+   {
+      cout << "   " << categoryNames[c] << ": " << byCategory[c]/(1024.0*1024.0) << " MB" << endl;
+   }
+   cout << "   total: " << total/(1024.0*1024.0) << " MB" << endl;
+   return;
+}
+
+/*
+ * Prints the peak bytes of every category and the peak total
+ */
+void memoryReport()
+{
+   long peaks[NUM_MEMORY_CATEGORIES];
+   for (int c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+   {
+      peaks[c] = peak[c];
+   }
+   cout << "Peak memory by category:" << endl;
+   printFootprint(peaks, peakTotal);
+   cout << endl;
+   return;
+}
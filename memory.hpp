@@ -0,0 +1,73 @@
+/*
+ * Header file for the memory accounting - Contains declarations for tracking
+ * the bytes held by the network, the reader and the datasets by category, and for
+ * estimating the footprint of a topology before anything is allocated.
+ *
+ * Only the large arrays are tracked (weights, deltas, layer arrays and training data),
+ * counting the bytes of the values they hold.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/15/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <string>
+#include <vector>
+
+#include "network.hpp"
+
+using namespace std;
+
+/*
+ * The categories memory is accounted under
+ */
+enum MemoryCategory {MEM_WEIGHTS, MEM_GRADIENTS, MEM_OPTIMIZER, MEM_ACTIVATIONS, MEM_DATASET,
+                     NUM_MEMORY_CATEGORIES};
+
+/*
+ * Recording allocations and frees (thread safe)
+ */
+void trackAlloc(int category, long bytes);
+void trackFree(int category, long bytes);
+
+/*
+ * Current and peak bytes of a category, and the peak of the total over all categories
+ */
+long currentBytes(int category);
+long peakBytes(int category);
+long peakTotalBytes();
+
+/*
+ * Bytes of values held by a weights array of the usual [layer][source][destination] shape
+ */
+long weightsBytes(const vector<vector<vector<double> > >& weights);
+
+/*
+ * Estimates the peak bytes of a run of the given topology by category (filled into
+ * byCategory) from the same allocations the program makes, given the bytes of data
+ * the dataset holds at once. Returns the estimated peak total.
+ */
+long estimateFootprint(int numLayers, LayerSpec* specs, long datasetBytes, long* byCategory);
+
+/*
+ * Parses a byte count such as 1048576, 512K, 64M or 2G
+ */
+long parseBytes(string text);
+
+/*
+ * Prints the peak bytes of every category and the peak total
+ */
+void memoryReport();
+
+/*
+ * Prints the bytes of every category in the given array and their total
+ */
+void printFootprint(long* byCategory, long total);
+
+
+#endif /* MEMORY_H */
@@ -0,0 +1,141 @@
+/*
+ * Implementation of the training metrics. Phase times are accumulated with a
+ * steady clock, and every epoch is written to the metrics file (if one is set).
+ * An epoch is printed to the console only every logInterval epochs and no more often
+ * than once every logSeconds seconds - the first and last epochs are always printed.
+ *
+ * The metrics file is a CSV file if its name ends in .csv and JSON lines otherwise.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/12/20
+ */
+
+
+#include <iostream>
+
+#include "metrics.hpp"
+
+using namespace std;
+
+/*
+ * Default logging options (can be overridden in the config file)
+ */
+int logInterval = 1;
+double logSeconds = 0.5;
+string metricsFile = "";
+int verbose = 0;
+
+
+/*
+ * Constructor for the metrics - starts the run clock and opens the metrics
+ * file (writing the header for CSV)
+ * @param fileName the metrics file ("" for none - defaults to the metricsFile option)
+ */
+Metrics::Metrics(string fileName)
+{
+   runStart = Clock::now();
+   lastPrint = runStart;
+   printedOnce = false;
+   totalSamples = 0;
+   epochs = 0;
+   csv = false;
+
+   if (fileName != "")
+   {
+      fileOut.open(fileName);
+      csv = fileName.size() >= 4 && fileName.substr(fileName.size() - 4) == ".csv";
+      if (csv)
+      {
+         fileOut << "epoch,seconds,samplesPerSec,forward,error,update,trainError,lambda\n";
+      }
+   }
+   startEpoch();
+}
+
+/*
+ * Resets the per-epoch counters and starts the epoch clock
+ */
+void Metrics::startEpoch()
+{
+   for (int p = 0; p < NUM_PHASES; p++)
+   {
+      phaseTime[p] = 0.0;
+   }
+   epochSamples = 0;
+   epochStart = Clock::now();
+   return;
+}
+
+/*
+ * Records the epoch that just finished. Always written to the metrics file,
+ * printed to the console only when the interval and rate limit allow it.
+ * @param epoch the index of the epoch
+ * @param error the error of the epoch
+ * @param lambdaValue the learning rate used in the epoch
+ * @param last whether this is the last epoch of the run (always printed)
+ */
+void Metrics::endEpoch(int epoch, double error, double lambdaValue, bool last)
+{
+   Clock::time_point now = Clock::now();
+   double seconds = chrono::duration<double>(now - epochStart).count();
+   double rate = seconds > 0.0 ? epochSamples/seconds : 0.0;
+   totalSamples += epochSamples;
+   epochs++;
+
+   if (fileOut.is_open())
+   {
+      if (csv)
+      {
+         fileOut << epoch << "," << seconds << "," << rate << "," << phaseTime[PHASE_FORWARD] << ","
+                 << phaseTime[PHASE_ERROR] << "," << phaseTime[PHASE_UPDATE] << "," << error << ","
+                 << lambdaValue << "\n";
+      }
+      else
+      {
+         fileOut << "{\"epoch\": " << epoch << ", \"seconds\": " << seconds << ", \"samplesPerSec\": "
+                 << rate << ", \"forward\": " << phaseTime[PHASE_FORWARD] << ", \"error\": "
+                 << phaseTime[PHASE_ERROR] << ", \"update\": " << phaseTime[PHASE_UPDATE]
+                 << ", \"trainError\": " << error << ", \"lambda\": " << lambdaValue << "}\n";
+      }
+   }
+
+   /*
+    * Rate limited console output - the line goes into cout's buffer
+    * and is only flushed when it is actually printed
+    */
+   bool intervalReached = logInterval > 0 && epoch % logInterval == 0;
+   bool waitedLongEnough = chrono::duration<double>(now - lastPrint).count() >= logSeconds;
+   if (last || !printedOnce || (intervalReached && waitedLongEnough))
+   {
+      cout << "Iteration " << epoch << " Error: " << error << " (" << seconds*1000.0 << " ms, "
+           << rate << " sets/s, lambda " << lambdaValue << ")\n" << flush;
+      lastPrint = now;
+      printedOnce = true;
+   }
+
+   startEpoch();
+   return;
+
+}  //void Metrics::endEpoch(int epoch, double error, double lambdaValue, bool last)
+
+/*
+ * Prints the totals of the run
+ */
+void Metrics::summary()
+{
+   double seconds = chrono::duration<double>(Clock::now() - runStart).count();
+   cout << "Trained " << epochs << " epochs in " << seconds << " s ("
+        << (seconds > 0.0 ? totalSamples/seconds : 0.0) << " sets/s)" << endl << endl;
+   return;
+}
+
+/*
+ * Destructor - closes (and so flushes) the metrics file
+ */
+Metrics::~Metrics()
+{
+   if (fileOut.is_open())
+   {
+      fileOut.close();
+   }
+}
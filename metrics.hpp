@@ -0,0 +1,89 @@
+/*
+ * Header file for the training metrics - Contains the declaration of the
+ * Metrics class that times each phase of training, counts throughput and logs
+ * one record per epoch to the console and/or a CSV or JSON lines file.
+ *
+ * Console output is buffered and rate limited so that printing never dominates
+ * short epochs.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/12/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <fstream>
+#include <chrono>
+
+using namespace std;
+
+/*
+ * Global variables storing the logging options (can be overridden in the config file)
+ */
+extern int logInterval;
+extern double logSeconds;
+extern string metricsFile;
+extern int verbose;
+
+/*
+ * The timed phases of a training step
+ */
+enum Phase {PHASE_FORWARD, PHASE_ERROR, PHASE_UPDATE, NUM_PHASES};
+
+/*
+ * Collects the metrics of a training run. The trainer calls start() before the
+ * first phase of a step and stop() at the end of each phase, and calls endEpoch()
+ * after each epoch, which records the epoch and decides whether it is logged.
+ *
+ * Logged per epoch: epoch time, training sets per second, time spent in run() (forward),
+ * error() (error and output layer psi) and updateWeights() (backpropagation through the
+ * hidden layers fused with the weight update), the epoch's error and lambda.
+ */
+class Metrics
+{
+   typedef chrono::steady_clock Clock;
+
+   Clock::time_point runStart;
+   Clock::time_point epochStart;
+   Clock::time_point phaseStart;
+   Clock::time_point lastPrint;
+   bool printedOnce;
+
+   double phaseTime[NUM_PHASES];    //Seconds spent in each phase this epoch
+   long epochSamples;
+   long totalSamples;
+   int epochs;
+
+   ofstream fileOut;
+   bool csv;
+
+   public:
+      Metrics(string fileName = metricsFile);
+      void startEpoch();
+      inline void start()
+      {
+         phaseStart = Clock::now();
+      }
+      inline void stop(int phase)   //Also starts timing the next phase
+      {
+         Clock::time_point now = Clock::now();
+         phaseTime[phase] += chrono::duration<double>(now - phaseStart).count();
+         phaseStart = now;
+      }
+      inline void countSample()
+      {
+         epochSamples++;
+      }
+      void endEpoch(int epoch, double error, double lambdaValue, bool last);
+      void summary();
+      ~Metrics();
+
+};    //class Metrics
+
+
+#endif /* METRICS_H */
@@ -11,7 +11,8 @@
  * propagation, double error() for error calculation, double activation(double x) for f(x), 
  * double derivative(double x) for f'(x), double randomGenerator(double min, double max) 
  * to give a random number in the given range, and fillWeights(double min, double max) to fill the
- * network's weights with random values in the given range. 
+ * network's weights with random values (in the given range, or scaled to each layer's fan in
+ * and fan out). 
  * 
  * Note: f(x) corresponds to the activation function used in training the network. 
  * 
@@ -24,38 +25,95 @@
 #include <iostream>
 #include <fstream> 
 #include "network.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include "conv.hpp"
+#include "binary.hpp"
+#include "random.hpp"
 #include <string>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
 
 /*
- * Default hyperparamter values (can be overridden in the config file)
+ * Default hyperparamter values (can be overridden in the config file) - every network
+ * copies them into its own Hyperparameters unless it is given others
  */
 double lambda = 0.1; 
 int maxIter = 50000;
 double randomWeightMin = -0.7;
 double randomWeightMax = 0.7;
 double minError = 0.001;
+int freezeLayers = 0;
+int weightInit = INIT_UNIFORM;
+
+static const int CHUNKS_PER_THREAD = 4;      //Chunks a split layer is cut into per pool thread
+
+/*
+ * The activations and theta values of every layer start on a cache line, so threads that
+ * split a layer along cache line boundaries never write to the same line
+ */
+static double* newAligned(int size)
+{
+   return new (align_val_t(CACHE_LINE)) double[size];
+}
+
+static void deleteAligned(double* values)
+{
+   ::operator delete[](values, align_val_t(CACHE_LINE));
+}
 
 /*
- * This method sets all of the weights in the network to 
- * random numbers given in the specified range
- * @param range the range of numbers that limits the RNG of the
- * weights
+ * This method sets all of the weights in the network to random numbers. Every weight
+ * layer draws from its own stream of the network's seed, so the weights only depend on
+ * the seed (not on what else used random numbers first, or on which thread built the network).
+ * Uniform init draws from the given range; Xavier init draws uniformly from
+ * +/- 4*sqrt(6/(fanIn + fanOut)) (Glorot and Bengio's range for sigmoid units, 4 times
+ * the tanh one) and He init from a normal with deviation sqrt(2/fanIn).
+ * @param min the minimum of the uniform range
+ * @param max the maximum of the uniform range
  */
 void Network::fillWeights(double min, double max)
 {
    for (int n = 0; n < nLayers-1; n++)            // Iterates over the weight layers
    {
-      for (int i = 0; i < layerSizes[n+1]; i++)   // Iterates over the destinations  
+      int numDestinations = weights[n].size() > 0 ? weights[n][0].size() : 0;   //Pooling layers have no weights
+      Philox generator(params.seed, RNG_WEIGHTS, n);
+
+      /*
+       * Fully connected weights are [source][destination]; convolution weights are
+       * [filter][channel*kernel*kernel] and each output pixel of a filter reuses them
+       */
+      double fanIn = weights[n].size();
+      double fanOut = numDestinations;
+      if (specs[n+1].type == LAYER_CONV)
       {
-         for (int j = 0; j < layerSizes[n]; j++)  // Iterates over the sources 
+         fanIn = numDestinations;
+         fanOut = (double) weights[n].size()*specs[n+1].kernel*specs[n+1].kernel;
+      }
+      double limit = 4.0*sqrt(6.0/(fanIn + fanOut));     //Glorot and Bengio's range for sigmoid units
+      double deviation = sqrt(2.0/fanIn);
+
+      for (int i = 0; i < numDestinations; i++)   // Iterates over the destinations  
+      {
+         for (int j = 0; j < weights[n].size(); j++)  // Iterates over the sources 
          {
-            /*
-             * Random number generator - uses the random generator function
-             * to get a number in the given range
-             */
-            double randNum = randomGenerator(min, max);
-            //cout << "Weight " << n << j << i << ": " << randNum << endl; 
+            double randNum;
+            if (params.init == INIT_XAVIER)
+            {
+               randNum = generator.uniform(-limit, limit);
+            }
+            else if (params.init == INIT_HE)
+            {
+               randNum = generator.normal()*deviation;
+            }
+            else
+            {
+               randNum = generator.uniform(min, max);
+            }
 
             weights[n][j][i] = randNum;
             
@@ -68,12 +126,90 @@ void Network::fillWeights(double min, double max)
 
 
 /*
- * Returns the weights array used by the network
- * @return a shallow copy of the weights (should only be used for printing)
+ * Returns the hyperparameters of this network (the trainer may change lambda)
+ */
+Hyperparameters& Network::hyperparameters()
+{
+   return params;
+}
+
+/*
+ * Returns the hyperparameters given by the config file
+ */
+Hyperparameters configHyperparameters()
+{
+   Hyperparameters config;
+   config.lambda = lambda;
+   config.maxIter = maxIter;
+   config.randomWeightMin = randomWeightMin;
+   config.randomWeightMax = randomWeightMax;
+   config.minError = minError;
+   config.init = weightInit;
+   config.seed = runSeed();
+   return config;
+}
+
+/*
+ * Returns the config file name of a weight initialization
+ */
+string initName(int init)
+{
+   if (init == INIT_XAVIER)
+   {
+      return "xavier";
+   }
+   if (init == INIT_HE)
+   {
+      return "he";
+   }
+   return "uniform";
+}
+
+/*
+ * A view of the given weights array - the array is not copied, so it must outlive the view
+ * (an rvalue such as a function's return value can not be viewed - that constructor is
+ * deleted, and this one is explicit so a vector is never viewed without saying so)
+ */
+WeightsView::WeightsView(const vector<vector<vector<double> > >& weights)
+{
+   viewed = &weights;
+}
+
+int WeightsView::numLayers() const
+{
+   return viewed->size();
+}
+
+int WeightsView::numRows(int n) const
+{
+   return (*viewed)[n].size();
+}
+
+int WeightsView::rowLength(int n, int j) const
+{
+   return (*viewed)[n][j].size();
+}
+
+/*
+ * The weights of row j of layer n as a contiguous span of rowLength(n, j) values
+ */
+const double* WeightsView::row(int n, int j) const
+{
+   return (*viewed)[n][j].data();
+}
+
+double WeightsView::at(int n, int j, int i) const
+{
+   return (*viewed)[n][j][i];
+}
+
+/*
+ * Returns a view of the weights array used by the network (nothing is copied)
+ * @return a read-only view, valid while the network is alive
  */
-vector<vector<vector<double> > > Network::getWeights()
+WeightsView Network::getWeights()
 {
-   return weights; 
+   return WeightsView(weights);
 }
 
 
@@ -92,13 +228,16 @@ vector<vector<vector<double> > > Network::getWeights()
  * first dimension represents the layer number, the second dimension
  * represents its source neuron, and the third dimension represents its destination. For example
  * a weight as the 3rd element of a source's weights array would be going to the 3rd hidden node
- * in the next layer. 
+ * in the next layer. It is taken by value so a caller that is done with its array can move
+ * it in (std::move) instead of having it copied.
+ * @param specsInput the type and shape of each layer (NULL for a fully connected network)
+ * @param paramsInput the hyperparameters of this network (NULL for the config file values)
  * 
  */
-Network::Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vector<vector<double> > >& weightsInput)
+Network::Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vector<vector<double> > > weightsInput,
+                 LayerSpec* specsInput, Hyperparameters* paramsInput)
 {   
-   
-   srand(time(NULL));  
+   params = paramsInput != NULL ? *paramsInput : configHyperparameters();
    
    nLayers = numLayers; 
    
@@ -111,9 +250,28 @@ Network::Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vecto
     */
                  
    nActivation = layerSizesInp[0]; 
-   layerSizes = layerSizesInp; 
-   weights = weightsInput; 
-   deltaWeights = weightsInput; 
+   layerSizes = new int[nLayers];         //The network keeps its own copy of the shape
+   for (int n = 0; n < nLayers; n++)
+   {
+      layerSizes[n] = layerSizesInp[n];
+   }
+
+   specs.resize(nLayers);
+   for (int n = 0; n < nLayers; n++)
+   {
+      if (specsInput != NULL)
+      {
+         specs[n] = specsInput[n];
+      }
+      else
+      {
+         specs[n] = {LAYER_FULL, layerSizes[n], 1, 1, 0};
+      }
+   }
+   weights = move(weightsInput); 
+   deltaWeights = weights;                //Same shape - the gradient buffer
+   trackAlloc(MEM_WEIGHTS, weightsBytes(weights));
+   trackAlloc(MEM_GRADIENTS, weightsBytes(deltaWeights));
    /*
     * The layers jagged array holds the activation values for the hidden and output 
     * layers. During network forward propagation, the first element of "layer" 
@@ -131,7 +289,8 @@ Network::Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vecto
     */ 
    for (int n = 0; n < nLayers; n++)  //Iterating over the layers
    {
-      layers[n] = new double [layerSizesInp[n]]; 
+      layers[n] = newAligned(layerSizesInp[n]); 
+      trackAlloc(MEM_ACTIVATIONS, layerSizesInp[n]*sizeof(double));
 
       /*
        * In this for loop, I also allocate memory for the 
@@ -141,12 +300,50 @@ Network::Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vecto
        */
       if (n < nLayers-1)
       {
-         theta[n] = new double[layerSizesInp[n+1]];
+         theta[n] = newAligned(layerSizesInp[n+1]);
          omega[n] = new double[layerSizesInp[n+1]];
          psi[n] = new double[layerSizesInp[n+1]];
+         trackAlloc(MEM_ACTIVATIONS, 3*layerSizesInp[n+1]*sizeof(double));
 
       }
    }  //for (int n = 0; n < nLayers; n++)
+
+   /*
+    * Work buffers of the convolution and pooling layers - the unrolled input patches
+    * of each convolution are kept from the forward pass for the weight gradient
+    */
+   columns = new double*[nLayers-1];
+   columnGrads = new double*[nLayers-1];
+   poolIndex = new int*[nLayers-1];
+   for (int n = 0; n < nLayers-1; n++)
+   {
+      columns[n] = NULL;
+      columnGrads[n] = NULL;
+      poolIndex[n] = NULL;
+      LayerSpec& out = specs[n+1];
+      if (out.type == LAYER_CONV)
+      {
+         long columnSize = (long) specs[n].channels*out.kernel*out.kernel*out.height*out.width;
+         columns[n] = new double[columnSize];
+         trackAlloc(MEM_ACTIVATIONS, columnSize*sizeof(double));
+         if (n > 0)                          //No gradient is needed at the input layer
+         {
+            columnGrads[n] = new double[columnSize];
+            trackAlloc(MEM_ACTIVATIONS, columnSize*sizeof(double));
+         }
+      }
+      else if (out.type == LAYER_MAXPOOL)
+      {
+         poolIndex[n] = new int[layerSizes[n+1]];
+         trackAlloc(MEM_ACTIVATIONS, layerSizes[n+1]*sizeof(int));
+      }
+   }
+   frozen.assign(nLayers-1, false);
+   firstTrained = 0;
+   packedActivations = NULL;
+   packedReady = false;
+   binaryReady = false;
+   pool = NULL;
    
    /*
     * Fills weights randomly because the user did not provide a set
@@ -154,7 +351,7 @@ Network::Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vecto
     */
    if (hasWeights == 0)
    {
-      fillWeights(randomWeightMin, randomWeightMax);
+      fillWeights(params.randomWeightMin, params.randomWeightMax);
 
    }
 
@@ -177,25 +374,146 @@ Network::Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vecto
  * 
  */
 double* Network::run(double inputValues[])
+{
+   return runFrom(0, inputValues);
+
+}  //Network::run(input) method 
+
+/*
+ * Runs the network starting from the given layer instead of the inputs - used to
+ * skip frozen layers whose outputs were cached
+ * @param start the layer the given values belong to
+ * @param values the activations of that layer
+ * @return the output layer values
+ */
+double* Network::runFrom(int start, double values[])
 {
    /*
-    * This for loop adds the input values into the network's
+    * This for loop adds the given values into the network's
     * backend layers array and is NOT a part of forward propagation
     */
-   for (int k = 0; k < nActivation; k++) //Iterating over the number of activation
+   for (int k = 0; k < layerSizes[start]; k++) //Iterating over the number of activation
    {
-      layers[0][k] = inputValues[k];     //Setting the values of the first layer to the 
-                                         //given input values 
+      layers[start][k] = values[k];            //Setting the values of the start layer to the 
+                                               //given values 
       
    }
+   forward(start, nLayers - 1);
    
    /*
-    * Loop for forward propagation - generalized for n layers
-    * Serves two purposes - to calculate new activation values and
-    * to calculate new theta values
+    * Storing output layer values and returning the layer
     */
-   for (int n = 0; n < nLayers - 1; n++)           //Iterates over the hidden layers
+   outputs = layers[nLayers-1];
+
+   return layers[nLayers - 1]; 
+
+}  //double* Network::runFrom(int start, double values[])
+
+/*
+ * Runs the network on binarized inputs (bitWords(inputs) words, see binary.hpp). A fully
+ * connected first layer adds up the weights of the set bits instead of multiplying every
+ * input - the same sums as run() on the inputs as 0s and 1s - or, after packBinary(),
+ * counts the set bits against the signs of its weights.
+ * @param bits the input bits
+ * @return the output layer values
+ */
+double* Network::runBits(const uint64_t* bits)
+{
+   unpackBits(bits, layerSizes[0], layers[0]);     //Backpropagation reads the input activations
+   if (!isFullyConnected(specs[1]))
+   {
+      forward(0, nLayers - 1);
+   }
+   else
    {
+      {
+         TraceScope layerScope("forward", 0);
+         int numWords = bitWords(layerSizes[0]);
+         if (binaryReady)
+         {
+            popcountForward(bits, numWords, signBits.data(), signScales.data(), layerSizes[1], theta[0]);
+         }
+         else
+         {
+            selectForward(bits, numWords, weights[0], layerSizes[1], theta[0]);
+         }
+         for (int i = 0; i < layerSizes[1]; i++)
+         {
+            layers[1][i] = activation(theta[0][i]);
+         }
+         finishLayer(0);
+      }
+      forward(1, nLayers - 1);
+   }
+   outputs = layers[nLayers-1];
+   return outputs;
+
+}  //double* Network::runBits(const uint64_t* bits)
+
+/*
+ * Runs the inputs only up to the given layer
+ * @return the activations of that layer (valid until the next run)
+ */
+double* Network::features(double inputValues[], int layer)
+{
+   for (int k = 0; k < nActivation; k++)
+   {
+      layers[0][k] = inputValues[k];
+   }
+   forward(0, layer);
+   return layers[layer];
+}
+
+/*
+ * Loop for forward propagation - generalized for n layers
+ * Serves two purposes - to calculate new activation values and
+ * to calculate new theta values
+ * @param start the layer whose activations are already set
+ * @param end the last layer to calculate
+ */
+void Network::forward(int start, int end)
+{
+   for (int n = start; n < end; n++)               //Iterates over the hidden layers
+   {
+      TraceScope layerScope("forward", n);
+      LayerSpec& in = specs[n];
+      LayerSpec& out = specs[n+1];
+
+      if (packedReady && isFullyConnected(out))
+      {
+         forwardBf16(n);
+         finishLayer(n);
+         continue;
+      }
+
+      /*
+       * Convolutions unroll the input patches and multiply them by the filters,
+       * pooling layers pass the pooled values through without an activation
+       */
+      if (out.type == LAYER_CONV)
+      {
+         im2col(layers[n], in.channels, in.height, in.width, out.kernel, columns[n]);
+         convForward(weights[n], columns[n], out.height*out.width, theta[n]);
+         for (int i = 0; i < layerSizes[n+1]; i++)
+         {
+            layers[n+1][i] = activation(theta[n][i]);
+         }
+         continue;
+      }
+      if (out.type == LAYER_MAXPOOL || out.type == LAYER_AVGPOOL)
+      {
+         poolForward(layers[n], in.channels, in.height, in.width, out.kernel, out.type == LAYER_MAXPOOL,
+                     theta[n], poolIndex[n]);
+         memcpy(layers[n+1], theta[n], layerSizes[n+1]*sizeof(double));
+         continue;
+      }
+      if (chunkWidth(n) > 0)
+      {
+         forwardParallel(n);
+         finishLayer(n);
+         continue;
+      }
+
       for (int i = 0; i < layerSizes[n+1]; i++)    //Iterates over the destination layer
       {
          double newValue = 0.0;                    //The new sum value of the current hidden layer node
@@ -220,197 +538,994 @@ double* Network::run(double inputValues[])
          
       }  //for (int i = 0; i < layerSizes[n+1]; i++)
 
-   }     //for (int n = 0; n < nLayers-1; n++)
-   
-   /*
-    * Storing output layer values and returning the layer
-    */
-   outputs = layers[nLayers-1];
+      finishLayer(n);
 
-   return layers[nLayers - 1]; 
+   }     //for (int n = start; n < end; n++)
+   return;
 
-}  //Network::run(input) method 
+}  //void Network::forward(int start, int end)
 
 /*
- * Currently, the error function is the sum of squares of the difference between
- * respective truth and output values all multiplied by 0.5. 
- * @return the error between the inputted truth value and the calculated output value
- * by the perceptron
- * 
+ * Replaces the sigmoid activations of the fully connected layer n+1 if it has another
+ * output function - the softmax of its theta values for a softmax layer, the theta values
+ * themselves for a linear layer
  */
-double Network::error()
+void Network::finishLayer(int n)
 {
-   /*
-    * The error is calculated as half the sum over i of (Ti-Fi)^2
-    */
-   double total = 0.0; 
-   for (int i = 0; i < nOutput; i++)      //Looping over the output layer
+   if (specs[n+1].type == LAYER_SOFTMAX)
    {
-      
-      double diff = outputs[i] - truth[i]; 
-      omega[nLayers-2][i] = -diff; 
-      psi[nLayers-2][i] = omega[nLayers-2][i] * derivative(theta[nLayers-2][i]);
-      total += diff*diff; 
-
-
+      softmaxValues(theta[n], layers[n+1], layerSizes[n+1]);
    }
-   total *= 0.5; 
-   
-   return total; 
-   
-}  //double Network::error()
+   else if (specs[n+1].type == LAYER_LINEAR)
+   {
+      memcpy(layers[n+1], theta[n], layerSizes[n+1]*sizeof(double));
+   }
+   return;
+}
 
 /*
- * Sets the internal truth variable
- * to the input parameter
- * @param truthValue the new value of the perceptron's input
- * truth output (what it should output)
- */ 
-void Network::setTruth(double* truthValue)
+ * The softmax of the given theta values. The largest theta is subtracted before
+ * exponentiating so no exp() can overflow.
+ */
+void softmaxValues(const double* thetas, double* outputs, int size)
 {
-   truth = truthValue;
-   return; 
+   double largest = thetas[0];
+   for (int i = 1; i < size; i++)
+   {
+      largest = max(largest, thetas[i]);
+   }
 
+   double sum = 0.0;
+   for (int i = 0; i < size; i++)
+   {
+      outputs[i] = exp(thetas[i] - largest);
+      sum += outputs[i];
+   }
+   for (int i = 0; i < size; i++)
+   {
+      outputs[i] /= sum;
+   }
+   return;
 }
 
-
 /*
- * The updateWeights function uses the backpropgation formula for
- * "i" outputs to update the weights given the error and lambda hyperparameter.
- * The delta(weights) are stored in a separate vector with the same dimensions
- * as the weights array and are used to update the weights. 
- * My backpropagation works for a generalized number of layers, so only
- * two backwards for loops are used. 
- * 
+ * Forward propagation through the fully connected layer n+1 with the bf16 weights - the
+ * source layer is rounded to bf16 and every dot product is accumulated in float. The new
+ * activations are kept at bf16 precision.
  */
-void Network::updateWeights()
-{ 
-
-   /*
-    * This loop iterates backwards(starting at the 2nd to last layer)
-    * and calculatesthe omega, psi, and deltaWeights values for each layer. 
-    * Delta weights calculated from the previous (n+1) layer are applied
-    * and delta weights for the nth layer are calculated
-    * Note - for generalized backprop, I'm using j as the current "source layer,"
-    * i as the next/destination layer, and k as the previous layer (n) but indexing n
-    * from the first k layer (so k is layers[n], j is layers[n+1], and i is layers[n+2])
-    */
-   for (int n = nLayers-3; n >= 0; n--)                     //Iterating over the layers starting from
-   {                                                        //Last hidden layer
-      
-            
-      for (int j = 0; j < layerSizes[n+1]; j++)             //Iterating over source layer
-      {
-         /*
-          * Omegas indices are shifted by one as it starts at the FIRST
-          * hidden layer, so 
-          * it would be [n][j] as opposed to [n+1][j]
-          */ 
-         omega[n][j] = 0.0; 
-
-         for (int i = 0; i < layerSizes[n+2]; i++)          //Iterating over destination layer to calculate omega
-         {  
-            /*
-             * Calculating omega(j) = sum over J of psi(i)*weights(ji)
-             * After this, the deltaWeights is calculated tactically right
-             * before incrementing its corresponding weights on the fly so the
-             * PREVIOUS values are still used but they're done in the same for loop
-             * for optimization.
-             */
-            omega[n][j] += psi[n+1][i] * weights[n+1][j][i];
-            deltaWeights[n+1][j][i] = lambda * psi[n+1][i] * layers[n+1][j];
-            weights[n+1][j][i] += deltaWeights[n+1][j][i];
-
-         }
-          
-         psi[n][j] = omega[n][j] * derivative(theta[n][j]); //Derived from the formula for psi
-
-      }  //for (int j = 0; j < layerSizes[n+1]; j++) - "source layer" 
-            
-      
-   }     //for (int n = nLayers - 3; n >= 0; n--)    - backpropagating through the network
+void Network::forwardBf16(int n)
+{
+   int numSources = layerSizes[n];
+   int numDestinations = layerSizes[n+1];
+   for (int j = 0; j < numSources; j++)
+   {
+      packedActivations[j] = toBf16(layers[n][j]);
+   }
 
-   /*
-    * By the backpropagation algorithm, the first weights layer
-    * requires an extra deltaWeights calculation and increment. This second
-    * for loop does just that. 
-    */
-   for (int m = 0; m < layerSizes[0]; m++)
+   auto destinations = [&](int first, int last)
    {
-      for (int k = 0; k < layerSizes[1]; k++)
+      for (int i = first; i < last; i++)
       {
-         deltaWeights[0][m][k] = lambda * psi[0][k] * layers[0][m];
-         weights[0][m][k] += deltaWeights[0][m][k];
+         float sum = dotBf16(&packedWeights[n][(long) i*numSources], packedActivations, numSources);
+         theta[n][i] = sum;
+         layers[n+1][i] = fromBf16(toBf16(activation(sum)));
       }
-   }
-   
-   return; 
+   };
 
-}  //updateWeights() method for backpropgation
+   int chunk = chunkWidth(n);
+   if (chunk == 0)
+   {
+      destinations(0, numDestinations);
+      return;
+   }
+   pool->run((numDestinations + chunk - 1)/chunk, [&](int c)
+   {
+      destinations(c*chunk, min((c + 1)*chunk, numDestinations));
+   });
+   return;
+}
 
 /*
- * Random generator currently generates a random number
- * in the given range above the "min" parameter
- * and below the "max" parameter
- * @param min the minimum boundary for the RNG
- * @param max the maximum boundary for the RNG
- * @return a random number between min and max
- * 
+ * Forward propagation through the fully connected layer n+1 split across the pool - each
+ * chunk of destination neurons is a whole number of cache lines of theta and of the
+ * activations, and goes over the sources in the same order as the serial loop (so the
+ * results are exactly the same), reading each source's weights to its chunk contiguously.
  */
-double randomGenerator(double min, double max)
+void Network::forwardParallel(int n)
 {
-   return ((double) rand() / (RAND_MAX))*(max-min) + min;   //(rand() / RAND_MAX) gives a value in the
-                                                            //standard range 0 to 1
+   int chunk = chunkWidth(n);
+   int numDestinations = layerSizes[n+1];
+   pool->run((numDestinations + chunk - 1)/chunk, [&](int c)
+   {
+      int first = c*chunk;
+      int last = min(first + chunk, numDestinations);
+      double* sums = theta[n];
+      for (int i = first; i < last; i++)
+      {
+         sums[i] = 0.0;
+      }
+      for (int j = 0; j < layerSizes[n]; j++)
+      {
+         const double* row = weights[n][j].data();
+         double source = layers[n][j];
+         for (int i = first; i < last; i++)
+         {
+            sums[i] += row[i] * source;
+         }
+      }
+      for (int i = first; i < last; i++)
+      {
+         layers[n+1][i] = activation(sums[i]);
+      }
+   });
+   return;
 
-} 
+}  //void Network::forwardParallel(int n)
 
 /*
- * This function holds the activation function that is applied over
- * the dot products in my network
- * @param x the input into the activation function f(x)
- * @return the value of f(x) - currently f(x) = x
+ * The number of destination neurons per chunk when the fully connected layer n+1 is split
+ * across the pool (a multiple of a cache line of doubles), or 0 if the layer is run serially -
+ * without a pool, or when it has too few multiply-adds for the split to pay for itself
  */
-double activation(double x)
+int Network::chunkWidth(int n)
 {
-   return 1.0/(1.0+exp(-x));
+   if (pool == NULL || pool->size() <= 1 || (long) layerSizes[n]*layerSizes[n+1] < parallelMinWork)
+   {
+      return 0;
+   }
+   int perLine = CACHE_LINE/sizeof(double);
+   int numChunks = pool->size()*CHUNKS_PER_THREAD;
+   int chunk = (layerSizes[n+1] + numChunks - 1)/numChunks;
+   return (chunk + perLine - 1)/perLine*perLine;
 }
 
 /*
- * This function holds the value of the derivative function of the given
- * activation for this network. 
- * @param x the x value to execute the derivative function at
- * @return the value of df(x)/dx where f(x) is the activation function
+ * Runs the large fully connected layers of every forward pass on the given pool from now on
+ * @param workPool the pool (it must outlive the network's use of it; NULL runs serially)
  */
-double derivative(double x)
+void Network::setPool(WorkPool* workPool)
 {
-   double activationAtX = activation(x);
-   return activationAtX*(1.0-activationAtX);
+   pool = workPool;
+   return;
 }
 
 /*
- * Destructor for the network class - frees up 
- * space allocated for the various array instances
+ * Makes the bf16 copy of the fully connected weights (transposed so each destination's
+ * weights are contiguous) that run() uses from then on. The double weights stay the
+ * master copy - updateWeights() changes them and run() goes back to them until the
+ * next packBf16().
  */
-Network::~Network()
+void Network::packBf16()
 {
-   free(layerSizes);
-   free(layers);
-   free(truth);
-   free(outputs);
-
-}
-
-
-
-
+   if (packedActivations == NULL)
+   {
+      int largest = 0;
+      for (int n = 0; n < nLayers; n++)
+      {
+         largest = max(largest, layerSizes[n]);
+      }
+      packedActivations = new bf16[largest];
+      trackAlloc(MEM_ACTIVATIONS, largest*sizeof(bf16));
 
+      packedWeights.resize(nLayers-1);
+      for (int n = 0; n < nLayers-1; n++)
+      {
+         if (isFullyConnected(specs[n+1]))
+         {
+            packedWeights[n].resize((long) layerSizes[n]*layerSizes[n+1]);
+            trackAlloc(MEM_WEIGHTS, packedWeights[n].size()*sizeof(bf16));
+         }
+      }
+   }
 
+   for (int n = 0; n < nLayers-1; n++)
+   {
+      if (isFullyConnected(specs[n+1]))
+      {
+         for (int i = 0; i < layerSizes[n+1]; i++)
+         {
+            for (int j = 0; j < layerSizes[n]; j++)
+            {
+               packedWeights[n][(long) i*layerSizes[n] + j] = toBf16(weights[n][j][i]);
+            }
+         }
+      }
+   }
+   packedReady = true;
+   return;
+
+}  //void Network::packBf16()
+
+/*
+ * Binarizes the fully connected first layer for runBits() - every weight becomes +1 or -1
+ * (its sign) times the mean magnitude of its destination's weights. The double weights
+ * stay the master copy, as with packBf16().
+ */
+void Network::packBinary()
+{
+   if (!isFullyConnected(specs[1]))
+   {
+      return;
+   }
+   int numWords = bitWords(layerSizes[0]);
+   if (signScales.empty())
+   {
+      trackAlloc(MEM_WEIGHTS, (long) layerSizes[1]*(numWords*sizeof(uint64_t) + sizeof(double)));
+   }
+   signBits.assign((long) layerSizes[1]*numWords, 0);
+   signScales.assign(layerSizes[1], 0.0);
+   for (int i = 0; i < layerSizes[1]; i++)
+   {
+      uint64_t* row = signBits.data() + (long) i*numWords;
+      for (int k = 0; k < layerSizes[0]; k++)
+      {
+         signScales[i] += fabs(weights[0][k][i]);
+         if (weights[0][k][i] >= 0.0)
+         {
+            row[k/64] |= (uint64_t) 1 << (k % 64);
+         }
+      }
+      signScales[i] /= layerSizes[0];
+   }
+   binaryReady = true;
+   return;
+
+}  //void Network::packBinary()
+
+/*
+ * Currently, the error function is the sum of squares of the difference between
+ * respective truth and output values all multiplied by 0.5 (the cross-entropy when the
+ * output layer is a softmax layer). 
+ * @return the error between the inputted truth value and the calculated output value
+ * by the perceptron
+ * 
+ */
+double Network::error()
+{
+   TraceScope scope("error");
+   return outputError(specs[nLayers-1].type, nOutput, theta[nLayers-2], outputs, truth,
+                      omega[nLayers-2], psi[nLayers-2]);
+   
+}  //double Network::error()
+
+/*
+ * The error of one set of outputs, which also sets the omega and psi values of the output
+ * layer for backpropagation.
+ * For a sigmoid output layer it is half the sum over i of (Ti-Fi)^2, with omega = Ti - Fi and
+ * psi = omega*f'(theta).
+ * For a softmax output layer it is the cross-entropy -sum over i of Ti*log(Fi). log(Fi) is
+ * taken from the theta values (theta minus the log of the sum of the exponentials, with the
+ * largest theta factored out) rather than from Fi, so an output that rounds to 0 does not
+ * give log(0). The softmax and the cross-entropy are differentiated together - the psi of
+ * output i is Ti - Fi*(sum of the truths), which is just Ti - Fi for a one-hot truth - so
+ * the gradient does not vanish when the outputs saturate the way it does with a sigmoid.
+ * @param type the LayerType of the output layer
+ * @param size the number of outputs
+ * @return the error of the outputs
+ */
+double outputError(int type, int size, const double* thetas, const double* outputs, const double* truth,
+                   double* omegas, double* psis)
+{
+   double total = 0.0;
+   if (type != LAYER_SOFTMAX)
+   {
+      for (int i = 0; i < size; i++)      //Looping over the output layer
+      {
+         double diff = outputs[i] - truth[i]; 
+         omegas[i] = -diff; 
+         psis[i] = omegas[i] * derivative(thetas[i]);
+         total += diff*diff; 
+      }
+      return total*0.5; 
+   }
+
+   double largest = thetas[0];
+   for (int i = 1; i < size; i++)
+   {
+      largest = max(largest, thetas[i]);
+   }
+   double sum = 0.0;
+   double truthSum = 0.0;
+   for (int i = 0; i < size; i++)
+   {
+      sum += exp(thetas[i] - largest);
+      truthSum += truth[i];
+   }
+   double logSum = largest + log(sum);
+
+   for (int i = 0; i < size; i++)
+   {
+      total -= truth[i]*(thetas[i] - logSum);
+      omegas[i] = truth[i] - outputs[i];
+      psis[i] = truth[i] - outputs[i]*truthSum;
+   }
+   return total;
+
+}  //double outputError(...)
+
+/*
+ * Runs the network and picks the class of the input
+ * @return the index of the largest output
+ */
+int Network::predict(double inputValues[])
+{
+   run(inputValues);
+   return topK(1)[0];
+}
+
+/*
+ * The classes of the last run, most likely first (the largest outputs - probabilities
+ * when the output layer is a softmax layer)
+ * @param k how many classes to return (at most the number of outputs)
+ * @return the indices of the k largest outputs in descending order of output
+ */
+vector<int> Network::topK(int k)
+{
+   vector<int> classes(nOutput);
+   for (int i = 0; i < nOutput; i++)
+   {
+      classes[i] = i;
+   }
+   k = min(max(k, 1), nOutput);
+   partial_sort(classes.begin(), classes.begin() + k, classes.end(),
+                [&](int a, int b) { return outputs[a] > outputs[b]; });
+   classes.resize(k);
+   return classes;
+}
+
+/*
+ * Sets the internal truth variable
+ * to the input parameter
+ * @param truthValue the new value of the perceptron's input
+ * truth output (what it should output)
+ */ 
+void Network::setTruth(double* truthValue)
+{
+   truth = truthValue;
+   return; 
+
+}
+
+
+/*
+ * The updateWeights function uses the backpropgation formula for
+ * "i" outputs to update the weights given the error and lambda hyperparameter.
+ * The delta(weights) are stored in a separate vector with the same dimensions
+ * as the weights array and are used to update the weights. 
+ * My backpropagation works for a generalized number of layers - each weights layer
+ * is handled (from the output backwards) by the function for its type of connection,
+ * which calculates the omega and psi values of the layer before it from the old
+ * weights and then applies the delta weights. Frozen weights layers are not changed, and
+ * nothing is calculated below the lowest trained layer. 
+ * 
+ */
+void Network::updateWeights()
+{ 
+   packedReady = false;                                     //The bf16 copy goes stale
+   binaryReady = false;                                     //And so does the binarized first layer
+   backward(params.lambda, true);
+   return; 
+
+}  //updateWeights() method for backpropgation
+
+/*
+ * Backpropagation through the trained layers. The delta weights of every trained layer
+ * are step times the psi of its destinations times its source activations, i.e. -step times
+ * the gradient of the error, and are added to the weights if apply is set.
+ * @param step the learning rate (frozen layers use 0)
+ * @param apply whether the weights are changed or only the delta weights are calculated
+ */
+void Network::backward(double step, bool apply)
+{
+   for (int n = nLayers-2; n >= firstTrained; n--)          //Iterating over the weights layers starting from
+   {                                                        //the output layer
+      TraceScope layerScope("backward", n);
+      double layerStep = frozen[n] ? 0.0 : step;
+      bool propagate = n > firstTrained;                    //Whether the layer below needs its psi values
+
+      if (specs[n+1].type == LAYER_CONV)
+      {
+         backwardConv(n, layerStep, propagate, apply);
+      }
+      else if (isFullyConnected(specs[n+1]))
+      {
+         backwardFull(n, layerStep, propagate, apply);
+      }
+      else
+      {
+         backwardPool(n, propagate);
+      }
+   }
+   return;
+
+}  //void Network::backward(double step, bool apply)
+
+/*
+ * Adds the gradient of the error of the current training set (after run() and error())
+ * to the given array without changing the weights. The gradient is laid out like
+ * getParameters(); frozen layers and the layers below them add nothing.
+ * @param gradient the running sum of the gradients, numParameters() long
+ */
+void Network::accumulateGradient(double* gradient)
+{
+   backward(-1.0, false);                                  //Delta weights are then the gradient itself
+   long k = 0;
+   for (int n = 0; n < nLayers-1; n++)
+   {
+      for (int j = 0; j < weights[n].size(); j++)
+      {
+         int length = weights[n][j].size();
+         if (n >= firstTrained)
+         {
+            const double* delta = deltaWeights[n][j].data();
+            for (int i = 0; i < length; i++)
+            {
+               gradient[k + i] += delta[i];
+            }
+         }
+         k += length;
+      }
+   }
+   return;
+
+}  //void Network::accumulateGradient(double* gradient)
+
+/*
+ * Returns the number of weights of the network (the length of the parameter vector)
+ */
+long Network::numParameters()
+{
+   return countWeights(nLayers, specs.data());
+}
+
+/*
+ * Copies every weight into one flat array, layer by layer in the order of the
+ * weights array
+ */
+void Network::getParameters(double* values)
+{
+   long k = 0;
+   for (int n = 0; n < nLayers-1; n++)
+   {
+      for (int j = 0; j < weights[n].size(); j++)
+      {
+         copy(weights[n][j].begin(), weights[n][j].end(), values + k);
+         k += weights[n][j].size();
+      }
+   }
+   return;
+}
+
+/*
+ * Sets every weight from a flat array laid out like getParameters()
+ */
+void Network::setParameters(const double* values)
+{
+   packedReady = false;
+   binaryReady = false;
+   long k = 0;
+   for (int n = 0; n < nLayers-1; n++)
+   {
+      for (int j = 0; j < weights[n].size(); j++)
+      {
+         copy(values + k, values + k + weights[n][j].size(), weights[n][j].begin());
+         k += weights[n][j].size();
+      }
+   }
+   return;
+}
+
+/*
+ * Makes a network with the same shape, weights, hyperparameters and frozen layers (but its
+ * own layer arrays), so that several training sets can be run through it at once on
+ * different threads
+ * @return the new network (owned by the caller)
+ */
+Network* Network::replica()
+{
+   Network* copyNet = new Network(nLayers, layerSizes, 1, weights, specs.data(), &params);
+   for (int n = 0; n < nLayers-1; n++)
+   {
+      copyNet->freezeLayer(n, frozen[n]);
+   }
+   return copyNet;
+}
+
+/*
+ * Backpropagation through the fully connected weights layer n (psi[n] must already be known)
+ * Note - I'm using j as the current "source layer," i as the destination layer. Omega and psi
+ * indices are shifted by one as they start at the FIRST hidden layer, so the omega of
+ * source neuron j is omega[n-1][j]
+ */
+void Network::backwardFull(int n, double step, bool propagate, bool apply)
+{
+   /*
+    * By the backpropagation algorithm, the first (trained) weights layer
+    * only requires the deltaWeights calculation and increment. 
+    */
+   if (!propagate)
+   {
+      for (int m = 0; m < layerSizes[n]; m++)
+      {
+         if (layers[n][m] == 0.0 && apply)      //Nothing changes (most of a binarized input is 0) - only
+         {                                      //accumulateGradient() reads the delta weights, without applying
+            continue;
+         }
+         for (int k = 0; k < layerSizes[n+1]; k++)
+         {
+            deltaWeights[n][m][k] = step * psi[n][k] * layers[n][m];
+            if (apply)
+            {
+               weights[n][m][k] += deltaWeights[n][m][k];
+            }
+         }
+      }
+      return;
+   }
+
+   bool activated = specs[n].type == LAYER_FULL || specs[n].type == LAYER_CONV;
+
+   for (int j = 0; j < layerSizes[n]; j++)                  //Iterating over source layer
+   {
+      omega[n-1][j] = 0.0; 
+
+      for (int i = 0; i < layerSizes[n+1]; i++)             //Iterating over destination layer to calculate omega
+      {  
+         /*
+          * Calculating omega(j) = sum over J of psi(i)*weights(ji)
+          * After this, the deltaWeights is calculated tactically right
+          * before incrementing its corresponding weights on the fly so the
+          * PREVIOUS values are still used but they're done in the same for loop
+          * for optimization.
+          */
+         omega[n-1][j] += psi[n][i] * weights[n][j][i];
+         deltaWeights[n][j][i] = step * psi[n][i] * layers[n][j];
+         if (apply)
+         {
+            weights[n][j][i] += deltaWeights[n][j][i];
+         }
+
+      }
+       
+      psi[n-1][j] = activated ? omega[n-1][j] * derivative(theta[n-1][j]) : omega[n-1][j]; //Derived from the formula for psi
+
+   }  //for (int j = 0; j < layerSizes[n]; j++) - "source layer" 
 
+   return;
 
+}  //void Network::backwardFull(int n)
 
+/*
+ * Backpropagation through the convolution feeding layer n+1 - the gradient at the unrolled
+ * patches is folded back onto the source layer (col2im) to give its omega values
+ */
+void Network::backwardConv(int n, double step, bool propagate, bool apply)
+{
+   LayerSpec& in = specs[n];
+   LayerSpec& out = specs[n+1];
 
+   convBackward(weights[n], deltaWeights[n], columns[n], psi[n], out.height*out.width, step,
+                propagate ? columnGrads[n] : NULL, apply);
+   if (propagate)
+   {
+      memset(omega[n-1], 0, layerSizes[n]*sizeof(double));
+      col2imAdd(columnGrads[n], in.channels, in.height, in.width, out.kernel, omega[n-1]);
+      setPsi(n-1);
+   }
+   return;
+}
 
+/*
+ * Backpropagation through the pooling layer n+1 (no weights to update)
+ */
+void Network::backwardPool(int n, bool propagate)
+{
+   LayerSpec& in = specs[n];
+   LayerSpec& out = specs[n+1];
 
+   if (propagate)
+   {
+      poolBackward(psi[n], in.channels, in.height, in.width, out.kernel, out.type == LAYER_MAXPOOL,
+                   poolIndex[n], omega[n-1]);
+      setPsi(n-1);
+   }
+   return;
+}
 
+/*
+ * Freezes or unfreezes a weights layer. Backpropagation stops at the lowest
+ * layer that is still trained.
+ * @param n the weights layer (0 connects the inputs to the first hidden layer)
+ * @param isFrozen whether the layer's weights should stay fixed
+ */
+void Network::freezeLayer(int n, bool isFrozen)
+{
+   frozen[n] = isFrozen;
+   firstTrained = 0;
+   while (firstTrained < nLayers-1 && frozen[firstTrained])
+   {
+      firstTrained++;
+   }
+   return;
+}
 
+/*
+ * psi = omega*f'(theta) for the layer n+1 (pooling layers have no activation, so psi = omega)
+ */
+void Network::setPsi(int n)
+{
+   bool activated = specs[n+1].type == LAYER_FULL || specs[n+1].type == LAYER_CONV;
+   for (int i = 0; i < layerSizes[n+1]; i++)
+   {
+      psi[n][i] = activated ? omega[n][i] * derivative(theta[n][i]) : omega[n][i];
+   }
+   return;
+}
 
+/*
+ * Random generator currently generates a random number
+ * in the given range above the "min" parameter
+ * and below the "max" parameter. Each thread draws from its own stream of the run seed
+ * (numbered in the order the threads first call it), so it is safe to call from any thread.
+ * @param min the minimum boundary for the RNG
+ * @param max the maximum boundary for the RNG
+ * @return a random number between min and max
+ * 
+ */
+double randomGenerator(double min, double max)
+{
+   static atomic<uint32_t> numStreams(0);
+   thread_local Philox generator(runSeed(), RNG_GENERAL, numStreams++);
+   return generator.uniform(min, max);
+
+} 
+
+/*
+ * This function holds the activation function that is applied over
+ * the dot products in my network
+ * @param x the input into the activation function f(x)
+ * @return the value of f(x) - currently f(x) = x
+ */
+double activation(double x)
+{
+   return 1.0/(1.0+exp(-x));
+}
+
+/*
+ * This function holds the value of the derivative function of the given
+ * activation for this network. 
+ * @param x the x value to execute the derivative function at
+ * @return the value of df(x)/dx where f(x) is the activation function
+ */
+double derivative(double x)
+{
+   double activationAtX = activation(x);
+   return activationAtX*(1.0-activationAtX);
+}
+
+/*
+ * Destructor for the network class - frees up 
+ * space allocated for the various array instances
+ * (the truth values belong to whoever set them, e.g. a dataset buffer, so they are not freed here)
+ */
+Network::~Network()
+{
+   for (int n = 0; n < nLayers; n++)
+   {
+      deleteAligned(layers[n]);
+      trackFree(MEM_ACTIVATIONS, layerSizes[n]*sizeof(double));
+      if (n < nLayers-1)
+      {
+         deleteAligned(theta[n]);
+         delete[] omega[n];
+         delete[] psi[n];
+         trackFree(MEM_ACTIVATIONS, 3*layerSizes[n+1]*sizeof(double));
+      }
+   }
+   delete[] layers;
+   delete[] theta;
+   delete[] omega;
+   delete[] psi;
+
+   for (int n = 0; n < nLayers-1; n++)
+   {
+      LayerSpec& out = specs[n+1];
+      long columnSize = (long) specs[n].channels*out.kernel*out.kernel*out.height*out.width;
+      if (columns[n] != NULL)
+      {
+         delete[] columns[n];
+         trackFree(MEM_ACTIVATIONS, columnSize*sizeof(double));
+      }
+      if (columnGrads[n] != NULL)
+      {
+         delete[] columnGrads[n];
+         trackFree(MEM_ACTIVATIONS, columnSize*sizeof(double));
+      }
+      if (poolIndex[n] != NULL)
+      {
+         delete[] poolIndex[n];
+         trackFree(MEM_ACTIVATIONS, layerSizes[n+1]*sizeof(int));
+      }
+   }
+   delete[] columns;
+   delete[] columnGrads;
+   delete[] poolIndex;
+
+   if (packedActivations != NULL)
+   {
+      int largest = 0;
+      for (int n = 0; n < nLayers; n++)
+      {
+         largest = max(largest, layerSizes[n]);
+      }
+      delete[] packedActivations;
+      trackFree(MEM_ACTIVATIONS, largest*sizeof(bf16));
+      for (int n = 0; n < nLayers-1; n++)
+      {
+         trackFree(MEM_WEIGHTS, packedWeights[n].size()*sizeof(bf16));
+      }
+   }
+
+   if (!signScales.empty())
+   {
+      trackFree(MEM_WEIGHTS, signBits.size()*sizeof(uint64_t) + signScales.size()*sizeof(double));
+   }
+
+   trackFree(MEM_WEIGHTS, weightsBytes(weights));
+   trackFree(MEM_GRADIENTS, weightsBytes(deltaWeights));
+   delete[] layerSizes;
+
+}
+
+/*
+ * Parses the layer tokens of an input file into layer specs. A number is a fully connected
+ * layer of that size (the first number is the input, treated as a square image when its size
+ * is a perfect square), "conv<F>x<K>" is a convolution with F filters of K x K (stride 1, no
+ * padding), "maxpool<P>" / "avgpool<P>" pool non-overlapping P x P windows and "softmax<C>"
+ * is a fully connected output layer of C classes with a softmax activation.
+ * @param tokens the layer tokens in order from the input layer
+ * @param specs filled with the spec of each layer
+ * @return false if a token is malformed or does not fit the layer before it
+ */
+bool parseLayerSpecs(vector<string>& tokens, vector<LayerSpec>& specs)
+{
+   specs.resize(tokens.size());
+   for (int n = 0; n < tokens.size(); n++)
+   {
+      const char* token = tokens[n].c_str();
+      LayerSpec& spec = specs[n];
+      int filters, size;
+
+      if (sscanf(token, "conv%dx%d", &filters, &size) == 2)
+      {
+         if (n == 0 || filters < 1 || size < 1 || size > specs[n-1].height || size > specs[n-1].width)
+         {
+            return false;
+         }
+         spec = {LAYER_CONV, filters, specs[n-1].height - size + 1, specs[n-1].width - size + 1, size};
+      }
+      else if (sscanf(token, "maxpool%d", &size) == 1 || sscanf(token, "avgpool%d", &size) == 1)
+      {
+         if (n == 0 || size < 1 || size > specs[n-1].height || size > specs[n-1].width)
+         {
+            return false;
+         }
+         int type = tokens[n].compare(0, 3, "max") == 0 ? LAYER_MAXPOOL : LAYER_AVGPOOL;
+         spec = {type, specs[n-1].channels, specs[n-1].height/size, specs[n-1].width/size, size};
+      }
+      else if (sscanf(token, "linear%d", &size) == 1)
+      {
+         if (n == 0 || n == tokens.size() - 1 || size < 1)        //Only hidden layers
+         {
+            return false;
+         }
+         spec = {LAYER_LINEAR, size, 1, 1, 0};
+      }
+      else if (sscanf(token, "softmax%d", &size) == 1)
+      {
+         if (n == 0 || n != tokens.size() - 1 || size < 2)       //Only the output layer
+         {
+            return false;
+         }
+         spec = {LAYER_SOFTMAX, size, 1, 1, 0};
+      }
+      else
+      {
+         size = atoi(token);
+         if (size < 1)
+         {
+            return false;
+         }
+         int side = (int) (sqrt((double) size) + 0.5);
+         if (n == 0 && side*side == size)
+         {
+            spec = {LAYER_FULL, 1, side, side, 0};
+         }
+         else
+         {
+            spec = {LAYER_FULL, size, 1, 1, 0};
+         }
+      }
+   }
+   return true;
+
+}  //bool parseLayerSpecs(vector<string>& tokens, vector<LayerSpec>& specs)
+
+/*
+ * The token a layer is written as in an input file
+ */
+string layerName(LayerSpec& spec)
+{
+   if (spec.type == LAYER_CONV)
+   {
+      return "conv" + to_string(spec.channels) + "x" + to_string(spec.kernel);
+   }
+   if (spec.type == LAYER_MAXPOOL)
+   {
+      return "maxpool" + to_string(spec.kernel);
+   }
+   if (spec.type == LAYER_AVGPOOL)
+   {
+      return "avgpool" + to_string(spec.kernel);
+   }
+   if (spec.type == LAYER_SOFTMAX)
+   {
+      return "softmax" + to_string(spec.channels);
+   }
+   if (spec.type == LAYER_LINEAR)
+   {
+      return "linear" + to_string(spec.channels);
+   }
+   return to_string(layerSize(spec));
+}
+
+/*
+ * The number of neurons in a layer
+ */
+int layerSize(LayerSpec& spec)
+{
+   return spec.channels*spec.height*spec.width;
+}
+
+/*
+ * Whether a layer is fed by a fully connected weights layer (plain, softmax or linear)
+ */
+bool isFullyConnected(LayerSpec& spec)
+{
+   return spec.type == LAYER_FULL || spec.type == LAYER_SOFTMAX || spec.type == LAYER_LINEAR;
+}
+
+/*
+ * Shapes a weights array for the given layers - [source][destination] for fully connected
+ * layers, [filter][channel*kernel*kernel] for convolutions and empty for pooling layers
+ */
+void shapeWeights(vector<vector<vector<double> > >& weights, int numLayers, LayerSpec* specs)
+{
+   weights.resize(numLayers - 1);
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      LayerSpec& out = specs[n+1];
+      if (isFullyConnected(out))
+      {
+         weights[n].resize(layerSize(specs[n]));
+         for (int j = 0; j < weights[n].size(); j++)
+         {
+            weights[n][j].resize(layerSize(out));
+         }
+      }
+      else if (out.type == LAYER_CONV)
+      {
+         weights[n].resize(out.channels);
+         for (int f = 0; f < weights[n].size(); f++)
+         {
+            weights[n][f].resize(specs[n].channels*out.kernel*out.kernel);
+         }
+      }
+      else
+      {
+         weights[n].clear();
+      }
+   }
+   return;
+
+}  //void shapeWeights(...)
+
+/*
+ * The total number of weights of the given layers
+ */
+long countWeights(int numLayers, LayerSpec* specs)
+{
+   long numWeights = 0;
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      LayerSpec& out = specs[n+1];
+      if (isFullyConnected(out))
+      {
+         numWeights += (long) layerSize(specs[n])*layerSize(out);
+      }
+      else if (out.type == LAYER_CONV)
+      {
+         numWeights += (long) out.channels*specs[n].channels*out.kernel*out.kernel;
+      }
+   }
+   return numWeights;
+}
+
+/*
+ * The bytes a Network allocates for activations - the layers, the theta, omega and psi
+ * arrays and the work buffers of the convolution and pooling layers
+ */
+long activationBytes(int numLayers, LayerSpec* specs)
+{
+   long bytes = layerSize(specs[0])*sizeof(double);
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      LayerSpec& out = specs[n+1];
+      bytes += 4L*layerSize(out)*sizeof(double);
+      if (out.type == LAYER_CONV)
+      {
+         long columnSize = (long) specs[n].channels*out.kernel*out.kernel*out.height*out.width;
+         bytes += (n > 0 ? 2 : 1)*columnSize*sizeof(double);
+      }
+      else if (out.type == LAYER_MAXPOOL)
+      {
+         bytes += layerSize(out)*sizeof(int);
+      }
+   }
+   return bytes;
+}
+
+/*
+ * Estimated FLOPs of one forward pass (multiply-adds count as two, an activation as four)
+ */
+double forwardFlops(int numLayers, LayerSpec* specs)
+{
+   double flops = 0.0;
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      LayerSpec& out = specs[n+1];
+      double outSize = layerSize(out);
+      if (isFullyConnected(out))
+      {
+         flops += 2.0*layerSize(specs[n])*outSize + 4.0*outSize;
+      }
+      else if (out.type == LAYER_CONV)
+      {
+         flops += 2.0*specs[n].channels*out.kernel*out.kernel*outSize + 4.0*outSize;
+      }
+      else
+      {
+         flops += layerSize(specs[n]);
+      }
+   }
+   return flops;
+}
+
+/*
+ * Estimated FLOPs of one updateWeights() pass - the omega sums (not needed below the
+ * first weights layer), the delta weights and increments, and the psi values
+ */
+double updateFlops(int numLayers, LayerSpec* specs)
+{
+   double flops = 0.0;
+   for (int n = 0; n < numLayers - 1; n++)
+   {
+      LayerSpec& out = specs[n+1];
+      double outSize = layerSize(out);
+      double macs = 0.0;
+      if (isFullyConnected(out))
+      {
+         macs = (double) layerSize(specs[n])*outSize;
+      }
+      else if (out.type == LAYER_CONV)
+      {
+         macs = (double) specs[n].channels*out.kernel*out.kernel*outSize;
+      }
+      else
+      {
+         flops += layerSize(specs[n]);
+      }
+      flops += (n > 0 ? 2.0 : 0.0)*macs + 3.0*macs + 8.0*outSize;
+   }
+   return flops;
+}
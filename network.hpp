@@ -21,18 +21,51 @@
 #include <vector> 
 #include <string> 
 #include <math.h>
+#include <stdint.h>
+
+#include "bf16.hpp"
+#include "pool.hpp"
 
 using namespace std;
 
 
 /*
- * Global variables storing the hyperparameter values
+ * Global variables storing the hyperparameter values read from the config file - they are
+ * only the defaults every network starts from (see Hyperparameters)
  */
 extern double lambda;
 extern int maxIter;
 extern double randomWeightMin;
 extern double randomWeightMax;
 extern double minError;
+extern int freezeLayers;
+extern int weightInit;
+
+/*
+ * How the weights of a new network are drawn - uniformly from the configured range,
+ * or scaled by the fan in and fan out of each layer (Xavier/Glorot uniform, He normal)
+ */
+enum WeightInit {INIT_UNIFORM, INIT_XAVIER, INIT_HE};
+
+/*
+ * The hyperparameters of one network. Each network has its own, so several networks
+ * with different settings can be trained in one process.
+ */
+struct Hyperparameters
+{
+   double lambda;
+   int maxIter;
+   double randomWeightMin;
+   double randomWeightMax;
+   double minError;
+   int init;                  //A WeightInit
+   unsigned long seed;        //Seed of the weight initialization
+};
+
+/*
+ * The hyperparameters given by the config file (the global values)
+ */
+Hyperparameters configHyperparameters();
 
 /*
  * These functions are general utilities that are not part of
@@ -42,6 +75,71 @@ extern double minError;
 double activation(double x);
 double derivative(double x);
 double randomGenerator(double min, double max);
+string initName(int init);
+void softmaxValues(const double* thetas, double* outputs, int size);
+double outputError(int type, int size, const double* thetas, const double* outputs, const double* truth,
+                   double* omegas, double* psis);
+
+/*
+ * The kinds of connection that can feed a layer. A softmax layer is fully connected but
+ * normalizes its outputs into class probabilities - it can only be the output layer, and
+ * the network's error is then the cross-entropy instead of the sum of squares. A linear
+ * layer is fully connected with no activation function (its activations are its theta
+ * values) - it is the narrow middle of a large layer factored into two thin ones, so it
+ * can only be a hidden layer.
+ */
+enum LayerType {LAYER_FULL, LAYER_CONV, LAYER_MAXPOOL, LAYER_AVGPOOL, LAYER_SOFTMAX, LAYER_LINEAR};
+
+/*
+ * The shape of one layer and the connection that feeds it from the layer before.
+ * Fully connected layers are channels x 1 x 1; the input layer is a 1 x s x s image
+ * when its size is a perfect square. kernel is the filter size of a convolution or the
+ * window of a pooling layer.
+ */
+struct LayerSpec
+{
+   int type;
+   int channels;
+   int height;
+   int width;
+   int kernel;
+};
+
+/*
+ * Helpers for layer specs - parsing the topology tokens of an input file ("40",
+ * "conv6x5", "maxpool2", "avgpool2", "softmax5", "linear32"), shaping a weights array for them and
+ * sizing the work and memory they need
+ */
+bool parseLayerSpecs(vector<string>& tokens, vector<LayerSpec>& specs);
+string layerName(LayerSpec& spec);
+int layerSize(LayerSpec& spec);
+bool isFullyConnected(LayerSpec& spec);
+void shapeWeights(vector<vector<vector<double> > >& weights, int numLayers, LayerSpec* specs);
+long countWeights(int numLayers, LayerSpec* specs);
+long activationBytes(int numLayers, LayerSpec* specs);
+double forwardFlops(int numLayers, LayerSpec* specs);
+double updateFlops(int numLayers, LayerSpec* specs);
+
+/*
+ * A read-only view of a weights array - it does not own or copy the weights, and each
+ * row (the weights leaving one source neuron, or one filter) is handed out as a pointer
+ * and a length. A view is only valid while the array it looks at is alive and unchanged
+ * in shape, so it should be used right away rather than stored.
+ */
+class WeightsView
+{
+   const vector<vector<vector<double> > >* viewed;
+
+   public:
+      explicit WeightsView(const vector<vector<vector<double> > >& weights);
+      WeightsView(vector<vector<vector<double> > >&& weights) = delete;     //A temporary would leave it dangling
+      int numLayers() const;
+      int numRows(int n) const;
+      int rowLength(int n, int j) const;
+      const double* row(int n, int j) const;
+      double at(int n, int j, int i) const;
+
+}; //WeightsView class declarations
 
 
 /*
@@ -52,12 +150,14 @@ double randomGenerator(double min, double max);
  * Constructing a network currently requires the weights array to already be 
  * formatted (values do not have to be known) but this is done by the driver method
  * 
- * Usage: Network net = Network(numLayers, layerSizes[], hasWeights (0 or 1), weightsArray)
+ * Usage: Network net = Network(numLayers, layerSizes[], hasWeights (0 or 1), weightsArray[, layerSpecs[, params]])
  * numHidden and numInput are both integers, hiddenLayerSizes is a vector of integers representing
  * the size of all the hidden layers in the perceptron (currently generalized but should only be one
  * for training to work)
  * and weights is a three dimensional array of double values having the same shape as the perceptron's
  * structure
+ * Layers can also be convolutional or pooling layers (given by the optional layer specs) -
+ * the weights of a convolution are [filter][channel*kernel*kernel] and pooling layers have none.
  */
 class Network
 {
@@ -76,17 +176,57 @@ class Network
    double** theta; 
    double** omega; 
    double** psi; 
+   vector<LayerSpec> specs;
+   double** columns;       //im2col buffers of the convolutions (NULL for other layers)
+   double** columnGrads;   //Gradients at the im2col buffers
+   int** poolIndex;        //Position of the max of each window of the max pooling layers
+   vector<bool> frozen;    //Weights layers that are not trained
+   int firstTrained;       //The lowest weights layer that is trained (backpropagation stops there)
+   vector<vector<bf16> > packedWeights;   //bf16 copy of the fully connected weights, [destination][source]
+   bf16* packedActivations;               //bf16 copy of the layer being fed forward
+   bool packedReady;                      //Whether the bf16 copy matches the weights
+   vector<uint64_t> signBits;             //Binarized first layer - weight signs, [destination][word]
+   vector<double> signScales;             //Mean weight magnitude of each destination
+   bool binaryReady;                      //Whether the binarized first layer matches the weights
+   Hyperparameters params;
+   WorkPool* pool;                        //Splits large layers across threads (NULL runs serially)
 
    private:
       void fillWeights(double min, double max);
+      void forward(int start, int end);
+      void forwardBf16(int n);
+      void forwardParallel(int n);
+      int chunkWidth(int n);
+      void backward(double step, bool apply);
+      void backwardFull(int n, double step, bool propagate, bool apply);
+      void backwardConv(int n, double step, bool propagate, bool apply);
+      void backwardPool(int n, bool propagate);
+      void setPsi(int n);
+      void finishLayer(int n);
 
    public:
-      Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vector<vector<double> > >& weightsInput);
+      Network(int numLayers, int* layerSizesInp, int hasWeights, vector<vector<vector<double> > > weightsInput,
+              LayerSpec* specsInput = NULL, Hyperparameters* paramsInput = NULL);
+      Hyperparameters& hyperparameters();
       void setTruth(double* truthValue);
       double* run(double inputValues[]);
+      double* runFrom(int start, double values[]);
+      double* runBits(const uint64_t* bits);
+      double* features(double inputValues[], int layer);
+      int predict(double inputValues[]);
+      vector<int> topK(int k);
+      void freezeLayer(int n, bool isFrozen);
+      void packBf16();
+      void packBinary();
+      void setPool(WorkPool* workPool);
       void updateWeights();
+      void accumulateGradient(double* gradient);
+      long numParameters();
+      void getParameters(double* values);
+      void setParameters(const double* values);
+      Network* replica();
       double error();
-      vector<vector<vector<double> > > getWeights();
+      WeightsView getWeights();
       ~Network();
 
 }; //Network class declarations
@@ -0,0 +1,251 @@
+/*
+ * Implementation of online learning. The replay buffer is a reservoir sample (Vitter's
+ * algorithm R): once it is full, the n-th training set seen replaces a random entry with
+ * probability replaySize/n, so the buffer stays a uniform sample of the whole stream and
+ * old training sets are not crowded out by a burst of new ones.
+ *
+ * The error logged is the error of each new training set before the network is updated
+ * on it (how well the network predicted it), averaged over the last publishInterval sets.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/6/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "online.hpp"
+#include "reader.hpp"
+#include "binary.hpp"
+#include "bf16.hpp"
+#include "random.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include "perfcounters.hpp"
+
+using namespace std;
+
+extern string outputFile;
+
+/*
+ * Default online learning options (can be overridden in the config file)
+ */
+int onlineSteps = 3;
+int replaySize = 256;
+int replaySamples = 4;
+int publishInterval = 100;
+
+
+/*
+ * Training sets kept for replay - the inputs and truth values of each entry next to each other
+ */
+struct ReplayBuffer
+{
+   vector<double> values;
+   long count;          //Entries in use
+   long seen;           //Training sets offered so far
+   int stride;
+};
+
+/*
+ * Offers a training set to the reservoir
+ */
+static void addReplay(ReplayBuffer& buffer, Philox& generator, double* input, double* truth, int numIn, int numOut)
+{
+   buffer.seen++;
+   long entry = buffer.count;
+   if (buffer.count == replaySize)
+   {
+      entry = (long) (generator.uniform()*buffer.seen);
+      if (entry >= replaySize)
+      {
+         return;
+      }
+   }
+   else
+   {
+      buffer.count++;
+   }
+   copy(input, input + numIn, buffer.values.begin() + entry*buffer.stride);
+   copy(truth, truth + numOut, buffer.values.begin() + entry*buffer.stride + numIn);
+   return;
+}
+
+/*
+ * One forward and backward pass on a training set
+ * @return the error of the set before the update
+ */
+static double step(Network& net, double* input, double* truth)
+{
+   net.setTruth(truth);
+   perfBegin();
+   net.run(input);
+   perfEnd(PERF_RUN);
+   double error = net.error();
+   perfBegin();
+   net.updateWeights();
+   perfEnd(PERF_UPDATE);
+   return error;
+}
+
+/*
+ * Writes the weights to a temporary file and renames it over the output file, so anything
+ * loading the weights sees either the old file or the new one, never half of one
+ */
+static void publish(Network& net)
+{
+   string temporary = outputFile + ".tmp";
+   if (bf16Storage)
+   {
+      exportWeightsBf16(net.getWeights(), temporary);
+   }
+   else
+   {
+      exportWeights(net.getWeights(), temporary);
+   }
+   if (rename(temporary.c_str(), outputFile.c_str()) != 0)
+   {
+      cout << "Could not replace \"" << outputFile << "\" with the new weights" << endl;
+   }
+   return;
+}
+
+/*
+ * Runs the online learning loop
+ * @param source "-" for stdin, or the name of a file or FIFO (a FIFO is opened again
+ * whenever its writer closes it, so writers can come and go)
+ * @param net the network to keep training
+ * @param numIn the number of input values per training set
+ * @param numOut the number of truth values per training set
+ * @param seedSets training sets to start the replay buffer with (may be NULL)
+ * @return the number of new training sets learned
+ */
+long runOnline(string source, Network& net, int numIn, int numOut, Dataset* seedSets)
+{
+   Philox generator(runSeed(), RNG_REPLAY);
+   ReplayBuffer buffer;
+   buffer.stride = numIn + numOut;
+   buffer.count = 0;
+   buffer.seen = 0;
+   replaySize = max(replaySize, 1);
+   buffer.values.resize((long) replaySize*buffer.stride);
+   trackAlloc(MEM_DATASET, buffer.values.size()*sizeof(double));
+
+   if (seedSets != NULL)
+   {
+      Sample sample;
+      seedSets->startEpoch(0);
+      while (seedSets->next(sample))
+      {
+         addReplay(buffer, generator, sample.input, sample.truth, numIn, numOut);
+      }
+   }
+
+   struct stat info;
+   bool isFifo = source != "-" && stat(source.c_str(), &info) == 0 && S_ISFIFO(info.st_mode);
+   ifstream fileIn;
+   if (source != "-")
+   {
+      fileIn.open(source);
+   }
+   istream& in = source == "-" ? cin : fileIn;
+   cout << "Online learning from " << (source == "-" ? "stdin" : "\"" + source + "\"") << " - "
+        << onlineSteps << " steps per training set, " << replaySamples << " replayed from "
+        << buffer.count << " of " << replaySize << " buffered" << endl;
+
+   vector<double> input(numIn);
+   vector<double> truth(numOut);
+   vector<uint64_t> bits(bitWords(numIn));
+   long learned = 0;
+   long lineNumber = 0;
+   double recentError = 0.0;
+   string line;
+
+   while (true)
+   {
+      if (!getline(in, line))
+      {
+         if (isFifo)                  //The writer went away - wait for the next one
+         {
+            fileIn.close();
+            fileIn.clear();
+            fileIn.open(source);
+            continue;
+         }
+         break;
+      }
+      lineNumber++;
+      if (line.find_first_not_of(" \t\r") == string::npos)
+      {
+         continue;
+      }
+      if (line.find("end") != string::npos)
+      {
+         break;
+      }
+
+      istringstream values(line);
+      int read = 0;
+      double value;
+      while (read < numIn + numOut && values >> value)
+      {
+         if (read < numIn)
+         {
+            input[read] = value/255.0;          //Scaled like the train files
+         }
+         else
+         {
+            truth[read - numIn] = value;
+         }
+         read++;
+      }
+      if (read < numIn + numOut)
+      {
+         cout << "Skipping line " << lineNumber << " - expected " << numIn + numOut << " values, got "
+              << read << endl;
+         continue;
+      }
+      if (binarizeInputs == 1)            //Thresholded like the input file's training sets
+      {
+         packBits(input.data(), numIn, binaryThreshold, bits.data());
+         unpackBits(bits.data(), numIn, input.data());
+      }
+
+      /*
+       * The new training set, then a few from the replay buffer
+       */
+      TraceScope scope("online training set", learned);
+      recentError += step(net, input.data(), truth.data());
+      for (int s = 1; s < onlineSteps; s++)
+      {
+         step(net, input.data(), truth.data());
+      }
+      for (int r = 0; r < replaySamples && buffer.count > 0; r++)
+      {
+         double* entry = &buffer.values[(long) (generator.uniform()*buffer.count)*buffer.stride];
+         step(net, entry, entry + numIn);
+      }
+      addReplay(buffer, generator, input.data(), truth.data(), numIn, numOut);
+      learned++;
+
+      if (learned % max(publishInterval, 1) == 0)
+      {
+         publish(net);
+         cout << "Learned " << learned << " training sets - error before update "
+              << recentError/max(publishInterval, 1) << ", weights published to \"" << outputFile << "\"" << endl;
+         recentError = 0.0;
+      }
+   }  //while (true)
+
+   publish(net);
+   cout << "Online learning finished after " << learned << " training sets - weights saved to \""
+        << outputFile << "\"" << endl << endl;
+   trackFree(MEM_DATASET, buffer.values.size()*sizeof(double));
+   return learned;
+
+}  //long runOnline(...)
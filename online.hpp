@@ -0,0 +1,47 @@
+/*
+ * Header file for online learning - Contains the declaration of the online trainer
+ * that keeps training an already trained network on labeled training sets as they
+ * arrive on stdin or a named pipe (FIFO), without retraining from scratch.
+ *
+ * Every new training set gets onlineSteps updates, followed by replaySamples updates on
+ * training sets drawn from a replay buffer of replaySize earlier sets (a uniform sample
+ * of everything seen so far, including the input file's training sets), so the network
+ * does not forget what it learned before. Every publishInterval training sets the weights
+ * are written to the output file, replacing it in one step.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/6/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef ONLINE_H
+#define ONLINE_H
+
+#include <string>
+
+#include "network.hpp"
+#include "dataset.hpp"
+
+using namespace std;
+
+/*
+ * Global variables storing the online learning options (can be set in the config file)
+ */
+extern int onlineSteps;
+extern int replaySize;
+extern int replaySamples;
+extern int publishInterval;
+
+/*
+ * Trains the network on the training sets read from source ("-" for stdin, otherwise a
+ * file or FIFO) until the end of the stream or a line "end". Each line is one training
+ * set - numIn input values (0-255, like the train files) followed by numOut truth values.
+ * seedSets (may be NULL) fill the replay buffer before the first new set.
+ * Returns the number of training sets learned.
+ */
+long runOnline(string source, Network& net, int numIn, int numOut, Dataset* seedSets);
+
+
+#endif /* ONLINE_H */
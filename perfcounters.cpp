@@ -0,0 +1,286 @@
+/*
+ * Implementation of the hardware performance counters. All counters are opened as
+ * one perf_event group (led by the cycle counter) on the calling thread, so a single
+ * read() returns all of them at once at every phase boundary. Counters that fail to
+ * open are left out of the group; if the leader fails, hardware counting is off.
+ *
+ * Floating point operations are counted with the FP_ARITH_INST_RETIRED events on Intel
+ * CPUs (scalar double and 128-bit packed double, the only double precision forms the
+ * compiler emits at the default flags). Elsewhere the FLOPs are estimated from the layer specs.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/21/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfcounters.hpp"
+
+using namespace std;
+
+/*
+ * Default machine peaks (unknown - can be overridden in the config file)
+ */
+double peakGflops = 0.0;
+double peakBandwidth = 0.0;
+
+bool perfEnabled = false;
+
+/*
+ * The counters in the group, in the order they are read
+ */
+enum Counter {CNT_CYCLES, CNT_INSTRUCTIONS, CNT_LLC_MISSES, CNT_DTLB_MISSES, CNT_FP_SCALAR,
+              CNT_FP_PACKED, NUM_COUNTERS};
+const char* counterNames[] = {"cycles", "instructions", "LLC misses", "dTLB misses",
+                              "FP scalar double", "FP 128-bit packed double"};
+
+static int leaderFd = -1;
+static int counterFd[NUM_COUNTERS];
+static int readSlot[NUM_COUNTERS];          //Position of each counter in a group read (-1 if not open)
+static int numOpen = 0;
+static bool scaled = false;                 //Whether the counts ever had to be scaled for multiplexing
+
+static unsigned long long beginValues[NUM_COUNTERS];
+static double totals[NUM_PERF_PHASES][NUM_COUNTERS];
+static double seconds[NUM_PERF_PHASES];
+static long passes[NUM_PERF_PHASES];
+static chrono::steady_clock::time_point beginTime;
+
+/*
+ * Thin wrapper - glibc has no perf_event_open()
+ */
+static int openEvent(unsigned int type, unsigned long long config, int groupFd)
+{
+   struct perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = type;
+   attr.config = config;
+   attr.disabled = groupFd == -1 ? 1 : 0;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+   attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+   return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+/*
+ * Checks /proc/cpuinfo for an Intel CPU (the FP_ARITH events are Intel specific)
+ */
+static bool isIntel()
+{
+   ifstream cpuinfo("/proc/cpuinfo");
+   string line;
+   while (getline(cpuinfo, line))
+   {
+      if (line.find("vendor_id") != string::npos)
+      {
+         return line.find("GenuineIntel") != string::npos;
+      }
+   }
+   return false;
+}
+
+/*
+ * Opens the counter group. Timing is always on; hardware counting only if
+ * at least the cycle counter could be opened.
+ * @return whether hardware counters are available
+ */
+bool perfStart()
+{
+   perfEnabled = true;
+   numOpen = 0;
+   for (int c = 0; c < NUM_COUNTERS; c++)
+   {
+      counterFd[c] = -1;
+      readSlot[c] = -1;
+   }
+
+   leaderFd = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+   if (leaderFd < 0)
+   {
+      cout << "Hardware counters unavailable (" << strerror(errno) << ") - check "
+           << "/proc/sys/kernel/perf_event_paranoid; only timing will be reported" << endl;
+      return false;
+   }
+   counterFd[CNT_CYCLES] = leaderFd;
+   readSlot[CNT_CYCLES] = numOpen++;
+
+   unsigned long long llcMiss = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+   unsigned long long dtlbMiss = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+   counterFd[CNT_INSTRUCTIONS] = openEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leaderFd);
+   counterFd[CNT_LLC_MISSES] = openEvent(PERF_TYPE_HW_CACHE, llcMiss, leaderFd);
+   counterFd[CNT_DTLB_MISSES] = openEvent(PERF_TYPE_HW_CACHE, dtlbMiss, leaderFd);
+   if (isIntel())
+   {
+      counterFd[CNT_FP_SCALAR] = openEvent(PERF_TYPE_RAW, 0x01c7, leaderFd);
+      counterFd[CNT_FP_PACKED] = openEvent(PERF_TYPE_RAW, 0x04c7, leaderFd);
+   }
+
+   for (int c = CNT_INSTRUCTIONS; c < NUM_COUNTERS; c++)
+   {
+      if (counterFd[c] >= 0)
+      {
+         readSlot[c] = numOpen++;
+      }
+      else
+      {
+         cout << "Counter \"" << counterNames[c] << "\" unavailable - leaving it out" << endl;
+      }
+   }
+
+   ioctl(leaderFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+   ioctl(leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+   return true;
+
+}  //bool perfStart()
+
+/*
+ * Reads the whole group, scaling the counts up if the group was only scheduled
+ * part of the time (multiplexed with other users of the PMU)
+ */
+static void readGroup(unsigned long long* values)
+{
+   unsigned long long buffer[3 + NUM_COUNTERS];
+   if (read(leaderFd, buffer, sizeof(buffer)) < 0)
+   {
+      return;
+   }
+
+   double scale = 1.0;
+   if (buffer[2] > 0 && buffer[2] < buffer[1])
+   {
+      scale = (double) buffer[1]/buffer[2];
+      scaled = true;
+   }
+   for (int c = 0; c < NUM_COUNTERS; c++)
+   {
+      values[c] = readSlot[c] >= 0 ? (unsigned long long) (buffer[3 + readSlot[c]]*scale) : 0;
+   }
+   return;
+}
+
+void perfBeginCounting()
+{
+   if (leaderFd >= 0)
+   {
+      readGroup(beginValues);
+   }
+   beginTime = chrono::steady_clock::now();
+   return;
+}
+
+void perfEndCounting(int phase)
+{
+   seconds[phase] += chrono::duration<double>(chrono::steady_clock::now() - beginTime).count();
+   passes[phase]++;
+   if (leaderFd >= 0)
+   {
+      unsigned long long endValues[NUM_COUNTERS];
+      readGroup(endValues);
+      for (int c = 0; c < NUM_COUNTERS; c++)
+      {
+         totals[phase][c] += (double) (endValues[c] - beginValues[c]);
+      }
+   }
+   return;
+}
+
+/*
+ * Prints the counts and derived metrics of every phase and closes the counters
+ */
+void perfReport(int numLayers, LayerSpec* specs)
+{
+   const char* phaseNames[] = {"run()", "updateWeights()"};
+
+   cout << "PERFORMANCE COUNTERS" << endl << endl;
+   for (int p = 0; p < NUM_PERF_PHASES; p++)
+   {
+      if (passes[p] == 0)
+      {
+         continue;
+      }
+      double* t = totals[p];
+      double flops = (p == PERF_RUN ? forwardFlops(numLayers, specs) : updateFlops(numLayers, specs))*passes[p];
+      bool hardwareFlops = readSlot[CNT_FP_SCALAR] >= 0 && t[CNT_FP_SCALAR] + t[CNT_FP_PACKED] > 0;
+      if (hardwareFlops)
+      {
+         flops = t[CNT_FP_SCALAR] + 2.0*t[CNT_FP_PACKED];
+      }
+
+      cout << phaseNames[p] << ": " << passes[p] << " passes, " << seconds[p]*1e6/passes[p]
+           << " us/pass, " << flops/seconds[p]*1e-9 << " GFLOP/s ("
+           << (hardwareFlops ? "counted" : "estimated") << " FLOPs)" << endl;
+
+      if (leaderFd >= 0)
+      {
+         double kiloInstructions = t[CNT_INSTRUCTIONS]/1000.0;
+         double memoryBytes = 64.0*t[CNT_LLC_MISSES];
+         cout << "   IPC: " << (t[CNT_CYCLES] > 0 ? t[CNT_INSTRUCTIONS]/t[CNT_CYCLES] : 0.0) << endl;
+         cout << "   LLC misses per 1000 instructions: "
+              << (kiloInstructions > 0 ? t[CNT_LLC_MISSES]/kiloInstructions : 0.0) << endl;
+         cout << "   dTLB misses per 1000 instructions: "
+              << (kiloInstructions > 0 ? t[CNT_DTLB_MISSES]/kiloInstructions : 0.0) << endl;
+
+         /*
+          * Arithmetic intensity against the bytes that actually came from memory
+          * (each LLC miss brings in one 64 byte line)
+          */
+         if (memoryBytes > 0)
+         {
+            double intensity = flops/memoryBytes;
+            cout << "   Arithmetic intensity: " << intensity << " FLOP/byte of memory traffic" << endl;
+            if (peakGflops > 0 && peakBandwidth > 0)
+            {
+               double ridge = peakGflops/peakBandwidth;
+               double attainable = min(peakGflops, intensity*peakBandwidth);
+               cout << "   Roofline: " << (intensity < ridge ? "memory-bound" : "compute-bound")
+                    << " (ridge at " << ridge << " FLOP/byte, attainable " << attainable
+                    << " GFLOP/s)" << endl;
+            }
+            else
+            {
+               cout << "   (set peakGflops and peakBandwidth in the config file for a roofline verdict)"
+                    << endl;
+            }
+         }
+         else
+         {
+            cout << "   No LLC misses - the working set fits in cache (compute-bound)" << endl;
+         }
+      }
+   }
+   if (scaled)
+   {
+      cout << "Note - counters were multiplexed, counts are scaled estimates" << endl;
+   }
+   cout << endl;
+
+   for (int c = 0; c < NUM_COUNTERS; c++)
+   {
+      if (counterFd[c] >= 0)
+      {
+         close(counterFd[c]);
+      }
+   }
+   leaderFd = -1;
+   perfEnabled = false;
+
+   return;
+
+}  //void perfReport(int numLayers, LayerSpec* specs)
@@ -0,0 +1,80 @@
+/*
+ * Header file for the hardware performance counters - Contains declarations
+ * for counting cycles, instructions, last level cache misses, dTLB misses and floating
+ * point operations (through Linux perf_event_open) around the forward and backward passes.
+ *
+ * At the end of a run the counts are turned into IPC, miss rates and an arithmetic
+ * intensity (FLOPs per byte brought in from memory) to tell whether each phase is
+ * compute-bound or memory-bound. If the counters cannot be opened (no permission,
+ * a container, a virtual machine) only the timing and estimated FLOPs are reported.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/21/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <string>
+
+#include "network.hpp"
+
+using namespace std;
+
+/*
+ * Machine peaks used for the roofline verdict (can be set in the config file,
+ * 0 if unknown)
+ */
+extern double peakGflops;
+extern double peakBandwidth;
+
+/*
+ * The phases that are counted separately
+ */
+enum PerfPhase {PERF_RUN, PERF_UPDATE, NUM_PERF_PHASES};
+
+/*
+ * Whether counting is on (set by perfStart)
+ */
+extern bool perfEnabled;
+
+/*
+ * Opens the counters. Returns false (and prints why) if the hardware counters
+ * are not available, in which case only time is measured.
+ */
+bool perfStart();
+
+/*
+ * Brackets one pass of a phase - perfEnd adds the counts since perfBegin to the phase
+ */
+void perfBeginCounting();
+void perfEndCounting(int phase);
+
+inline void perfBegin()
+{
+   if (perfEnabled)
+   {
+      perfBeginCounting();
+   }
+}
+
+inline void perfEnd(int phase)
+{
+   if (perfEnabled)
+   {
+      perfEndCounting(phase);
+   }
+}
+
+/*
+ * Prints the counts, IPC, miss rates and arithmetic intensity of every phase.
+ * The FLOPs per pass of each phase are estimated from the topology for when the
+ * hardware cannot count them.
+ */
+void perfReport(int numLayers, LayerSpec* specs);
+
+
+#endif /* PERFCOUNTERS_H */
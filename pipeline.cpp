@@ -0,0 +1,577 @@
+/*
+ * Implementation of the pipeline trainer. The stages work on their own flat copies of
+ * their weights (laid out like getParameters(), [source*destinations + destination]), which
+ * are copied back into the network at the end.
+ *
+ * Stage s hands its outputs to stage s+1 by keeping them in its own activations of the
+ * micro-batch, and stage s+1 hands back the omega values of that layer. Each hand-off is
+ * announced by a counter of the micro-batches done so far in the epoch. A stage only starts
+ * the next group once its backward pass of every micro-batch of the group is done, which in
+ * turn needs every later stage to be done with them, so no buffer of a micro-batch is
+ * written again while another stage can still read it.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/7/20
+ */
+
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <math.h>
+
+#include "pipeline.hpp"
+#include "trainer.hpp"
+#include "metrics.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+/*
+ * Default pipeline options (can be overridden in the config file)
+ */
+int pipelineStages = 0;       //0 or 1 trains with train()
+int microBatch = 4;           //Training sets per micro-batch
+int pipelineGroup = 8;        //Micro-batches per weight update
+
+
+/*
+ * One stage - the weights layers first to last-1 and what it keeps of each micro-batch
+ */
+struct Stage
+{
+   int first;
+   int last;
+   vector<vector<double> > weights;                   //[layer - first][source*destinations + destination]
+   vector<vector<double> > gradients;                 //Sum of psi*activation over the group
+   vector<vector<vector<double> > > activations;      //[slot][layer - first][sample*size + neuron] of layers first+1 to last
+   vector<vector<vector<double> > > thetas;           //Same shape as the activations
+   vector<vector<double> > omegas;                    //[slot] omega of layer first, handed to the stage before
+   atomic<long> forwardDone;                          //Micro-batches of the epoch whose outputs are ready
+   atomic<long> backwardDone;                         //Micro-batches of the epoch whose backward pass is done
+   double error;                                      //Error of the epoch (last stage only)
+};
+
+/*
+ * Everything the stages share
+ */
+struct Pipeline
+{
+   vector<int> sizes;
+   int outputType;
+   double lambda;
+   vector<Stage> stages;
+   Dataset* data;
+
+   /*
+    * The current group, read in by the first stage
+    */
+   vector<vector<double> > inputs;                    //[slot][sample*inputs + input]
+   vector<vector<double> > truths;                    //[slot][sample*outputs + output]
+   vector<int> slotSamples;                           //Training sets in each micro-batch
+   int groupSlots;                                    //Micro-batches in the group (0 ends the epoch)
+   atomic<long> groupsReady;
+   long numSamples;                                   //Training sets read this epoch
+};
+
+/*
+ * Waits until the counter reaches the value
+ */
+static void waitFor(atomic<long>& counter, long value)
+{
+   while (counter.load(memory_order_acquire) < value)
+   {
+      this_thread::yield();
+   }
+   return;
+}
+
+/*
+ * Splits the weights layers into numStages runs of consecutive layers so that the most
+ * multiply-adds any stage has is as small as possible
+ * @return the first layer of each stage followed by the number of weights layers
+ */
+static vector<int> partition(vector<long>& costs, int numStages)
+{
+   int numWeights = costs.size();
+   vector<long> prefix(numWeights + 1, 0);
+   for (int n = 0; n < numWeights; n++)
+   {
+      prefix[n+1] = prefix[n] + costs[n];
+   }
+
+   /*
+    * best[k][i] is the smallest largest stage for the first i layers in k stages
+    */
+   const long NONE = -1;
+   vector<vector<long> > best(numStages + 1, vector<long>(numWeights + 1, NONE));
+   vector<vector<int> > split(numStages + 1, vector<int>(numWeights + 1, 0));
+   best[0][0] = 0;
+   for (int k = 1; k <= numStages; k++)
+   {
+      for (int i = k; i <= numWeights; i++)
+      {
+         for (int j = k - 1; j < i; j++)
+         {
+            if (best[k-1][j] == NONE)
+            {
+               continue;
+            }
+            long largest = max(best[k-1][j], prefix[i] - prefix[j]);
+            if (best[k][i] == NONE || largest < best[k][i])
+            {
+               best[k][i] = largest;
+               split[k][i] = j;
+            }
+         }
+      }
+   }
+
+   vector<int> firsts(numStages + 1);
+   firsts[numStages] = numWeights;
+   for (int k = numStages; k > 0; k--)
+   {
+      firsts[k-1] = split[k][firsts[k]];
+   }
+   return firsts;
+
+}  //static vector<int> partition(...)
+
+/*
+ * The activations of the layer stage s starts from for the micro-batch in the slot
+ */
+static const double* stageInput(Pipeline& pipe, int s, int slot)
+{
+   if (s == 0)
+   {
+      return pipe.inputs[slot].data();
+   }
+   Stage& before = pipe.stages[s-1];
+   return before.activations[slot][before.last - before.first - 1].data();
+}
+
+/*
+ * Forward pass of stage s for the micro-batch in the slot (the n-th of the epoch)
+ */
+static void forwardStage(Pipeline& pipe, int s, int slot, long sequence)
+{
+   TraceScope scope("pipeline forward", s);
+   Stage& stage = pipe.stages[s];
+   if (s > 0)
+   {
+      waitFor(pipe.stages[s-1].forwardDone, sequence + 1);
+   }
+
+   for (int n = stage.first; n < stage.last; n++)
+   {
+      int numSources = pipe.sizes[n];
+      int numDestinations = pipe.sizes[n+1];
+      const double* weights = stage.weights[n - stage.first].data();
+      const double* in = n == stage.first ? stageInput(pipe, s, slot) : stage.activations[slot][n - stage.first - 1].data();
+      double* thetas = stage.thetas[slot][n - stage.first].data();
+      double* out = stage.activations[slot][n - stage.first].data();
+      bool softmax = n == pipe.sizes.size() - 2 && pipe.outputType == LAYER_SOFTMAX;
+
+      for (int k = 0; k < pipe.slotSamples[slot]; k++)
+      {
+         const double* source = in + (long) k*numSources;
+         double* sums = thetas + (long) k*numDestinations;
+         for (int i = 0; i < numDestinations; i++)
+         {
+            sums[i] = 0.0;
+         }
+         for (int j = 0; j < numSources; j++)      //Same order of additions as Network::run()
+         {
+            const double* row = weights + (long) j*numDestinations;
+            for (int i = 0; i < numDestinations; i++)
+            {
+               sums[i] += row[i] * source[j];
+            }
+         }
+
+         double* values = out + (long) k*numDestinations;
+         if (softmax)
+         {
+            softmaxValues(sums, values, numDestinations);
+         }
+         else
+         {
+            for (int i = 0; i < numDestinations; i++)
+            {
+               values[i] = activation(sums[i]);
+            }
+         }
+      }
+   }  //for (int n = stage.first; n < stage.last; n++)
+
+   stage.forwardDone.store(sequence + 1, memory_order_release);
+   return;
+
+}  //static void forwardStage(...)
+
+/*
+ * Backward pass of stage s for the micro-batch in the slot - adds the micro-batch's
+ * psi*activation products to the stage's gradients and hands the omega values of the
+ * stage's first layer back to the stage before it. The last stage starts from the error.
+ */
+static void backwardStage(Pipeline& pipe, int s, int slot, long sequence)
+{
+   TraceScope scope("pipeline backward", s);
+   Stage& stage = pipe.stages[s];
+   bool lastStage = s == pipe.stages.size() - 1;
+   int numOutputs = pipe.sizes.back();
+   if (!lastStage)
+   {
+      waitFor(pipe.stages[s+1].backwardDone, sequence + 1);
+   }
+
+   int widest = *max_element(pipe.sizes.begin() + stage.first, pipe.sizes.begin() + stage.last + 1);
+   vector<double> psi(widest), previous(widest), omegas(widest);
+
+   for (int k = 0; k < pipe.slotSamples[slot]; k++)
+   {
+      /*
+       * psi of the stage's last layer
+       */
+      int top = stage.last - stage.first - 1;
+      int topSize = pipe.sizes[stage.last];
+      const double* topThetas = &stage.thetas[slot][top][(long) k*topSize];
+      if (lastStage)
+      {
+         stage.error += outputError(pipe.outputType, numOutputs, topThetas,
+                                    &stage.activations[slot][top][(long) k*numOutputs],
+                                    &pipe.truths[slot][(long) k*numOutputs], omegas.data(), psi.data());
+      }
+      else
+      {
+         const double* handed = &pipe.stages[s+1].omegas[slot][(long) k*topSize];
+         for (int i = 0; i < topSize; i++)
+         {
+            psi[i] = handed[i] * derivative(topThetas[i]);
+         }
+      }
+
+      for (int n = stage.last - 1; n >= stage.first; n--)
+      {
+         int numSources = pipe.sizes[n];
+         int numDestinations = pipe.sizes[n+1];
+         const double* weights = stage.weights[n - stage.first].data();
+         double* gradients = stage.gradients[n - stage.first].data();
+         const double* in = (n == stage.first ? stageInput(pipe, s, slot) : stage.activations[slot][n - stage.first - 1].data())
+                            + (long) k*numSources;
+         bool propagate = n > stage.first || s > 0;
+
+         for (int j = 0; j < numSources; j++)
+         {
+            const double* row = weights + (long) j*numDestinations;
+            double* gradientRow = gradients + (long) j*numDestinations;
+            double omega = 0.0;
+            for (int i = 0; i < numDestinations; i++)
+            {
+               omega += psi[i] * row[i];
+               gradientRow[i] += psi[i] * in[j];
+            }
+            previous[j] = omega;
+         }
+
+         if (n > stage.first)
+         {
+            const double* belowThetas = &stage.thetas[slot][n - stage.first - 1][(long) k*numSources];
+            for (int j = 0; j < numSources; j++)
+            {
+               psi[j] = previous[j] * derivative(belowThetas[j]);
+            }
+         }
+         else if (propagate)
+         {
+            copy(previous.begin(), previous.begin() + numSources, &stage.omegas[slot][(long) k*numSources]);
+         }
+      }  //for (int n = stage.last - 1; n >= stage.first; n--)
+   }  //for (int k = 0; k < pipe.slotSamples[slot]; k++)
+
+   stage.backwardDone.store(sequence + 1, memory_order_release);
+   return;
+
+}  //static void backwardStage(...)
+
+/*
+ * Reads the next group of micro-batches (first stage only) and announces it
+ */
+static void readGroup(Pipeline& pipe, long group)
+{
+   TraceScope scope("next training sets");
+   int numIn = pipe.sizes.front();
+   int numOut = pipe.sizes.back();
+   Sample sample;
+   int slots = 0;
+   bool more = true;
+   while (slots < pipe.inputs.size() && more)
+   {
+      int count = 0;
+      while (count < microBatch && (more = pipe.data->next(sample)))
+      {
+         copy(sample.input, sample.input + numIn, &pipe.inputs[slots][(long) count*numIn]);
+         copy(sample.truth, sample.truth + numOut, &pipe.truths[slots][(long) count*numOut]);
+         count++;
+      }
+      if (count > 0)
+      {
+         pipe.slotSamples[slots++] = count;
+         pipe.numSamples += count;
+      }
+   }
+   pipe.groupSlots = slots;
+   pipe.groupsReady.store(group + 1, memory_order_release);
+   return;
+}
+
+/*
+ * The work of stage s for one epoch - group by group, the 1F1B schedule: the stage runs
+ * ahead by as many forward passes as there are stages after it, then alternates one
+ * forward and one backward pass, then finishes the group's backward passes and applies
+ * the gradients to its layers
+ */
+static void runStage(Pipeline& pipe, int s)
+{
+   Stage& stage = pipe.stages[s];
+   int numStages = pipe.stages.size();
+   long sequence = 0;               //Micro-batches of the epoch before the group
+
+   for (long group = 0; ; group++)
+   {
+      if (s == 0)
+      {
+         readGroup(pipe, group);
+      }
+      else
+      {
+         waitFor(pipe.groupsReady, group + 1);
+      }
+      int slots = pipe.groupSlots;
+      if (slots == 0)
+      {
+         break;
+      }
+
+      int forwards = 0;
+      int backwards = 0;
+      int warmup = min(numStages - 1 - s, slots);
+      while (forwards < warmup)
+      {
+         forwardStage(pipe, s, forwards, sequence + forwards);
+         forwards++;
+      }
+      while (forwards < slots)
+      {
+         forwardStage(pipe, s, forwards, sequence + forwards);
+         forwards++;
+         backwardStage(pipe, s, backwards, sequence + backwards);
+         backwards++;
+      }
+      while (backwards < slots)
+      {
+         backwardStage(pipe, s, backwards, sequence + backwards);
+         backwards++;
+      }
+
+      /*
+       * The group boundary - the stage's weights take the summed step of every training set
+       */
+      for (int l = 0; l < stage.weights.size(); l++)
+      {
+         for (long w = 0; w < stage.weights[l].size(); w++)
+         {
+            stage.weights[l][w] += pipe.lambda * stage.gradients[l][w];
+            stage.gradients[l][w] = 0.0;
+         }
+      }
+      sequence += slots;
+   }  //for (long group = 0; ; group++)
+   return;
+
+}  //static void runStage(Pipeline& pipe, int s)
+
+/*
+ * Trains the network in a pipeline of stages. Each epoch is logged like an epoch of
+ * train() (all of its time is counted as update time).
+ * @param numLayers the number of layers of the network
+ * @param specs the type and shape of each layer
+ * @param n the network to train
+ * @param data the training sets
+ * @return 1 if the error went below minError, 3 if it was stopped early (time budget or
+ * signal, checked between epochs), 0 otherwise
+ */
+int trainPipeline(int numLayers, LayerSpec* specs, Network& n, Dataset& data)
+{
+   Hyperparameters& params = n.hyperparameters();
+   bool supported = freezeLayers == 0;
+   for (int l = 1; l < numLayers; l++)
+   {
+      supported = supported && isFullyConnected(specs[l]) && specs[l].type != LAYER_LINEAR;
+   }
+   if (!supported)
+   {
+      cout << "Pipeline training needs a fully connected sigmoid network without frozen layers - training normally" << endl;
+      return train(layerSize(specs[numLayers-1]), n, data);
+   }
+
+   Pipeline pipe;
+   pipe.data = &data;
+   pipe.outputType = specs[numLayers-1].type;
+   pipe.lambda = params.lambda;
+   vector<long> costs;
+   for (int l = 0; l < numLayers; l++)
+   {
+      pipe.sizes.push_back(layerSize(specs[l]));
+      if (l > 0)
+      {
+         costs.push_back((long) pipe.sizes[l-1]*pipe.sizes[l]);
+      }
+   }
+
+   /*
+    * Splitting the layers and copying each stage's weights out of the network
+    */
+   int numStages = max(1, min(pipelineStages, numLayers - 1));
+   int groupSize = max(pipelineGroup, 1);
+   int batchSize = max(microBatch, 1);
+   microBatch = batchSize;
+   vector<int> firsts = partition(costs, numStages);
+   vector<double> parameters(n.numParameters());
+   n.getParameters(parameters.data());
+
+   long trackedBytes[NUM_MEMORY_CATEGORIES] = {0};
+   pipe.stages = vector<Stage>(numStages);
+   long offset = 0;
+   for (int s = 0; s < numStages; s++)
+   {
+      Stage& stage = pipe.stages[s];
+      stage.first = firsts[s];
+      stage.last = firsts[s+1];
+      stage.activations.resize(groupSize);
+      stage.thetas.resize(groupSize);
+      stage.omegas.resize(groupSize);
+      for (int l = stage.first; l < stage.last; l++)
+      {
+         long count = costs[l];
+         stage.weights.push_back(vector<double>(parameters.begin() + offset, parameters.begin() + offset + count));
+         stage.gradients.push_back(vector<double>(count, 0.0));
+         offset += count;
+         trackedBytes[MEM_WEIGHTS] += count*sizeof(double);
+         trackedBytes[MEM_GRADIENTS] += count*sizeof(double);
+      }
+      for (int slot = 0; slot < groupSize; slot++)
+      {
+         for (int l = stage.first + 1; l <= stage.last; l++)
+         {
+            stage.activations[slot].push_back(vector<double>((long) batchSize*pipe.sizes[l]));
+            stage.thetas[slot].push_back(vector<double>((long) batchSize*pipe.sizes[l]));
+            trackedBytes[MEM_ACTIVATIONS] += 2L*batchSize*pipe.sizes[l]*sizeof(double);
+         }
+         if (s > 0)
+         {
+            stage.omegas[slot].resize((long) batchSize*pipe.sizes[stage.first]);
+            trackedBytes[MEM_ACTIVATIONS] += (long) batchSize*pipe.sizes[stage.first]*sizeof(double);
+         }
+      }
+   }
+   pipe.inputs.assign(groupSize, vector<double>((long) batchSize*pipe.sizes.front()));
+   pipe.truths.assign(groupSize, vector<double>((long) batchSize*pipe.sizes.back()));
+   pipe.slotSamples.assign(groupSize, 0);
+   trackedBytes[MEM_DATASET] += (long) groupSize*batchSize*(pipe.sizes.front() + pipe.sizes.back())*sizeof(double);
+   for (int c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+   {
+      trackAlloc(c, trackedBytes[c]);
+   }
+
+   cout << "Pipeline training on " << numStages << " stages (weights layers";
+   for (int s = 0; s < numStages; s++)
+   {
+      cout << (s > 0 ? " |" : "") << " " << firsts[s] << "-" << firsts[s+1] - 1;
+   }
+   cout << "), micro-batches of " << batchSize << ", " << groupSize << " per update" << endl;
+
+   /*
+    * Gathers the stages' weights into the network's layout
+    */
+   auto collect = [&]()
+   {
+      long position = 0;
+      for (int s = 0; s < numStages; s++)
+      {
+         for (int l = 0; l < pipe.stages[s].weights.size(); l++)
+         {
+            copy(pipe.stages[s].weights[l].begin(), pipe.stages[s].weights[l].end(), parameters.begin() + position);
+            position += pipe.stages[s].weights[l].size();
+         }
+      }
+   };
+
+   /*
+    * The epochs - every stage runs on its own thread until the training sets run out
+    */
+   bool errorReachedThreshold = false;
+   bool stopped = false;
+   double error = INFINITY;
+   Metrics metrics;
+   TrainingBudget budget;
+   BestWeights best;
+   for (int i = 0; i < params.maxIter && !errorReachedThreshold; i++)
+   {
+      if (!budget.allowsEpoch())
+      {
+         stopped = true;
+         break;
+      }
+      TraceScope epochScope("epoch", i);
+      metrics.startEpoch();
+      metrics.start();
+
+      data.startEpoch(i);
+      pipe.groupsReady = 0;
+      pipe.numSamples = 0;
+      for (int s = 0; s < numStages; s++)
+      {
+         pipe.stages[s].forwardDone = 0;
+         pipe.stages[s].backwardDone = 0;
+         pipe.stages[s].error = 0.0;
+      }
+      parallelFor(numStages, numStages, [&](int s)
+      {
+         runStage(pipe, s);
+      });
+
+      for (long k = 0; k < pipe.numSamples; k++)
+      {
+         metrics.countSample();
+      }
+      error = pipe.stages.back().error/max(1L, pipe.numSamples);
+      errorReachedThreshold = error < params.minError;
+      budget.endEpoch();
+      if (best.improves(error))
+      {
+         collect();
+         best.keep(parameters, error, i);
+      }
+
+      metrics.stop(PHASE_UPDATE);
+      metrics.endEpoch(i, error, params.lambda, errorReachedThreshold || i == params.maxIter - 1);
+   }
+   metrics.summary();
+
+   /*
+    * Copying the trained weights back into the network (the best epoch's if the last was worse)
+    */
+   collect();
+   n.setParameters(parameters.data());
+   best.restore(n, error);
+   for (int c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+   {
+      trackFree(c, trackedBytes[c]);
+   }
+
+   return errorReachedThreshold ? 1 : (stopped ? 3 : 0);
+
+}  //int trainPipeline(...)
@@ -0,0 +1,44 @@
+/*
+ * Header file for the pipeline trainer - Contains declarations for training a network
+ * with its layers split into stages that run on different threads.
+ *
+ * Each stage owns a run of consecutive weights layers. The training sets go through in
+ * micro-batches: while one stage works on a micro-batch the stage after it works on the
+ * one before, so a deep network whose layers are each too small to split still keeps
+ * several cores busy. Each stage interleaves the forward and backward passes of the
+ * micro-batches one for one (1F1B), and the gradients of a group of micro-batches are
+ * added up and applied together once the whole group is through, so every micro-batch of
+ * a group sees the same weights.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/7/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "network.hpp"
+#include "dataset.hpp"
+
+using namespace std;
+
+/*
+ * Global variables storing the pipeline options (can be set in the config file)
+ */
+extern int pipelineStages;
+extern int microBatch;
+extern int pipelineGroup;
+
+/*
+ * Trains the network with its weights layers split into pipelineStages stages until its
+ * maxIter epochs are done or the error goes below its minError. Networks the pipeline can
+ * not train (convolution, pooling or linear layers, frozen layers) are trained with train().
+ * Returns 1 if the error went below minError, 0 otherwise.
+ */
+int trainPipeline(int numLayers, LayerSpec* specs, Network& n, Dataset& data);
+
+
+#endif /* PIPELINE_H */
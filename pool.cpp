@@ -0,0 +1,151 @@
+/*
+ * Implementation of the work pool. A job is published by bumping the generation under the
+ * lock (so a sleeping worker can not miss it), and run() returns only once every worker has
+ * reported back, so no worker can still be looking at the shares when the next job resets
+ * them.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/6/20
+ */
+
+
+#include "pool.hpp"
+
+using namespace std;
+
+/*
+ * Default latency mode options (can be overridden in the config file)
+ */
+int latencyThreads = 0;             //0 runs every layer on the calling thread
+long parallelMinWork = 50000;       //Multiply-adds below which a layer is run serially
+
+static const int SPIN_LIMIT = 20000;   //Yields before an idle worker goes to sleep
+
+
+/*
+ * Starts the workers of a pool of numThreads threads (counting the caller)
+ */
+WorkPool::WorkPool(int numThreads) : shares(numThreads < 1 ? 1 : numThreads)
+{
+   job = NULL;
+   generation = 0;
+   finished = 0;
+   stopping = false;
+   for (int t = 1; t < shares.size(); t++)
+   {
+      workers.push_back(thread(&WorkPool::workerLoop, this, t));
+   }
+}
+
+/*
+ * The number of threads that run a job (counting the caller)
+ */
+int WorkPool::size()
+{
+   return shares.size();
+}
+
+/*
+ * Runs chunkJob(0) to chunkJob(count-1) on the pool and returns when all are done
+ * @param count the number of chunks
+ * @param chunkJob the work of one chunk (called from several threads at once)
+ */
+void WorkPool::run(int count, const function<void(int)>& chunkJob)
+{
+   if (workers.empty() || count <= 1)
+   {
+      for (int c = 0; c < count; c++)
+      {
+         chunkJob(c);
+      }
+      return;
+   }
+
+   int numThreads = shares.size();
+   for (int t = 0; t < numThreads; t++)
+   {
+      shares[t].next.store((long) count*t/numThreads, memory_order_relaxed);
+      shares[t].end = (long) count*(t + 1)/numThreads;
+   }
+   job = &chunkJob;
+   finished.store(0, memory_order_relaxed);
+   {
+      lock_guard<mutex> guard(lock);
+      generation.fetch_add(1, memory_order_release);
+   }
+   wake.notify_all();
+
+   work(0);
+   while (finished.load(memory_order_acquire) < workers.size())
+   {
+      this_thread::yield();
+   }
+   return;
+
+}  //void WorkPool::run(...)
+
+/*
+ * Runs the chunks of the current job - the thread's own share first, then whatever is
+ * left of the others' shares
+ */
+void WorkPool::work(int self)
+{
+   int numThreads = shares.size();
+   for (int k = 0; k < numThreads; k++)
+   {
+      Share& share = shares[(self + k) % numThreads];
+      int c;
+      while ((c = share.next.fetch_add(1, memory_order_relaxed)) < share.end)
+      {
+         (*job)(c);
+      }
+   }
+   return;
+}
+
+/*
+ * A worker waits for each job (spinning at first, then asleep), works on it and reports back
+ */
+void WorkPool::workerLoop(int self)
+{
+   int seen = 0;
+   while (true)
+   {
+      int spins = 0;
+      while (generation.load(memory_order_acquire) == seen)
+      {
+         if (++spins < SPIN_LIMIT)
+         {
+            this_thread::yield();
+            continue;
+         }
+         unique_lock<mutex> guard(lock);
+         wake.wait(guard, [&]() { return generation.load(memory_order_relaxed) != seen || stopping; });
+         if (stopping)
+         {
+            return;
+         }
+      }
+      seen++;                       //run() waits for every worker, so no job is skipped
+
+      work(self);
+      finished.fetch_add(1, memory_order_release);
+   }
+
+}  //void WorkPool::workerLoop(int self)
+
+/*
+ * Wakes the workers up to stop and waits for them
+ */
+WorkPool::~WorkPool()
+{
+   {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (int t = 0; t < workers.size(); t++)
+   {
+      workers[t].join();
+   }
+}
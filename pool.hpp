@@ -0,0 +1,80 @@
+/*
+ * Header file for the work pool - Contains the declarations for splitting the work of
+ * one forward pass across threads (the latency mode of test runs).
+ *
+ * parallelFor starts new threads each time it is called, which is fine for jobs that run
+ * for seconds but costs more than a whole layer of a single-image forward pass. A WorkPool
+ * keeps its threads alive between calls: they spin for a short while after a job so the
+ * next layer starts right away, and only then go to sleep. Every thread is handed an equal
+ * share of the chunks of a job and steals chunks from the others once its own are done, so
+ * one slow or descheduled thread does not hold the whole layer up.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/6/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Bytes in a cache line - per-thread data is padded to this so threads never write to
+ * the same line
+ */
+static const int CACHE_LINE = 64;
+
+/*
+ * Global variables storing the latency mode options (can be set in the config file)
+ */
+extern int latencyThreads;
+extern long parallelMinWork;
+
+/*
+ * A pool of threads that run the chunks of one job at a time. The thread that calls
+ * run() works on the job too, so a pool of numThreads threads starts numThreads - 1.
+ */
+class WorkPool
+{
+   /*
+    * The chunks a thread has left - its own share, which other threads steal from
+    */
+   struct alignas(CACHE_LINE) Share
+   {
+      atomic<int> next;
+      int end;
+   };
+
+   vector<thread> workers;
+   vector<Share> shares;                   //One per thread, the caller's first
+   const function<void(int)>* job;
+   atomic<int> generation;                 //Counts the jobs handed out
+   atomic<int> finished;                   //Workers done with the current job
+   bool stopping;
+   mutex lock;
+   condition_variable wake;
+
+   private:
+      void workerLoop(int self);
+      void work(int self);
+
+   public:
+      WorkPool(int numThreads);
+      int size();
+      void run(int count, const function<void(int)>& chunkJob);
+      ~WorkPool();
+
+}; //WorkPool class declarations
+
+
+#endif /* POOL_H */
@@ -0,0 +1,538 @@
+/*
+ * Implementation of the input projection. PCA finds the eigenvectors of the covariance of
+ * the centered training inputs with Householder tridiagonalization followed by the QL
+ * algorithm with implicit shifts (the EISPACK tred2/tql2 routines). With fewer training
+ * sets than inputs the covariance has rank below the number of sets, so the much smaller
+ * matrix of dot products between the sets (the Gram matrix) is diagonalized instead and
+ * its eigenvectors are mapped back onto the inputs.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/8/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <math.h>
+
+#include "projection.hpp"
+#include "random.hpp"
+
+using namespace std;
+
+/*
+ * Default projection options (can be overridden in the config file)
+ */
+int projectDims = 0;                   //0 feeds the inputs to the first layer as they are
+int projectMethod = PROJECT_PCA;
+
+static const double RANK_TOLERANCE = 1e-9;   //Eigenvalues below this times the largest are dropped
+
+
+/*
+ * Reduces the symmetric matrix in v to tridiagonal form by Householder reflections.
+ * On return diagonal and offDiagonal hold the tridiagonal matrix and v the orthogonal
+ * transformation that produced it.
+ */
+static void tridiagonalize(vector<vector<double> >& v, vector<double>& diagonal, vector<double>& offDiagonal)
+{
+   int n = v.size();
+   vector<double>& d = diagonal;
+   vector<double>& e = offDiagonal;
+   for (int j = 0; j < n; j++)
+   {
+      d[j] = v[n - 1][j];
+   }
+
+   for (int i = n - 1; i > 0; i--)
+   {
+      double scale = 0.0;
+      double h = 0.0;
+      for (int k = 0; k < i; k++)
+      {
+         scale += fabs(d[k]);
+      }
+      if (scale == 0.0)
+      {
+         e[i] = d[i - 1];
+         for (int j = 0; j < i; j++)
+         {
+            d[j] = v[i - 1][j];
+            v[i][j] = 0.0;
+            v[j][i] = 0.0;
+         }
+      }
+      else
+      {
+         /*
+          * The Householder vector of row i
+          */
+         for (int k = 0; k < i; k++)
+         {
+            d[k] /= scale;
+            h += d[k]*d[k];
+         }
+         double f = d[i - 1];
+         double g = f > 0 ? -sqrt(h) : sqrt(h);
+         e[i] = scale*g;
+         h -= f*g;
+         d[i - 1] = f - g;
+         for (int j = 0; j < i; j++)
+         {
+            e[j] = 0.0;
+         }
+
+         /*
+          * Applying the similarity transformation to the rest of the matrix
+          */
+         for (int j = 0; j < i; j++)
+         {
+            f = d[j];
+            v[j][i] = f;
+            g = e[j] + v[j][j]*f;
+            for (int k = j + 1; k <= i - 1; k++)
+            {
+               g += v[k][j]*d[k];
+               e[k] += v[k][j]*f;
+            }
+            e[j] = g;
+         }
+         f = 0.0;
+         for (int j = 0; j < i; j++)
+         {
+            e[j] /= h;
+            f += e[j]*d[j];
+         }
+         double hh = f/(h + h);
+         for (int j = 0; j < i; j++)
+         {
+            e[j] -= hh*d[j];
+         }
+         for (int j = 0; j < i; j++)
+         {
+            f = d[j];
+            g = e[j];
+            for (int k = j; k <= i - 1; k++)
+            {
+               v[k][j] -= (f*e[k] + g*d[k]);
+            }
+            d[j] = v[i - 1][j];
+            v[i][j] = 0.0;
+         }
+      }
+      d[i] = h;
+   }  //for (int i = n - 1; i > 0; i--)
+
+   /*
+    * Accumulating the transformations
+    */
+   for (int i = 0; i < n - 1; i++)
+   {
+      v[n - 1][i] = v[i][i];
+      v[i][i] = 1.0;
+      double h = d[i + 1];
+      if (h != 0.0)
+      {
+         for (int k = 0; k <= i; k++)
+         {
+            d[k] = v[k][i + 1]/h;
+         }
+         for (int j = 0; j <= i; j++)
+         {
+            double g = 0.0;
+            for (int k = 0; k <= i; k++)
+            {
+               g += v[k][i + 1]*v[k][j];
+            }
+            for (int k = 0; k <= i; k++)
+            {
+               v[k][j] -= g*d[k];
+            }
+         }
+      }
+      for (int k = 0; k <= i; k++)
+      {
+         v[k][i + 1] = 0.0;
+      }
+   }
+   for (int j = 0; j < n; j++)
+   {
+      d[j] = v[n - 1][j];
+      v[n - 1][j] = 0.0;
+   }
+   v[n - 1][n - 1] = 1.0;
+   e[0] = 0.0;
+   return;
+
+}  //static void tridiagonalize(...)
+
+/*
+ * Diagonalizes the tridiagonal matrix from tridiagonalize() with the QL algorithm.
+ * On return diagonal holds the eigenvalues (in no particular order) and column i of v
+ * the eigenvector of eigenvalue i.
+ */
+static void diagonalize(vector<vector<double> >& v, vector<double>& diagonal, vector<double>& offDiagonal)
+{
+   int n = v.size();
+   vector<double>& d = diagonal;
+   vector<double>& e = offDiagonal;
+   for (int i = 1; i < n; i++)
+   {
+      e[i - 1] = e[i];
+   }
+   e[n - 1] = 0.0;
+
+   double f = 0.0;
+   double largest = 0.0;
+   double epsilon = pow(2.0, -52.0);
+   for (int l = 0; l < n; l++)
+   {
+      /*
+       * Finding the first negligible off-diagonal element from l on
+       */
+      largest = max(largest, fabs(d[l]) + fabs(e[l]));
+      int m = l;
+      while (m < n - 1 && fabs(e[m]) > epsilon*largest)
+      {
+         m++;
+      }
+
+      /*
+       * Iterating until d[l] is an eigenvalue
+       */
+      if (m > l)
+      {
+         do
+         {
+            double g = d[l];
+            double p = (d[l + 1] - g)/(2.0*e[l]);
+            double r = hypot(p, 1.0);
+            if (p < 0)
+            {
+               r = -r;
+            }
+            d[l] = e[l]/(p + r);
+            d[l + 1] = e[l]*(p + r);
+            double dl1 = d[l + 1];
+            double h = g - d[l];
+            for (int i = l + 2; i < n; i++)
+            {
+               d[i] -= h;
+            }
+            f += h;
+
+            /*
+             * Implicit QL transformation
+             */
+            p = d[m];
+            double c = 1.0;
+            double c2 = c;
+            double c3 = c;
+            double el1 = e[l + 1];
+            double s = 0.0;
+            double s2 = 0.0;
+            for (int i = m - 1; i >= l; i--)
+            {
+               c3 = c2;
+               c2 = c;
+               s2 = s;
+               g = c*e[i];
+               h = c*p;
+               r = hypot(p, e[i]);
+               e[i + 1] = s*r;
+               s = e[i]/r;
+               c = p/r;
+               p = c*d[i] - s*g;
+               d[i + 1] = h + s*(c*g + s*d[i]);
+               for (int k = 0; k < n; k++)
+               {
+                  h = v[k][i + 1];
+                  v[k][i + 1] = s*v[k][i] + c*h;
+                  v[k][i] = c*v[k][i] - s*h;
+               }
+            }
+            p = -s*s2*c3*el1*e[l]/dl1;
+            e[l] = s*p;
+            d[l] = c*p;
+
+         } while (fabs(e[l]) > epsilon*largest);
+      }
+      d[l] += f;
+      e[l] = 0.0;
+
+   }  //for (int l = 0; l < n; l++)
+   return;
+
+}  //static void diagonalize(...)
+
+
+/*
+ * Finds the eigenvalues and eigenvectors of a symmetric matrix
+ * @param matrix the matrix - replaced by the eigenvectors, one per column
+ * @param eigenvalues filled in with the eigenvalues, largest first (the order of the columns)
+ */
+void symmetricEigen(vector<vector<double> >& matrix, vector<double>& eigenvalues)
+{
+   int size = matrix.size();
+   vector<double> values(size);
+   vector<double> offDiagonal(size);
+   tridiagonalize(matrix, values, offDiagonal);
+   diagonalize(matrix, values, offDiagonal);
+
+   vector<int> order(size);
+   for (int i = 0; i < size; i++)
+   {
+      order[i] = i;
+   }
+   sort(order.begin(), order.end(), [&](int a, int b) { return values[a] > values[b]; });
+   eigenvalues.resize(size);
+   for (int r = 0; r < size; r++)
+   {
+      vector<double> row = matrix[r];
+      for (int c = 0; c < size; c++)
+      {
+         matrix[r][c] = row[order[c]];
+      }
+   }
+   for (int c = 0; c < size; c++)
+   {
+      eigenvalues[c] = values[order[c]];
+   }
+   return;
+
+}  //void symmetricEigen(...)
+
+
+Projection::Projection()
+{
+   numInputs = 0;
+   numDims = 0;
+}
+
+int Projection::inputs()
+{
+   return numInputs;
+}
+
+int Projection::dims()
+{
+   return numDims;
+}
+
+/*
+ * Fits PCA to the training inputs - the directions are the eigenvectors of the largest
+ * eigenvalues of their covariance
+ * @param sets the input activations of each training set
+ * @param numSets the number of training sets
+ * @param numIn the number of input activations per set
+ * @param maxDims the number of directions wanted
+ * @return the number of directions kept - fewer than maxDims if the inputs span fewer
+ * (at most numSets - 1 directions, since the inputs are centered)
+ */
+int Projection::fitPca(double** sets, long numSets, int numIn, int maxDims)
+{
+   numInputs = numIn;
+   mean.assign(numIn, 0.0);
+   for (long s = 0; s < numSets; s++)
+   {
+      for (int i = 0; i < numIn; i++)
+      {
+         mean[i] += sets[s][i]/numSets;
+      }
+   }
+   vector<vector<double> > centered(numSets, vector<double>(numIn));
+   for (long s = 0; s < numSets; s++)
+   {
+      for (int i = 0; i < numIn; i++)
+      {
+         centered[s][i] = sets[s][i] - mean[i];
+      }
+   }
+
+   /*
+    * The covariance (inputs x inputs) or, with fewer sets than inputs, the Gram matrix
+    * (sets x sets) - both have the same nonzero eigenvalues
+    */
+   bool gram = numSets < numIn;
+   int size = gram ? numSets : numIn;
+   vector<vector<double> > v(size, vector<double>(size, 0.0));
+   if (gram)
+   {
+      for (int a = 0; a < size; a++)
+      {
+         for (int b = 0; b <= a; b++)
+         {
+            double dot = 0.0;
+            for (int i = 0; i < numIn; i++)
+            {
+               dot += centered[a][i]*centered[b][i];
+            }
+            v[a][b] = dot;
+            v[b][a] = dot;
+         }
+      }
+   }
+   else
+   {
+      for (long s = 0; s < numSets; s++)
+      {
+         for (int a = 0; a < size; a++)
+         {
+            double x = centered[s][a];
+            for (int b = 0; b <= a; b++)
+            {
+               v[a][b] += x*centered[s][b];
+            }
+         }
+      }
+      for (int a = 0; a < size; a++)
+      {
+         for (int b = 0; b < a; b++)
+         {
+            v[b][a] = v[a][b];
+         }
+      }
+   }
+   vector<double> eigenvalues;
+   symmetricEigen(v, eigenvalues);
+
+   /*
+    * Keeping the directions of the largest eigenvalues (a Gram eigenvector u maps back to
+    * the unit direction X^T u / sqrt(eigenvalue))
+    */
+   numDims = 0;
+   basis.clear();
+   for (int c = 0; c < min(maxDims, size); c++)
+   {
+      double eigenvalue = eigenvalues[c];
+      if (eigenvalue <= RANK_TOLERANCE*eigenvalues[0])
+      {
+         break;
+      }
+      vector<double> direction(numIn, 0.0);
+      for (int i = 0; i < numIn; i++)
+      {
+         if (gram)
+         {
+            for (long s = 0; s < numSets; s++)
+            {
+               direction[i] += v[s][c]*centered[s][i];
+            }
+            direction[i] /= sqrt(eigenvalue);
+         }
+         else
+         {
+            direction[i] = v[i][c];
+         }
+      }
+      basis.insert(basis.end(), direction.begin(), direction.end());
+      numDims++;
+   }
+   return numDims;
+
+}  //int Projection::fitPca(...)
+
+/*
+ * Makes a random projection - every direction has independent gaussian entries scaled
+ * so projecting keeps the length of an input on average (nothing is centered)
+ * @param numIn the number of input activations per set
+ * @param dimsWanted the number of directions
+ */
+void Projection::fitRandom(int numIn, int dimsWanted)
+{
+   numInputs = numIn;
+   numDims = dimsWanted;
+   mean.assign(numIn, 0.0);
+   basis.resize((long) numDims*numInputs);
+   for (int r = 0; r < numDims; r++)
+   {
+      Philox generator(runSeed(), RNG_PROJECTION, r);
+      for (int i = 0; i < numInputs; i++)
+      {
+         basis[(long) r*numInputs + i] = generator.normal()/sqrt((double) numDims);
+      }
+   }
+   return;
+}
+
+/*
+ * Projects one set of input activations
+ * @param input numInputs input activations
+ * @param output filled in with the numDims projected activations
+ */
+void Projection::apply(const double* input, double* output)
+{
+   for (int r = 0; r < numDims; r++)
+   {
+      const double* direction = &basis[(long) r*numInputs];
+      double sum = 0.0;
+      for (int i = 0; i < numInputs; i++)
+      {
+         sum += direction[i]*(input[i] - mean[i]);
+      }
+      output[r] = sum;
+   }
+   return;
+}
+
+/*
+ * Saves the projection as text - the number of directions and of inputs, the mean and
+ * then one direction per line (at full precision, so the inputs are projected exactly as
+ * they were while training)
+ */
+bool Projection::save(string fileName)
+{
+   ofstream fout(fileName);
+   fout << setprecision(17);
+   fout << numDims << " " << numInputs << endl;
+   for (int i = 0; i < numInputs; i++)
+   {
+      fout << mean[i] << " ";
+   }
+   fout << endl;
+   for (int r = 0; r < numDims; r++)
+   {
+      for (int i = 0; i < numInputs; i++)
+      {
+         fout << basis[(long) r*numInputs + i] << " ";
+      }
+      fout << endl;
+   }
+   fout.close();
+   return !fout.fail();
+}
+
+/*
+ * Loads a projection written by save()
+ * @return false if the file does not exist or is cut short
+ */
+bool Projection::load(string fileName)
+{
+   ifstream fin(fileName);
+   int dimsRead = 0;
+   int inputsRead = 0;
+   if (!(fin >> dimsRead >> inputsRead) || dimsRead <= 0 || inputsRead <= 0)
+   {
+      return false;
+   }
+   mean.resize(inputsRead);
+   basis.resize((long) dimsRead*inputsRead);
+   for (int i = 0; i < inputsRead; i++)
+   {
+      fin >> mean[i];
+   }
+   for (long w = 0; w < basis.size(); w++)
+   {
+      fin >> basis[w];
+   }
+   if (!fin)
+   {
+      return false;
+   }
+   numDims = dimsRead;
+   numInputs = inputsRead;
+   return true;
+
+}  //bool Projection::load(string fileName)
@@ -0,0 +1,69 @@
+/*
+ * Header file for the input projection - Contains declarations for compressing the
+ * input activations down to a few dimensions before the first layer.
+ *
+ * The 25x25 images are highly redundant, and the first weights layer (inputs x first
+ * hidden layer) is the largest one of the network, so projecting every input onto k
+ * directions shrinks its work by the same factor. The directions are either the top k
+ * principal components of the training inputs (PCA) or k random gaussian directions
+ * (random projection, which keeps distances between inputs about the same and needs no
+ * fitting). The projection is saved next to the weights so a network trained on projected
+ * inputs is always run on them.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/8/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Global variables storing the projection options (can be set in the config file)
+ */
+extern int projectDims;
+extern int projectMethod;
+
+/*
+ * The ways of choosing the directions to project onto
+ */
+enum ProjectMethod {PROJECT_PCA, PROJECT_RANDOM};
+
+/*
+ * Finds the eigenvalues (largest first) and eigenvectors (the columns of the matrix on
+ * return) of a symmetric matrix - also used to take the SVD of a weights layer
+ */
+void symmetricEigen(vector<vector<double> >& matrix, vector<double>& eigenvalues);
+
+/*
+ * A linear projection y = B(x - mean) of numInputs input activations onto numDims
+ * orthonormal (PCA) or random (random projection) directions, the rows of B
+ */
+class Projection
+{
+   int numInputs;
+   int numDims;
+   vector<double> mean;
+   vector<double> basis;      //numDims rows of numInputs values
+
+   public:
+      Projection();
+      int inputs();
+      int dims();
+      int fitPca(double** sets, long numSets, int numIn, int maxDims);
+      void fitRandom(int numIn, int numDims);
+      void apply(const double* input, double* output);
+      bool save(string fileName);
+      bool load(string fileName);
+
+};    //class Projection
+
+
+#endif /* PROJECTION_H */
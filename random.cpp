@@ -0,0 +1,130 @@
+/*
+ * Implementation of the Philox4x32-10 generator (Salmon et al., "Parallel random
+ * numbers: as easy as 1, 2, 3") - ten rounds of two 32x32->64 bit multiplies with the
+ * halves swapped and mixed with the key, which is bumped by a Weyl sequence every round.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/2/20
+ */
+
+
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <math.h>
+
+#include "random.hpp"
+
+using namespace std;
+
+/*
+ * Default seed (from the clock - can be overridden in the config file)
+ */
+unsigned long randomSeed = 0;
+
+static const uint32_t PHILOX_M0 = 0xD2511F53;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9;
+static const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+/*
+ * Picks the seed from the clock the first time it is needed if none was given
+ */
+unsigned long runSeed()
+{
+   static once_flag chosen;
+   call_once(chosen, []()
+   {
+      if (randomSeed == 0)
+      {
+         randomSeed = chrono::system_clock::now().time_since_epoch().count() & 0xffffffffUL;
+         cout << "Random seed: " << randomSeed << " (set seed in the config file to repeat this run)" << endl;
+      }
+   });
+   return randomSeed;
+}
+
+/*
+ * Starts the stream (purpose, a, b) of the given seed at its first number
+ */
+Philox::Philox(unsigned long seedValue, uint32_t purpose, uint32_t a, uint32_t b)
+{
+   key[0] = (uint32_t) seedValue;
+   key[1] = (uint32_t) (seedValue >> 32);
+   counter[0] = 0;
+   counter[1] = purpose;
+   counter[2] = a;
+   counter[3] = b;
+   used = 4;
+}
+
+/*
+ * Computes the block of four numbers for the current counter and advances the counter
+ */
+void Philox::nextBlock()
+{
+   uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+   uint32_t k0 = key[0];
+   uint32_t k1 = key[1];
+
+   for (int round = 0; round < 10; round++)
+   {
+      uint64_t product0 = (uint64_t) PHILOX_M0*c[0];
+      uint64_t product1 = (uint64_t) PHILOX_M1*c[2];
+      uint32_t next[4] = {(uint32_t) (product1 >> 32) ^ c[1] ^ k0, (uint32_t) product1,
+                          (uint32_t) (product0 >> 32) ^ c[3] ^ k1, (uint32_t) product0};
+      c[0] = next[0];
+      c[1] = next[1];
+      c[2] = next[2];
+      c[3] = next[3];
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+   }
+
+   for (int i = 0; i < 4; i++)
+   {
+      block[i] = c[i];
+   }
+   counter[0]++;
+   used = 0;
+   return;
+}
+
+/*
+ * Returns the next 32 random bits of the stream
+ */
+Philox::result_type Philox::operator()()
+{
+   if (used == 4)
+   {
+      nextBlock();
+   }
+   return block[used++];
+}
+
+/*
+ * Returns a uniform double in [0, 1) (53 random bits)
+ */
+double Philox::uniform()
+{
+   uint64_t high = (*this)();
+   uint64_t low = (*this)();
+   return ((high << 32 | low) >> 11)*(1.0/9007199254740992.0);
+}
+
+/*
+ * Returns a uniform double in [low, high)
+ */
+double Philox::uniform(double low, double high)
+{
+   return low + uniform()*(high - low);
+}
+
+/*
+ * Returns a standard normal double (Box-Muller)
+ */
+double Philox::normal()
+{
+   double radius = sqrt(-2.0*log(1.0 - uniform()));      //1 - uniform() is never 0
+   return radius*cos(2.0*M_PI*uniform());
+}
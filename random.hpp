@@ -0,0 +1,78 @@
+/*
+ * Header file for the random number generator - Contains the declaration of a
+ * counter-based generator (Philox4x32-10) used for weight initialization, shuffling
+ * and augmentation.
+ *
+ * A counter-based generator computes its n-th number directly from (key, counter), so
+ * every user gets its own independent stream just by putting its purpose and position
+ * (layer, epoch, copy number...) into the counter. Streams never have to be shared
+ * between threads or drawn in a particular order, and everything is reproducible from
+ * the one seed in the config file.
+ *
+ * @author Kailash Ranganathan
+ * @version 5/2/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+/*
+ * The seed of the run (can be set in the config file - 0 picks one from the clock,
+ * which is printed so the run can be repeated)
+ */
+extern unsigned long randomSeed;
+
+/*
+ * Returns the seed of the run, choosing it on first use if it is 0
+ */
+unsigned long runSeed();
+
+/*
+ * What a stream of random numbers is used for (keeps the streams of different
+ * users apart even when the rest of their counters are equal)
+ */
+enum RandomPurpose {RNG_WEIGHTS = 1, RNG_SHUFFLE, RNG_AUGMENT, RNG_GENERAL, RNG_REPLAY, RNG_SCHEDULE,
+                    RNG_PROJECTION};
+
+/*
+ * Philox4x32-10 - the key is the seed and the 128 bit counter is (block number, purpose,
+ * a, b), so every (purpose, a, b) is a separate stream of 2^34 numbers.
+ * Meets the requirements of a uniform random bit generator, so it works with
+ * std::shuffle and the <random> distributions.
+ */
+class Philox
+{
+   uint32_t key[2];
+   uint32_t counter[4];
+   uint32_t block[4];
+   int used;                     //Numbers of the current block already handed out
+
+   private:
+      void nextBlock();
+
+   public:
+      typedef uint32_t result_type;
+      static constexpr result_type min()
+      {
+         return 0;
+      }
+      static constexpr result_type max()
+      {
+         return 0xffffffff;
+      }
+
+      Philox(unsigned long seedValue, uint32_t purpose, uint32_t a = 0, uint32_t b = 0);
+      result_type operator()();
+      double uniform();
+      double uniform(double low, double high);
+      double normal();
+
+};    //class Philox
+
+
+#endif /* RANDOM_H */
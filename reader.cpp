@@ -11,9 +11,11 @@
  * Reader important values such as number of training sets, a weights existence flag, and
  * the number of layers in the network as well as the shape of the network layers, 
  * void readTrainingData(ifstream& fileIn) reads in training data given the number of 
- * training sets and input activations per set, void readWeights(ifstream& fileIn)
- * populates a weights array if the user has predefined values, void exportWeights(weights)
- * stores the given weights in an output
+ * training sets and input activations per set, void readWeights()
+ * populates a weights array if the user has predefined values, void setUpProjection()
+ * decides whether the inputs are projected before the first layer (see projection.hpp,
+ * the projection of read weights is weightsFile.proj),
+ * void exportWeights(weights) stores the given weights in an output
  * 
  * @author Kailash Ranganathan
  * @version 3/21/20
@@ -23,8 +25,13 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <algorithm>
 
 #include "reader.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
+#include "lbfgs.hpp"
+#include "binary.hpp"
 
 using namespace std; 
 
@@ -39,6 +46,52 @@ extern double randomWeightMin;
 extern double randomWeightMax;
 extern double minError;
 extern string outputFile; 
+extern int streamData;
+extern int chunkSize;
+extern int shuffleData;
+extern int freezeLayers;
+extern string cacheFile;
+extern int scheduleSamples;
+extern double easyRate;
+extern int fullErrorInterval;
+extern int augment;
+extern int augmentCopies;
+extern int augmentThreads;
+extern int augmentQueue;
+extern int augmentSeed;
+extern double maxShift;
+extern double maxRotate;
+extern double maxScale;
+extern double maxBrightness;
+extern int logInterval;
+extern double logSeconds;
+extern string metricsFile;
+extern int verbose;
+extern double peakGflops;
+extern double peakBandwidth;
+extern int bf16Storage;
+extern int sweepThreads;
+extern unsigned long randomSeed;
+extern int weightInit;
+extern int optimizer;
+extern int lbfgsHistory;
+extern int lbfgsThreads;
+extern int onlineSteps;
+extern int replaySize;
+extern int replaySamples;
+extern int publishInterval;
+extern int latencyThreads;
+extern long parallelMinWork;
+extern int pipelineStages;
+extern int microBatch;
+extern int pipelineGroup;
+extern int projectDims;
+extern int projectMethod;
+extern double timeBudget;
+extern double budgetReserve;
+extern int binarizeInputs;
+extern double binaryThreshold;
+extern int binaryWeights;
 
 
 /*
@@ -71,8 +124,22 @@ void readConfigFile(string config)
       
       /*
        * Parsing of the configuration files. The valid expressions
-       * are lambda, maxIter, minWeight, and maxWeight. Their values
-       * must be on the line following the hyperparameter name. 
+       * are lambda, maxIter, minWeight, maxWeight, and minError, as well as the 
+       * dataset options streamData, chunkSize, and shuffleData, the loss-aware scheduling
+       * options (scheduleSamples, easyRate, fullErrorInterval), the fine-tuning options
+       * freezeLayers and cacheFile and the augmentation
+       * options (augment, augmentCopies, augmentThreads, augmentQueue, augmentSeed,
+       * maxShift, maxRotate, maxScale, maxBrightness) and the logging options (logInterval,
+       * logSeconds, metricsFile, verbose) and the machine peaks for the performance counter
+       * report (peakGflops, peakBandwidth in GB/s), bf16Storage, sweepThreads, seed, init
+       * (uniform, xavier or he), optimizer (sgd or lbfgs), lbfgsHistory, lbfgsThreads and the
+       * online learning options (onlineSteps, replaySize, replaySamples, publishInterval) and
+       * the latency mode options (latencyThreads, parallelMinWork) and the pipeline options
+       * (pipelineStages, microBatch, pipelineGroup) and the input projection options
+       * (projectDims, projectMethod - pca or random) and the time budget options
+       * (timeBudget, budgetReserve - in seconds) and the binarized input options
+       * (binarizeInputs, binaryThreshold - on the 0-1 scale, binaryWeights).
+       * Their values must be on the line following the hyperparameter name. 
        */ 
       if (currentArg.find("lambda") != string::npos)
       {
@@ -96,6 +163,201 @@ void readConfigFile(string config)
         
          minError = val;
       }
+      else if (currentArg.find("streamData") != string::npos)
+      {
+         streamData = val;
+      }
+      else if (currentArg.find("chunkSize") != string::npos)
+      {
+         chunkSize = val;
+      }
+      else if (currentArg.find("shuffleData") != string::npos)
+      {
+         shuffleData = val;
+      }
+      else if (currentArg.find("scheduleSamples") != string::npos)
+      {
+         scheduleSamples = val;
+      }
+      else if (currentArg.find("easyRate") != string::npos)
+      {
+         easyRate = val;
+      }
+      else if (currentArg.find("fullErrorInterval") != string::npos)
+      {
+         fullErrorInterval = val;
+      }
+      else if (currentArg.find("freezeLayers") != string::npos)
+      {
+         freezeLayers = val;
+      }
+      else if (currentArg.find("cacheFile") != string::npos)
+      {
+         cacheFile = value;
+      }
+      else if (currentArg.find("augmentCopies") != string::npos)
+      {
+         augmentCopies = val;
+      }
+      else if (currentArg.find("augmentThreads") != string::npos)
+      {
+         augmentThreads = val;
+      }
+      else if (currentArg.find("augmentQueue") != string::npos)
+      {
+         augmentQueue = val;
+      }
+      else if (currentArg.find("augmentSeed") != string::npos)
+      {
+         augmentSeed = val;
+      }
+      else if (currentArg.find("augment") != string::npos)   //Checked after the longer augment options
+      {
+         augment = val;
+      }
+      else if (currentArg.find("maxShift") != string::npos)
+      {
+         maxShift = val;
+      }
+      else if (currentArg.find("maxRotate") != string::npos)
+      {
+         maxRotate = val;
+      }
+      else if (currentArg.find("maxScale") != string::npos)
+      {
+         maxScale = val;
+      }
+      else if (currentArg.find("maxBrightness") != string::npos)
+      {
+         maxBrightness = val;
+      }
+      else if (currentArg.find("logInterval") != string::npos)
+      {
+         logInterval = val;
+      }
+      else if (currentArg.find("logSeconds") != string::npos)
+      {
+         logSeconds = val;
+      }
+      else if (currentArg.find("metricsFile") != string::npos)
+      {
+         metricsFile = value;       //A name, not a number
+      }
+      else if (currentArg.find("verbose") != string::npos)
+      {
+         verbose = val;
+      }
+      else if (currentArg.find("peakGflops") != string::npos)
+      {
+         peakGflops = val;
+      }
+      else if (currentArg.find("peakBandwidth") != string::npos)
+      {
+         peakBandwidth = val;
+      }
+      else if (currentArg.find("bf16Storage") != string::npos)
+      {
+         bf16Storage = val;
+      }
+      else if (currentArg.find("sweepThreads") != string::npos)
+      {
+         sweepThreads = val;
+      }
+      else if (currentArg.find("seed") != string::npos)
+      {
+         randomSeed = strtoul(value.c_str(), NULL, 10);    //Too large for a double to hold exactly
+      }
+      else if (currentArg.find("init") != string::npos)
+      {
+         if (value.find("xavier") != string::npos)
+         {
+            weightInit = INIT_XAVIER;
+         }
+         else if (value.find("he") != string::npos)
+         {
+            weightInit = INIT_HE;
+         }
+         else
+         {
+            weightInit = INIT_UNIFORM;
+         }
+      }
+      else if (currentArg.find("optimizer") != string::npos)
+      {
+         optimizer = value.find("lbfgs") != string::npos ? OPT_LBFGS : OPT_SGD;
+      }
+      else if (currentArg.find("lbfgsHistory") != string::npos)
+      {
+         lbfgsHistory = val;
+      }
+      else if (currentArg.find("lbfgsThreads") != string::npos)
+      {
+         lbfgsThreads = val;
+      }
+      else if (currentArg.find("onlineSteps") != string::npos)
+      {
+         onlineSteps = val;
+      }
+      else if (currentArg.find("replaySize") != string::npos)
+      {
+         replaySize = val;
+      }
+      else if (currentArg.find("replaySamples") != string::npos)
+      {
+         replaySamples = val;
+      }
+      else if (currentArg.find("publishInterval") != string::npos)
+      {
+         publishInterval = val;
+      }
+      else if (currentArg.find("latencyThreads") != string::npos)
+      {
+         latencyThreads = val;
+      }
+      else if (currentArg.find("parallelMinWork") != string::npos)
+      {
+         parallelMinWork = val;
+      }
+      else if (currentArg.find("pipelineStages") != string::npos)
+      {
+         pipelineStages = val;
+      }
+      else if (currentArg.find("microBatch") != string::npos)
+      {
+         microBatch = val;
+      }
+      else if (currentArg.find("pipelineGroup") != string::npos)
+      {
+         pipelineGroup = val;
+      }
+      else if (currentArg.find("binarizeInputs") != string::npos)
+      {
+         binarizeInputs = val;
+      }
+      else if (currentArg.find("binaryThreshold") != string::npos)
+      {
+         binaryThreshold = val;
+      }
+      else if (currentArg.find("binaryWeights") != string::npos)
+      {
+         binaryWeights = val;
+      }
+      else if (currentArg.find("timeBudget") != string::npos)
+      {
+         timeBudget = val;
+      }
+      else if (currentArg.find("budgetReserve") != string::npos)
+      {
+         budgetReserve = val;
+      }
+      else if (currentArg.find("projectDims") != string::npos)
+      {
+         projectDims = val;
+      }
+      else if (currentArg.find("projectMethod") != string::npos)
+      {
+         projectMethod = value.find("random") != string::npos ? PROJECT_RANDOM : PROJECT_PCA;
+      }
       
       
    }
@@ -105,6 +367,36 @@ void readConfigFile(string config)
 }                      //readConfig(string filename) method
 
 
+/*
+ * Reads only the metadata and layer sizes at the top of an input file, without
+ * allocating anything for weights or training data. Used to size a run before it starts.
+ * @param fileName the name of the input file
+ * @param numTrain set to the number of training sets
+ * @param testOrTrain set to 1 for training and 0 for testing
+ * @param specs filled with the spec of each layer
+ */
+void readHeader(string fileName, int& numTrain, int& testOrTrain, vector<LayerSpec>& specs)
+{
+   ifstream fileIn(fileName);
+   int weightsFlag, numLayers; 
+   fileIn >> numTrain >> weightsFlag >> numLayers >> testOrTrain;
+
+   vector<string> tokens(numLayers);
+   for (int n = 0; n < numLayers; n++)
+   {
+      fileIn >> tokens[n];
+   }
+   fileIn.close();
+   if (!parseLayerSpecs(tokens, specs))
+   {
+      cout << "Invalid network structure in \"" << fileName << "\"" << endl;
+      exit(1);
+   }
+
+   return; 
+}
+
+
 /*
  * Constructor for the Reader class. Takes in a file name for the training data
  * and network parameters and configFile name (if it is empty, then just uses 
@@ -118,7 +410,11 @@ void readConfigFile(string config)
 Reader::Reader(string filename, string configFile, string testFile)
 {
    
+   TraceScope scope("Reader load");
    ifstream fileIn(filename);
+   inputs = NULL;             //Stay empty unless the training sets are read in up front
+   truths = NULL;
+   test = NULL;
 
    /*
     * If a valid filename is given for configurations/hyperparameters
@@ -139,13 +435,20 @@ Reader::Reader(string filename, string configFile, string testFile)
    if (hasWeights == 1)       //Read weights if the user has written them
    {
       
-      readWeights(fileIn);
+      readWeights();
       
       
    }
    if(testOrTrain == 1)
    {
-      readTrainingData(fileIn);
+      /*
+       * When streaming, the training sets are read from disk chunk by chunk
+       * during training instead of all at once here
+       */
+      if (streamData == 0)
+      {
+         readTrainingData(fileIn);
+      }
 
    }
    else
@@ -169,15 +472,31 @@ void Reader::readTestData(string testFileName)
    
    
    ifstream testFile(testFileName.c_str());
+   vector<double> raw(rawInputs);
    test = new double[numInputs];
-   for (int i = 0; i < numInputs; i++)
+   trackAlloc(MEM_DATASET, numInputs*sizeof(double));
+   for (int i = 0; i < rawInputs; i++)
    {
       double current;
       testFile >> current; 
-      test[i] = current/(255.0);
+      raw[i] = current/(255.0);
       
 
       
+   }
+   if (projected)
+   {
+      projection.apply(raw.data(), test);
+   }
+   else if (binarized)        //Thresholded like the training sets, as bits and as 0s and 1s
+   {
+      testBits.resize(bitWords(numInputs));
+      packBits(raw.data(), numInputs, binaryThreshold, testBits.data());
+      unpackBits(testBits.data(), numInputs, test);
+   }
+   else
+   {
+      copy(raw.begin(), raw.end(), test);
    }
    cout << "Evaluation of file " << "\"" <<  testFileName << "\"" << endl; 
    return; 
@@ -201,17 +520,43 @@ void Reader::readMetaData(ifstream& fileIn)
    layerSizes = new int[numLayers];                
    cout << endl << endl; 
    /*
-    * Reading in the layer sizes from the input file
+    * Reading in the layers from the input file - each is a size or a
+    * convolution/pooling token, whose size follows from the layer before it
     */
+   vector<string> tokens(numLayers);
+   for (int n = 0; n < numLayers; n++)
+   {
+      fileIn >> tokens[n];
+   }
+
+   /*
+    * The weights file is named on the line after the layers (finalweights if it is blank) -
+    * read here because its projection (weightsFile.proj) decides the input layer's size
+    */
+   if (hasWeights == 1)
+   {
+      string throwaway;
+      getline(fileIn, throwaway);
+      getline(fileIn, weightsFile);
+      weightsFile.erase(0, weightsFile.find_first_not_of(" \t\r"));
+      weightsFile.erase(weightsFile.find_last_not_of(" \t\r") + 1);
+      if (weightsFile.empty())
+      {
+         weightsFile = "finalweights";
+      }
+   }
+   if (!parseLayerSpecs(tokens, layerSpecs))
+   {
+      cout << "Invalid network structure" << endl;
+      exit(1);
+   }
+
    cout << "Network structure: "; 
    for (int n = 0; n < numLayers; n++)
    {
-      int currentLayerSize; 
-      fileIn >> currentLayerSize; 
+      layerSizes[n] = layerSize(layerSpecs[n]); 
       
-      layerSizes[n] = currentLayerSize; 
-      
-      cout << layerSizes[n] << " ";
+      cout << layerName(layerSpecs[n]) << " ";
 
    }
    cout << endl; 
@@ -221,28 +566,16 @@ void Reader::readMetaData(ifstream& fileIn)
     */
    numInputs = layerSizes[0];
    numOutputs = layerSizes[numLayers-1];
+   rawInputs = numInputs;
+   setUpProjection();         //May shrink the input layer
+   setUpBinarized();
 
    /*
-    * Allocating memory space for the weights array
-    * 
+    * Allocating memory space for the weights array ([source][destination] for
+    * fully connected layers, [filter][patch] for convolutions)
     */
-   weightsRead.resize(numLayers - 1);       
-
-   for (int n = 0; n < numLayers - 1; n++)      //Iterating over the number of layers
-   {
-      /*
-       * Allocating memory for the current weights layer
-       * Resizing the 2nd dimension to the source layer (current layer)
-       * and iterating over that to resize the 3rd dimension to the destination layer
-       *
-       */
-      weightsRead[n].resize(layerSizes[n]);
-      for (int j = 0; j < layerSizes[n]; j++)       //Iterating over the current source node
-      {
-         weightsRead[n][j].resize(layerSizes[n+1]); //Allocating memory for the current node's weights
-
-      }
-   }  //for (int n = 0; n < numLayers - 1; n++)
+   shapeWeights(weightsRead, numLayers, layerSpecs.data());
+   trackAlloc(MEM_WEIGHTS, weightsBytes(weightsRead));
 
    return; 
 
@@ -261,6 +594,12 @@ void Reader::readTrainingData(ifstream& fileIn)
   
    
    
+   TraceScope scope("read training data");
+   if (binarized)
+   {
+      readBinarizedData();
+      return;
+   }
    inputs = new double*[numTrain];
    truths = new double*[numTrain];
     
@@ -272,100 +611,167 @@ void Reader::readTrainingData(ifstream& fileIn)
    {
       
       truths[i] = new double[numOutputs];
-      inputs[i] = new double[numInputs];
+      inputs[i] = new double[rawInputs];
    }
+   trackAlloc(MEM_DATASET, (long) numTrain*(rawInputs + numOutputs)*sizeof(double));
 
-   double currentInput = 5.5;
-   double currentTruth = 5.5;
-   string currentImage =  "wacko";
-   string currentTruthPath = "truth"; 
    for (int i = 0; i < numTrain; ++i)         //Iterates over each training set to read it
    { 
-     
-      
-      currentImage = "train/train";
-      currentTruthPath =  "truth/truth"; 
-
-
-      currentImage += to_string(i);
-      currentTruthPath += to_string(i);
-      cout << currentImage << endl; 
-      cout << currentTruthPath << endl; 
-      
-      ifstream currentFile(currentImage);
-      ifstream currentTruthFile(currentTruthPath);
-      
-
-      
-      /*
-       * Reading in the current input values
-       * 
-       */
-      for (int j = 0; j < numInputs; j++)    //Reads in the appropriate number of inputs
-      {
-         currentFile >> currentInput; 
-        
-         inputs[i][j] = (1.0*currentInput)/(255.0);
-         
-      }
+      readSample(i, rawInputs, numOutputs, inputs[i], truths[i]);
 
       /*
-       * Reading in the current truth values
-       * 
+       * Echoing every file and truth value is slow for large datasets
+       * so it only happens in verbose mode
        */
-      for (int j = 0; j < numOutputs; j++)   //Reads in the appropriate number of outputs(truth values)
+      if (verbose)
       {
-         currentTruthFile >> currentTruth; 
-         cout << currentTruth << endl; 
-         truths[i][j] = currentTruth;
+         cout << "train/train" << i << "\n"; 
+         cout << "truth/truth" << i << "\n"; 
+         for (int j = 0; j < numOutputs; j++)   //Echoing the truth values that were read
+         {
+            cout << truths[i][j] << "\n"; 
+         }
       }
-     
-      currentInput = 0.0; 
-      currentTruth = 0.0; 
-      currentFile.close();
-      currentTruthFile.close();
-      
-
-
-      
-
 
    } // for (int i = 0; i < numTrain; i++)
 
    
    //cout << numOutputs; 
    
+   if (projected)
+   {
+      projectTrainingData();
+   }
 
    return; 
 
 }    // void Reader::readTrainingData(ifstream& fileIn)
 
+/*
+ * Reads the training sets keeping only their input bits (one word per 64 inputs instead
+ * of 64 doubles) and the truth values
+ */
+void Reader::readBinarizedData()
+{
+   int numWords = bitWords(numInputs);
+   truths = new double*[numTrain];
+   packedInputs.assign((long) numTrain*numWords, 0);
+   trackAlloc(MEM_DATASET, (long) numTrain*(numWords*sizeof(uint64_t) + numOutputs*sizeof(double)));
+
+   vector<double> raw(numInputs);
+   for (int i = 0; i < numTrain; i++)
+   {
+      truths[i] = new double[numOutputs];
+      readSample(i, numInputs, numOutputs, raw.data(), truths[i]);
+      packBits(raw.data(), numInputs, binaryThreshold, &packedInputs[(long) i*numWords]);
+   }
+   return;
+
+}  //void Reader::readBinarizedData()
+
 
 /*
- * If the user inputs weights as part of the file, this method
- * reads in those weights given by the dimensions of the weights array
- * @param fileIn the file input stream passed by reference
+ * Reads a single training set from its input file (train/trainN) and
+ * truth file (truth/truthN). Inputs are scaled from pixel values (0-255) to 0-1.
+ * Used both by the Reader and by the streaming dataset. 
+ * @param index the number N of the training set
+ * @param numIn the number of input activations to read
+ * @param numOut the number of truth values to read
+ * @param input the array to store the input activations in
+ * @param truth the array to store the truth values in
  */
-void Reader::readWeights(ifstream& fileIn)
+void readSample(long index, int numIn, int numOut, double* input, double* truth)
 {
-   string weightsFile; 
-   string throwaway; 
-   getline(fileIn, throwaway);
-   getline(fileIn, weightsFile);
-   
-   std::string const weightsFileName = weightsFile + "\0"; 
+   double currentInput = 0.0;
+   double currentTruth = 0.0;
+   string currentImage = "train/train" + to_string(index);
+   string currentTruthPath = "truth/truth" + to_string(index); 
+
+   ifstream currentFile(currentImage);
+   ifstream currentTruthFile(currentTruthPath);
+
+   /*
+    * Reading in the current input values
+    * 
+    */
+   for (int j = 0; j < numIn; j++)           //Reads in the appropriate number of inputs
+   {
+      currentFile >> currentInput; 
+      input[j] = (1.0*currentInput)/(255.0);
+   }
+
+   /*
+    * Reading in the current truth values
+    * 
+    */
+   for (int j = 0; j < numOut; j++)          //Reads in the appropriate number of outputs(truth values)
+   {
+      currentTruthFile >> currentTruth; 
+      truth[j] = currentTruth;
+   }
+
+   currentFile.close();
+   currentTruthFile.close();
+
+   return; 
+
+}  //void readSample(long index, int numIn, int numOut, double* input, double* truth)
+
+
+/*
+ * If the user inputs weights as part of the file, this method reads in those weights
+ * (from weightsFile, named in the input file) given by the dimensions of the weights array.
+ * A file holding fewer weights than the network needs was trained on another topology or
+ * on projected inputs, so it is an error rather than a partly read network.
+ */
+void Reader::readWeights()
+{
+   TraceScope scope("read weights");
    ifstream weightsFileIn;
-   weightsFileIn.open("finalweights");
+   weightsFileIn.open(weightsFile, ios::binary);
    cout << "Weights from from " << weightsFile << endl << endl; 
 
+   /*
+    * A bf16 weights file starts with "BF16" and holds the weights in the same
+    * order as a text weights file
+    */
+   char magic[4] = {0, 0, 0, 0};
+   weightsFileIn.read(magic, 4);
+   if (weightsFileIn && string(magic, 4) == "BF16")
+   {
+      for (int n = 0; n < numLayers - 1; n++)
+      {
+         for (int j = 0; j < weightsRead[n].size(); j++)
+         {
+            vector<bf16> row(weightsRead[n][j].size());
+            weightsFileIn.read((char*) row.data(), row.size()*sizeof(bf16));
+            if (!weightsFileIn)
+            {
+               weightsTooFew();
+            }
+            for (int i = 0; i < row.size(); i++)
+            {
+               weightsRead[n][j][i] = fromBf16(row[i]);
+            }
+         }
+      }
+      weightsFileIn.close();
+      return;
+   }
+   weightsFileIn.clear();
+   weightsFileIn.seekg(0);
+
    for (int n = 0; n < numLayers - 1; n++)         //Iterating over the layers
    {
-      for (int j = 0; j < layerSizes[n]; j++)      //Iterating over the source layer
+      for (int j = 0; j < weightsRead[n].size(); j++)      //Iterating over the source layer (or filter)
       {
-         for (int i = 0; i < layerSizes[n+1]; i++) //Iterating over the destination layer
+         for (int i = 0; i < weightsRead[n][j].size(); i++) //Iterating over the destination layer
          {
             weightsFileIn >> weightsRead[n][j][i];        //Reading in the current weight
-            
+            if (!weightsFileIn)
+            {
+               weightsTooFew();
+            }
          }
 
       }
@@ -376,7 +782,29 @@ void Reader::readWeights(ifstream& fileIn)
 
    return; 
 
-}  //void Reader::readWeights(ifstream& fileIn)
+}  //void Reader::readWeights()
+
+/*
+ * Stops the run when the weights file holds fewer weights than the network needs - the
+ * likely cause (weights trained on projected inputs without their projection file) is named
+ */
+void Reader::weightsTooFew()
+{
+   cout << "The weights file " << weightsFile << " holds fewer weights than the network needs" << endl;
+   if (!projected && !ifstream(weightsFile + ".proj").good())
+   {
+      cout << "(weights trained on projected inputs need their projection, " << weightsFile << ".proj)" << endl;
+   }
+   exit(1);
+}
+
+/*
+ * Returns the file the weights were read from (its projection is this name + ".proj")
+ */
+string Reader::getWeightsFile()
+{
+   return weightsFile;
+}
 
 /*
  * Returns a shallow copy of the metadata in a double array (currently)
@@ -405,13 +833,49 @@ int* Reader::getLayerSizes()
 }
 
 /*
- * Returns the weights array shaped by the reader. If no weights were read in, 
- * hasWeights will be zero and the network MUST populate the weights randomly or else
- * it will a bunch of uninitialized double values. 
+ * Returns the type and shape of each layer
+ */
+LayerSpec* Reader::getLayerSpecs()
+{
+   return layerSpecs.data();
+}
+
+/*
+ * Hands the weights array shaped by the reader over to the caller - the array is moved out
+ * rather than copied, so the reader no longer holds the weights afterwards. If no weights
+ * were read in, hasWeights will be zero and the network MUST populate the weights randomly
+ * or else it will a bunch of uninitialized double values. 
  */
-vector<vector<vector<double> > > Reader::getWeights()
+vector<vector<vector<double> > > Reader::takeWeights()
 {
-   return weightsRead; 
+   trackFree(MEM_WEIGHTS, weightsBytes(weightsRead));
+   return move(weightsRead); 
+}
+
+/*
+ * Reads the training sets in now if they were left on disk for streaming
+ * (the reads do not depend on the input file stream), or unpacks binarized ones into
+ * 0s and 1s, for the drivers that need the input activations as doubles
+ */
+void Reader::loadTrainingData()
+{
+   if (inputs == NULL && binarized && !packedInputs.empty())
+   {
+      int numWords = bitWords(numInputs);
+      inputs = new double*[numTrain];
+      for (int i = 0; i < numTrain; i++)
+      {
+         inputs[i] = new double[numInputs];
+         unpackBits(&packedInputs[(long) i*numWords], numInputs, inputs[i]);
+      }
+      trackAlloc(MEM_DATASET, (long) numTrain*numInputs*sizeof(double));
+   }
+   else if (inputs == NULL && testOrTrain == 1)
+   {
+      ifstream unused;
+      readTrainingData(unused);
+   }
+   return;
 }
 
 /*
@@ -432,13 +896,199 @@ double** Reader::getTruths()
    return truths; 
 }
 
+/*
+ * Returns the projection of the inputs, or NULL if they are fed to the first layer as
+ * they are
+ */
+Projection* Reader::getProjection()
+{
+   return projected ? &projection : NULL;
+}
+
+/*
+ * Returns the input bits of every training set (bitWords(inputs) words each), or NULL if
+ * the inputs are not binarized
+ */
+uint64_t* Reader::getPackedInputs()
+{
+   return packedInputs.empty() ? NULL : packedInputs.data();
+}
+
+/*
+ * Returns the input bits of the test set, or NULL if the inputs are not binarized
+ */
+uint64_t* Reader::getTestBits()
+{
+   return testBits.empty() ? NULL : testBits.data();
+}
+
+/*
+ * Decides whether the inputs are projected before the first layer. Weights that are read
+ * in come with the projection they were trained with (weightsFile.proj) if there was one;
+ * otherwise a training run projects when projectDims is set - onto random directions now,
+ * or onto principal components once the training sets are read. Only inputs that feed a
+ * fully connected layer can be projected.
+ */
+void Reader::setUpProjection()
+{
+   projected = false;
+   string projectionFile = weightsFile + ".proj";
+   bool wanted = (hasWeights == 1) ? ifstream(projectionFile).good() : (testOrTrain == 1 && projectDims > 0);
+   if (!wanted)
+   {
+      if (projectDims > 0 && hasWeights == 1)
+      {
+         cout << "Note - the weights were trained without a projection (no " << projectionFile
+              << "), so the inputs are not projected" << endl;
+      }
+      return;
+   }
+   if (numLayers < 2 || !isFullyConnected(layerSpecs[1]))
+   {
+      cout << "Note - only inputs feeding a fully connected layer can be projected" << endl;
+      return;
+   }
+
+   if (hasWeights == 1)
+   {
+      if (!projection.load(projectionFile) || projection.inputs() != rawInputs)
+      {
+         cout << "Invalid projection file " << projectionFile << endl;
+         exit(1);
+      }
+      useInputSize(projection.dims());
+   }
+   else if (projectMethod == PROJECT_RANDOM)
+   {
+      projection.fitRandom(rawInputs, min(projectDims, rawInputs));
+      useInputSize(projection.dims());
+   }
+   else
+   {
+      useInputSize(min(projectDims, rawInputs));      //Fewer if the training sets span fewer directions
+   }
+   projected = true;
+   string source = projectMethod == PROJECT_RANDOM ? "random projection" : "PCA";
+   cout << "Inputs projected from " << rawInputs << " to " << numInputs << " values ("
+        << (hasWeights == 1 ? "read from " + projectionFile : source) << ")" << endl;
+
+   /*
+    * The projected inputs are no longer an image and the PCA needs every training set
+    */
+   if (streamData == 1 && testOrTrain == 1)
+   {
+      cout << "Note - streaming is off, the projection needs the training sets in memory" << endl;
+      streamData = 0;
+   }
+   if (augment == 1)
+   {
+      cout << "Note - augmentation is off, the projected inputs are not an image" << endl;
+      augment = 0;
+   }
+   return;
+
+}  //void Reader::setUpProjection()
+
+/*
+ * Decides whether the inputs are binarized (binarizeInputs) - not when they are projected.
+ * Binarized training sets are kept in memory, so streaming is turned off, and so is
+ * augmentation (its copies are not black and white).
+ */
+void Reader::setUpBinarized()
+{
+   binarized = false;
+   if (binarizeInputs == 0)
+   {
+      return;
+   }
+   if (projected)
+   {
+      cout << "Note - projected inputs are not binarized" << endl;
+      return;
+   }
+   binarized = true;
+   cout << "Inputs binarized at " << binaryThreshold << " (" << bitWords(numInputs) << " words per set)";
+   cout << (binaryWeights == 1 ? ", binarized first layer weights for inference" : "") << endl;
+   if (binaryWeights == 1)
+   {
+      cout << "Note - the first layer weights are binarized after training (the training does not adapt to it), "
+           << "which can cost a lot of accuracy" << endl;
+   }
+   if (streamData == 1 && testOrTrain == 1)
+   {
+      cout << "Note - streaming is off, the binarized training sets are kept in memory" << endl;
+      streamData = 0;
+   }
+   if (augment == 1)
+   {
+      cout << "Note - augmentation is off with binarized inputs" << endl;
+      augment = 0;
+   }
+   return;
+
+}  //void Reader::setUpBinarized()
+
+/*
+ * Makes the input layer a plain layer of the given size
+ */
+void Reader::useInputSize(int size)
+{
+   layerSpecs[0].channels = size;
+   layerSpecs[0].height = 1;
+   layerSpecs[0].width = 1;
+   layerSizes[0] = size;
+   numInputs = size;
+   return;
+}
+
+/*
+ * Replaces every training set's inputs by their projection, fitting PCA to them first if
+ * the projection is not chosen yet. If the training sets span fewer directions than asked
+ * for, the input layer (and the weights array) shrinks to the number found.
+ */
+void Reader::projectTrainingData()
+{
+   TraceScope scope("project training data");
+   if (projection.dims() == 0)
+   {
+      int found = projection.fitPca(inputs, numTrain, rawInputs, numInputs);
+      if (found == 0)         //A single training set, or identical ones - nothing varies to project onto
+      {
+         cout << "The training sets do not vary, so PCA finds no directions to project onto "
+              << "(use more training sets, projectMethod random or projectDims 0)" << endl;
+         exit(1);
+      }
+      if (found < numInputs)
+      {
+         cout << "Note - the training sets span only " << found << " directions, projecting to "
+              << found << " values" << endl;
+         trackFree(MEM_WEIGHTS, weightsBytes(weightsRead));
+         useInputSize(found);
+         shapeWeights(weightsRead, numLayers, layerSpecs.data());
+         trackAlloc(MEM_WEIGHTS, weightsBytes(weightsRead));
+      }
+   }
+
+   for (int i = 0; i < numTrain; i++)
+   {
+      double* raw = inputs[i];
+      inputs[i] = new double[numInputs];
+      projection.apply(raw, inputs[i]);
+      delete[] raw;
+   }
+   trackFree(MEM_DATASET, (long) numTrain*(rawInputs - numInputs)*sizeof(double));
+   return;
+
+}  //void Reader::projectTrainingData()
+
 /*
  * Exports the given weights to a file with the name of the parameter
- * @param weights the weights to export
+ * @param weights a view of the weights to export (they are not copied)
  * @param filename the filename of the weights file. 
  */
-void exportWeights(vector<vector<vector<double> > > weights, string fileName)
+void exportWeights(WeightsView weights, string fileName)
 {
+   TraceScope scope("export weights");
    ofstream fout(fileName);
 
    /*
@@ -446,13 +1096,14 @@ void exportWeights(vector<vector<vector<double> > > weights, string fileName)
     * one by one - each "layer" of weights corresponds to a line
     * in the file. 
     */ 
-   for (int n = 0; n < weights.size(); n++)             //Iterating over the layers
+   for (int n = 0; n < weights.numLayers(); n++)        //Iterating over the layers
    {
-      for (int j = 0; j < weights[n].size(); j++)       //Iterating over the source layer
+      for (int j = 0; j < weights.numRows(n); j++)      //Iterating over the source layer
       {
-         for (int i = 0; i < weights[n][j].size(); i++) //Iterating over the destination layer
+         const double* row = weights.row(n, j);
+         for (int i = 0; i < weights.rowLength(n, j); i++) //Iterating over the destination layer
          {
-            fout << weights[n][j][i] << " ";            //Exporting current weight to file
+            fout << row[i] << " ";                      //Exporting current weight to file
 
          }
          
@@ -464,3 +1115,55 @@ void exportWeights(vector<vector<vector<double> > > weights, string fileName)
    return; 
 
 }                    //exportWeights method
+
+/*
+ * Exports the given weights rounded to bf16 - "BF16" followed by the weights as 2 byte
+ * values in the same order as exportWeights() (half the size of float32 weights)
+ * @param weights a view of the weights to export (they are not copied)
+ * @param filename the filename of the weights file. 
+ */
+void exportWeightsBf16(WeightsView weights, string fileName)
+{
+   TraceScope scope("export weights");
+   ofstream fout(fileName, ios::binary);
+
+   fout.write("BF16", 4);
+   for (int n = 0; n < weights.numLayers(); n++)
+   {
+      for (int j = 0; j < weights.numRows(n); j++)
+      {
+         const double* source = weights.row(n, j);
+         vector<bf16> row(weights.rowLength(n, j));
+         for (int i = 0; i < row.size(); i++)
+         {
+            row[i] = toBf16(source[i]);
+         }
+         fout.write((const char*) row.data(), row.size()*sizeof(bf16));
+      }
+   }
+   fout.close();
+
+   return; 
+
+}  //void exportWeightsBf16(...)
+
+/*
+ * Saves the projection the weights in fileName were trained with next to them
+ * (fileName.proj), or removes an old one if they were trained on the inputs as they are,
+ * so the weights are never run on inputs projected differently than while training
+ * @param projection the projection of the inputs, NULL if there is none
+ * @param fileName the filename of the weights file
+ */
+void exportProjection(Projection* projection, string fileName)
+{
+   string projectionFile = fileName + ".proj";
+   if (projection != NULL)
+   {
+      projection->save(projectionFile);
+   }
+   else
+   {
+      remove(projectionFile.c_str());
+   }
+   return;
+}
@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <vector>
 
+#include "network.hpp"
+#include "projection.hpp"
+
 using namespace std; 
 /*
  * Helper method to read in the config file values
@@ -30,10 +33,31 @@ using namespace std;
  */
 void readConfigFile(string config);
 
+/*
+ * Reads just the number of training sets, test/train flag and layer specs of an input file
+ */
+void readHeader(string fileName, int& numTrain, int& testOrTrain, vector<LayerSpec>& specs);
+
 /*
  *  Exports the weights to a file given by the filename
  */
-void exportWeights(vector<vector<vector<double> > > weights, string fileName);
+void exportWeights(WeightsView weights, string fileName);
+
+/*
+ *  Exports the weights to a binary file of bf16 values (2 bytes per weight)
+ */
+void exportWeightsBf16(WeightsView weights, string fileName);
+
+/*
+ * Saves the projection of the inputs next to the weights file (fileName.proj), or removes
+ * the old one if there is no projection
+ */
+void exportProjection(Projection* projection, string fileName);
+
+/*
+ * Reads training set number index (train/trainN and truth/truthN) into the given arrays
+ */
+void readSample(long index, int numIn, int numOut, double* input, double* truth);
 
 
 /*
@@ -46,6 +70,7 @@ void exportWeights(vector<vector<vector<double> > > weights, string fileName);
  * 
  * Note - the Reader is generalized for an N layer network. 
  * (and will properly calculate how many weights it has to read in that context)
+ * Layers can be given as sizes or as convolution/pooling tokens (see parseLayerSpecs). 
  * Also, there should always be spaces between numbers and no empty lines between data. 
  * 
  */
@@ -54,6 +79,7 @@ class Reader
    int numTrain; 
    int numLayers; 
    int* layerSizes; 
+   vector<LayerSpec> layerSpecs;
    double** inputs; 
    double** truths;
    double* test; 
@@ -62,22 +88,41 @@ class Reader
    int hasWeights; 
    int testOrTrain; 
    vector<vector<vector<double> > > weightsRead;
+   string weightsFile;        //The file the weights are read from (named in the input file)
+   int rawInputs;             //Input activations in the files (numInputs once projected)
+   bool projected;
+   Projection projection;
+   bool binarized;            //Inputs thresholded into bits (binarizeInputs)
+   vector<uint64_t> packedInputs;      //Input bits of every training set when binarized
+   vector<uint64_t> testBits;
 
    private:
-      void readWeights(ifstream& fin);
+      void readWeights();
+      void weightsTooFew();
       void readTrainingData(ifstream& fin);
       void readMetaData(ifstream& fin);
       void readTestData(string testFile);
+      void setUpProjection();
+      void useInputSize(int size);
+      void projectTrainingData();
+      void setUpBinarized();
+      void readBinarizedData();
 
 
    public:
-      vector<vector<vector<double> > > getWeights();
+      vector<vector<vector<double> > > takeWeights();
       int* getMetaData();
       int* getLayerSizes();
+      LayerSpec* getLayerSpecs();
       double* getTest();
 
       double** getTrainingData();
+      void loadTrainingData();
       double** getTruths();
+      Projection* getProjection();
+      string getWeightsFile();
+      uint64_t* getPackedInputs();
+      uint64_t* getTestBits();
 
       Reader(string fileName, string configFile, string testFile);   
 
@@ -0,0 +1,462 @@
+/*
+ * End-to-end performance regression suite. Runs a fixed set of workloads through the
+ * same Reader, Network and training loop the driver uses and measures, for each one:
+ *
+ *    - loadMs             time for the Reader to read the input file and the training sets
+ *    - trainMs            time to reach minError (or to run the workload's epochs)
+ *    - epochs             epochs that took (deterministic, since the seed is fixed)
+ *    - epochsPerSec       training throughput
+ *    - inferP50Us/P99Us   latency of run() on a single image, after training
+ *
+ * The workloads are the shipped "everything" topology and "configs" hyperparameters on the
+ * 15 shipped training sets, and two larger synthetic datasets made of noisy copies of them.
+ * Every timed number is the best of the repeats (what the code can do - the slower
+ * repeats only add the machine's noise). The results are written to regress.json and
+ * compared with the baseline: a metric more than the tolerance worse than its baseline is
+ * a regression (unless the change is within the metric's noise floor, so a 20 ms load that
+ * takes 30 ms does not fail the suite), and the suite then exits with 1. Without a baseline
+ * (or with --update) the results become the baseline.
+ *
+ * The training sets of each workload are written under regress_data/ once (the Reader
+ * reads train/trainN and truth/truthN relative to the working directory) and kept for
+ * later runs, and they are read once untimed before the first repeat, so every timed load
+ * reads files that are already in the page cache.
+ *
+ * Usage: ./regress (--baseline file) (--tolerance 0.15) (--repeats 3) (--quick) (--update)
+ * --quick runs every workload once
+ *
+ * @author Kailash Ranganathan
+ * @version 5/8/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "network.hpp"
+#include "reader.hpp"
+#include "dataset.hpp"
+#include "trainer.hpp"
+#include "metrics.hpp"
+#include "random.hpp"
+
+using namespace std;
+
+/*
+ * Defined by the driver of every program that links the Reader (not used here)
+ */
+string outputFile = "regress_weights";
+
+static const int NUM_SHIPPED = 15;        //Training sets that come with the repository
+static const int INFER_REQUESTS = 5000;   //Single-image runs timed per repeat (50 above the p99)
+
+/*
+ * One workload - a topology, a dataset and the hyperparameters to train it with
+ */
+struct Workload
+{
+   string name;
+   string topology;
+   int numSets;            //NUM_SHIPPED uses the shipped sets as they are, more adds noisy copies
+   string config;          //Config file lines
+};
+
+/*
+ * The metrics of one workload, in the order they are written
+ */
+enum RegressMetric {REG_LOAD, REG_TRAIN, REG_EPOCHS, REG_EPOCHS_PER_SEC, REG_INFER_P50, REG_INFER_P99,
+                    NUM_REG_METRICS};
+const char* metricNames[] = {"loadMs", "trainMs", "epochs", "epochsPerSec", "inferP50Us", "inferP99Us"};
+const bool higherIsBetter[] = {false, false, false, true, false, false};
+const double noiseFloor[] = {50.0, 50.0, 0.0, 0.0, 10.0, 200.0};   //Changes smaller than this are never regressions
+
+struct RegressResult
+{
+   string name;
+   double values[NUM_REG_METRICS];
+};
+
+
+/*
+ * Reads a whole file into a string (empty if it can not be opened)
+ */
+static string readFile(string fileName)
+{
+   ifstream fin(fileName);
+   stringstream contents;
+   contents << fin.rdbuf();
+   return contents.str();
+}
+
+/*
+ * Finds the shipped training set and truth file index (train/trainN, or trainN next to the
+ * program when the sets have not been moved into train/)
+ */
+static string shippedPath(string directory, int index)
+{
+   string moved = directory + "/" + directory + to_string(index);
+   if (ifstream(moved).good())
+   {
+      return moved;
+   }
+   return directory + to_string(index);
+}
+
+/*
+ * Writes the workload's input file, config file and training sets into its directory.
+ * Training set N is shipped set N mod 15; past the first 15 every pixel gets gaussian noise
+ * (deviation 8 out of 255) drawn from its own stream, so the data is the same on every run.
+ * The training sets are only written if the directory does not have them all yet (the
+ * "prepared" file holds the number written, once they all are).
+ */
+static void prepare(Workload& work, string root, vector<string>& shippedInputs, vector<string>& shippedTruths)
+{
+   string directory = root + "/" + work.name;
+   mkdir(directory.c_str(), 0755);
+   mkdir((directory + "/train").c_str(), 0755);
+   mkdir((directory + "/truth").c_str(), 0755);
+
+   string stamp = directory + "/prepared";
+   bool written = readFile(stamp) == to_string(work.numSets);
+   for (int s = 0; s < work.numSets && !written; s++)
+   {
+      int source = s % NUM_SHIPPED;
+      ofstream image(directory + "/train/train" + to_string(s));
+      if (s < NUM_SHIPPED)
+      {
+         image << shippedInputs[source];
+      }
+      else
+      {
+         stringstream pixels(shippedInputs[source]);
+         Philox random(1, RNG_GENERAL, (uint32_t) s);
+         double pixel;
+         while (pixels >> pixel)
+         {
+            image << (int) min(255.0, max(0.0, pixel + 8.0*random.normal() + 0.5)) << " ";
+         }
+      }
+      ofstream truth(directory + "/truth/truth" + to_string(s));
+      truth << shippedTruths[source];
+   }
+
+   vector<string> tokens;
+   stringstream layers(work.topology);
+   string token;
+   while (layers >> token)
+   {
+      tokens.push_back(token);
+   }
+   ofstream input(directory + "/input");
+   input << work.numSets << " 0 " << tokens.size() << " 1" << endl << work.topology << endl;
+   ofstream config(directory + "/config");
+   config << work.config;
+   if (!written)
+   {
+      ofstream(stamp) << work.numSets;
+   }
+   return;
+
+}  //static void prepare(...)
+
+/*
+ * Reads every training set of the workload (in its directory) without timing it, so the
+ * timed loads do not depend on whether the files were still on disk
+ */
+static void warmUp(Workload& work)
+{
+   for (int s = 0; s < work.numSets; s++)
+   {
+      readFile("train/train" + to_string(s));
+      readFile("truth/truth" + to_string(s));
+   }
+   return;
+}
+
+/*
+ * Runs one repeat of a workload (in its directory) and fills in the metrics
+ */
+static void runWorkload(double* values)
+{
+   typedef chrono::steady_clock Clock;
+
+   Clock::time_point start = Clock::now();
+   Reader reader = Reader("input", "config", "");
+   values[REG_LOAD] = chrono::duration<double, milli>(Clock::now() - start).count();
+
+   int* metadata = reader.getMetaData();
+   int numLayers = metadata[2];
+   int* layerSizes = reader.getLayerSizes();
+   Network net = Network(numLayers, layerSizes, 0, reader.takeWeights(), reader.getLayerSpecs());
+   ResidentDataset data(reader.getTrainingData(), reader.getTruths(), metadata[0]);
+
+   /*
+    * Training until minError or maxIter, like train()
+    */
+   Hyperparameters& params = net.hyperparameters();
+   Metrics metrics;
+   int epochs = 0;
+   bool reached = false;
+   start = Clock::now();
+   while (epochs < params.maxIter && !reached)
+   {
+      double error = trainEpoch(net, data, epochs, metrics);
+      reached = error < params.minError;
+      metrics.endEpoch(epochs, error, params.lambda, reached || epochs == params.maxIter - 1);
+      epochs++;
+   }
+   double trainMs = chrono::duration<double, milli>(Clock::now() - start).count();
+   values[REG_TRAIN] = trainMs;
+   values[REG_EPOCHS] = epochs;
+   values[REG_EPOCHS_PER_SEC] = epochs/(trainMs/1000.0);
+
+   /*
+    * Single-image latency of the trained network
+    */
+   double* image = reader.getTrainingData()[0];
+   vector<double> times(INFER_REQUESTS);
+   for (int r = -10; r < INFER_REQUESTS; r++)
+   {
+      start = Clock::now();
+      net.run(image);
+      if (r >= 0)
+      {
+         times[r] = chrono::duration<double, micro>(Clock::now() - start).count();
+      }
+   }
+   sort(times.begin(), times.end());
+   values[REG_INFER_P50] = times[INFER_REQUESTS/2];
+   values[REG_INFER_P99] = times[INFER_REQUESTS*99/100];
+   return;
+
+}  //static void runWorkload(double* values)
+
+/*
+ * Writes the results as JSON (one workload per line, which readJson relies on)
+ */
+static void writeJson(vector<RegressResult>& results, string fileName)
+{
+   ofstream fout(fileName);
+   fout << "{" << endl;
+   fout << "  \"compiler\": \"" << __VERSION__ << "\"," << endl;
+   fout << "  \"workloads\": [" << endl;
+   for (int r = 0; r < results.size(); r++)
+   {
+      fout << "    {\"name\": \"" << results[r].name << "\"";
+      for (int m = 0; m < NUM_REG_METRICS; m++)
+      {
+         fout << ", \"" << metricNames[m] << "\": " << results[r].values[m];
+      }
+      fout << "}" << (r + 1 < results.size() ? "," : "") << endl;
+   }
+   fout << "  ]" << endl;
+   fout << "}" << endl;
+   fout.close();
+   return;
+}
+
+/*
+ * Reads results written by writeJson (metrics missing from the file are -1)
+ */
+static vector<RegressResult> readJson(string fileName)
+{
+   vector<RegressResult> results;
+   ifstream fin(fileName);
+   string line;
+   while (getline(fin, line))
+   {
+      size_t name = line.find("\"name\": \"");
+      if (name == string::npos)
+      {
+         continue;
+      }
+      RegressResult result;
+      size_t nameStart = name + 9;
+      result.name = line.substr(nameStart, line.find('"', nameStart) - nameStart);
+      for (int m = 0; m < NUM_REG_METRICS; m++)
+      {
+         size_t key = line.find("\"" + string(metricNames[m]) + "\": ");
+         result.values[m] = key == string::npos ? -1.0 : atof(line.c_str() + key + strlen(metricNames[m]) + 4);
+      }
+      results.push_back(result);
+   }
+   return results;
+}
+
+/*
+ * Runs the workloads and compares them with the baseline
+ */
+int main(int argc, char* argv[])
+{
+   string baselineFile = "regress_baseline.json";
+   double tolerance = 0.15;
+   int repeats = 3;
+   bool update = false;
+   for (int a = 1; a < argc; a++)
+   {
+      string arg = argv[a];
+      if (arg == "--baseline" && a + 1 < argc)
+      {
+         baselineFile = argv[++a];
+      }
+      else if (arg == "--tolerance" && a + 1 < argc)
+      {
+         tolerance = atof(argv[++a]);
+      }
+      else if (arg == "--repeats" && a + 1 < argc)
+      {
+         repeats = max(1, atoi(argv[++a]));
+      }
+      else if (arg == "--quick")
+      {
+         repeats = 1;
+      }
+      else if (arg == "--update")
+      {
+         update = true;
+      }
+   }
+
+   /*
+    * The shipped training sets and the shipped topology and hyperparameters
+    */
+   vector<string> shippedInputs(NUM_SHIPPED), shippedTruths(NUM_SHIPPED);
+   for (int s = 0; s < NUM_SHIPPED; s++)
+   {
+      shippedInputs[s] = readFile(shippedPath("train", s));
+      shippedTruths[s] = readFile(shippedPath("truth", s));
+      if (shippedInputs[s].empty() || shippedTruths[s].empty())
+      {
+         cout << "The shipped training set " << s << " is missing (train" << s << ", truth" << s << ")" << endl;
+         return 2;
+      }
+   }
+   ifstream everything("everything");
+   string header, topology;
+   getline(everything, header);
+   getline(everything, topology);
+   string configs = readFile("configs");
+   if (topology.empty())
+   {
+      cout << "The shipped input file \"everything\" is missing" << endl;
+      return 2;
+   }
+
+   /*
+    * Every workload sets every hyperparameter it uses, since the config values carry over
+    * from one Reader to the next. The seed is the same for all of them.
+    */
+   string common = "seed\n1\ninit\nuniform\nlogInterval\n1000000\n";
+   vector<Workload> workloads;
+   workloads.push_back({"everything", topology, NUM_SHIPPED, common + "maxIter\n5000\n" + configs});
+   workloads.push_back({"synthetic-1000", "625 100 5", 1000, common + "maxIter\n5\nminError\n0\nlambda\n0.1\n"});
+   workloads.push_back({"synthetic-4000-deep", "625 40 40 40 40 5", 4000,
+                        common + "maxIter\n3\nminError\n0\nlambda\n0.1\n"});
+   randomSeed = 1;
+
+   string root = "regress_data";
+   mkdir(root.c_str(), 0755);
+   char home[4096];
+   if (getcwd(home, sizeof(home)) == NULL)
+   {
+      return 2;
+   }
+
+   vector<RegressResult> results;
+   for (int w = 0; w < workloads.size(); w++)
+   {
+      Workload& work = workloads[w];
+      cout << "Workload " << work.name << " (" << work.topology << ", " << work.numSets << " training sets)" << endl;
+      prepare(work, root, shippedInputs, shippedTruths);
+      if (chdir((root + "/" + work.name).c_str()) != 0)
+      {
+         return 2;
+      }
+
+      warmUp(work);
+      vector<vector<double> > repeatValues(NUM_REG_METRICS);
+      for (int r = 0; r < repeats; r++)
+      {
+         double values[NUM_REG_METRICS];
+         runWorkload(values);
+         for (int m = 0; m < NUM_REG_METRICS; m++)
+         {
+            repeatValues[m].push_back(values[m]);
+         }
+      }
+      if (chdir(home) != 0)
+      {
+         return 2;
+      }
+
+      RegressResult result;
+      result.name = work.name;
+      for (int m = 0; m < NUM_REG_METRICS; m++)
+      {
+         vector<double>& values = repeatValues[m];
+         result.values[m] = higherIsBetter[m] ? *max_element(values.begin(), values.end())
+                                              : *min_element(values.begin(), values.end());
+      }
+      results.push_back(result);
+   }  //for (int w = 0; w < workloads.size(); w++)
+   writeJson(results, "regress.json");
+
+   /*
+    * Comparing with the baseline
+    */
+   vector<RegressResult> baseline = update ? vector<RegressResult>() : readJson(baselineFile);
+   if (baseline.empty())
+   {
+      writeJson(results, baselineFile);
+      cout << endl << "No baseline to compare with - the results were saved as the baseline \"" << baselineFile << "\"" << endl;
+      return 0;
+   }
+
+   int regressions = 0;
+   cout << endl << "Compared with \"" << baselineFile << "\" (tolerance " << tolerance*100.0 << "%):" << endl;
+   for (int r = 0; r < results.size(); r++)
+   {
+      RegressResult* before = NULL;
+      for (int b = 0; b < baseline.size(); b++)
+      {
+         if (baseline[b].name == results[r].name)
+         {
+            before = &baseline[b];
+         }
+      }
+      for (int m = 0; m < NUM_REG_METRICS; m++)
+      {
+         double now = results[r].values[m];
+         double then = before == NULL ? -1.0 : before->values[m];
+         if (then <= 0.0)
+         {
+            cout << "   " << results[r].name << " " << metricNames[m] << ": " << now << " (no baseline)" << endl;
+            continue;
+         }
+         double change = (now - then)/then;
+         bool worse = (higherIsBetter[m] ? change < -tolerance : change > tolerance) && fabs(now - then) > noiseFloor[m];
+         regressions += worse ? 1 : 0;
+         cout << "   " << results[r].name << " " << metricNames[m] << ": " << now << " vs " << then << " ("
+              << (change >= 0 ? "+" : "") << change*100.0 << "%)" << (worse ? "  REGRESSION" : "") << endl;
+      }
+   }
+
+   if (regressions > 0)
+   {
+      cout << regressions << " metrics regressed" << endl;
+      return 1;
+   }
+   cout << "No regressions" << endl;
+   return 0;
+
+}  //int main(int argc, char* argv[])
@@ -0,0 +1,279 @@
+/*
+ * Implementation of the hyperparameter sweep. Every configuration gets its own network
+ * and its own view of the shared training sets (datasets only keep a cursor, so views are
+ * cheap). Each rung of the successive halving is a batch of jobs - one per surviving
+ * configuration - handed to a pool of worker threads.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/30/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+
+#include "sweep.hpp"
+#include "trainer.hpp"
+#include "augment.hpp"
+#include "reader.hpp"
+
+using namespace std;
+
+extern string outputFile;
+
+/*
+ * Default number of threads (can be overridden in the config file)
+ */
+int sweepThreads = 0;
+
+/*
+ * One configuration of the sweep and the state of its training
+ */
+struct SweepRun
+{
+   Hyperparameters params;
+   Network* net;
+   Dataset* sets;          //View of the shared training sets
+   Dataset* data;          //What the network trains on (sets, or a wrapper of it)
+   Metrics* metrics;
+   int epochs;             //Epochs trained so far
+   double error;           //Error of the last epoch
+   bool converged;         //Whether the error went below minError
+};
+
+/*
+ * Sets the named hyperparameter (the same names as the config file)
+ * @return false if the name is not a hyperparameter
+ */
+static bool setHyperparameter(Hyperparameters& params, string name, double value)
+{
+   if (name.find("lambda") != string::npos)
+   {
+      params.lambda = value;
+   }
+   else if (name.find("maxIter") != string::npos)
+   {
+      params.maxIter = value;
+   }
+   else if (name.find("minWeight") != string::npos)
+   {
+      params.randomWeightMin = value;
+   }
+   else if (name.find("maxWeight") != string::npos)
+   {
+      params.randomWeightMax = value;
+   }
+   else if (name.find("minError") != string::npos)
+   {
+      params.minError = value;
+   }
+   else if (name.find("seed") != string::npos)
+   {
+      params.seed = value;
+   }
+   else if (name.find("init") != string::npos)
+   {
+      params.init = value;       //0 uniform, 1 xavier, 2 he
+   }
+   else
+   {
+      return false;
+   }
+   return true;
+}
+
+/*
+ * Reads the sweep file into the grid of configurations it describes
+ */
+static vector<Hyperparameters> readSweepFile(string fileName)
+{
+   vector<Hyperparameters> grid(1, configHyperparameters());
+   ifstream fin(fileName);
+   string name, values;
+
+   while (getline(fin, name) && getline(fin, values))
+   {
+      Hyperparameters test = grid[0];
+      if (!setHyperparameter(test, name, 0.0))
+      {
+         cout << "Sweep option \"" << name << "\" is not a hyperparameter - ignored" << endl;
+         continue;
+      }
+
+      vector<double> choices;
+      istringstream valuesIn(values);
+      double value;
+      while (valuesIn >> value)
+      {
+         choices.push_back(value);
+      }
+
+      vector<Hyperparameters> expanded;
+      for (int g = 0; g < grid.size(); g++)
+      {
+         for (int c = 0; c < choices.size(); c++)
+         {
+            Hyperparameters params = grid[g];
+            setHyperparameter(params, name, choices[c]);
+            expanded.push_back(params);
+         }
+      }
+      grid = expanded;
+   }
+   fin.close();
+   return grid;
+
+}  //static vector<Hyperparameters> readSweepFile(string fileName)
+
+/*
+ * Prints a configuration and how far it got
+ */
+static void printRun(SweepRun& run)
+{
+   cout << "   lambda " << run.params.lambda << ", weights " << run.params.randomWeightMin << " to "
+        << run.params.randomWeightMax << ", maxIter " << run.params.maxIter << ", minError "
+        << run.params.minError << ", " << initName(run.params.init) << " init, seed " << run.params.seed
+        << ": error " << run.error << " after " << run.epochs << " epochs"
+        << (run.converged ? " (converged)" : "") << endl;
+   return;
+}
+
+/*
+ * Frees everything a run holds except its results
+ */
+static void releaseRun(SweepRun& run)
+{
+   if (run.data != run.sets)
+   {
+      delete run.data;
+   }
+   delete run.sets;
+   delete run.metrics;
+   delete run.net;
+   run.net = NULL;
+   return;
+}
+
+/*
+ * Runs the sweep - see sweep.hpp
+ */
+int runSweep(string sweepFile, int numLayers, int* layerSizes, LayerSpec* specs, int hasWeights,
+             vector<vector<vector<double> > >& weights, double** inputs, double** truths, long numSets)
+{
+   vector<Hyperparameters> grid = readSweepFile(sweepFile);
+   if (grid.size() == 0)
+   {
+      cout << "No configurations in sweep file \"" << sweepFile << "\"" << endl;
+      return 1;
+   }
+   int numThreads = sweepThreads > 0 ? sweepThreads : max(1, (int) thread::hardware_concurrency());
+   int numOutputs = layerSizes[numLayers-1];
+   cacheFile = "";                  //Every run has its own feature cache, so they stay in memory
+
+   /*
+    * Successive halving - with 2^R configurations there are R+1 rungs, and a configuration
+    * that reaches rung r trains up to maxIter/2^(R-r) epochs in total
+    */
+   int numRungs = 0;
+   while ((1L << numRungs) < (long) grid.size())
+   {
+      numRungs++;
+   }
+   cout << "Sweeping " << grid.size() << " configurations on " << numThreads << " threads ("
+        << numRungs + 1 << " rungs of successive halving)" << endl << endl;
+
+   int frozen = min(freezeLayers, numLayers - 1);      //No more than the weights layers, as in main
+   vector<SweepRun> runs(grid.size());
+   for (int c = 0; c < runs.size(); c++)
+   {
+      SweepRun& run = runs[c];
+      run.params = grid[c];
+      run.net = new Network(numLayers, layerSizes, hasWeights, weights, specs, &run.params);
+      for (int n = 0; n < frozen; n++)
+      {
+         run.net->freezeLayer(n, true);
+      }
+      run.sets = new ResidentDataset(inputs, truths, numSets);
+      run.data = run.sets;
+      if (augment == 1)
+      {
+         run.data = new AugmentedDataset(run.sets, layerSizes[0], numOutputs);
+      }
+      else if (frozen > 0)
+      {
+         run.data = new FeatureCacheDataset(run.sets, *run.net, frozen, layerSizes[frozen], numOutputs);
+      }
+      run.metrics = new Metrics("");
+      run.epochs = 0;
+      run.error = 0.0;
+      run.converged = false;
+   }
+
+   vector<int> survivors(runs.size());
+   for (int c = 0; c < survivors.size(); c++)
+   {
+      survivors[c] = c;
+   }
+
+   for (int rung = 0; rung <= numRungs; rung++)
+   {
+      parallelFor(survivors.size(), numThreads, [&](int s)
+      {
+         SweepRun& run = runs[survivors[s]];
+         int budget = max(1, run.params.maxIter >> (numRungs - rung));
+         while (run.epochs < budget && !run.converged)
+         {
+            run.error = trainEpoch(*run.net, *run.data, run.epochs, *run.metrics);
+            run.epochs++;
+            run.converged = run.error < run.params.minError;
+         }
+      });
+
+      sort(survivors.begin(), survivors.end(), [&](int a, int b)
+      {
+         return runs[a].error < runs[b].error;
+      });
+      cout << "Rung " << rung << ":" << endl;
+      for (int s = 0; s < survivors.size(); s++)
+      {
+         printRun(runs[survivors[s]]);
+      }
+      cout << endl;
+
+      /*
+       * The worse half is pruned (its networks are freed right away)
+       */
+      if (rung < numRungs)
+      {
+         int keep = (survivors.size() + 1)/2;
+         for (int s = keep; s < survivors.size(); s++)
+         {
+            releaseRun(runs[survivors[s]]);
+         }
+         survivors.resize(keep);
+      }
+   }  //for (int rung = 0; rung <= numRungs; rung++)
+
+   SweepRun& best = runs[survivors[0]];
+   cout << "Best configuration:" << endl;
+   printRun(best);
+   if (bf16Storage)
+   {
+      exportWeightsBf16(best.net->getWeights(), outputFile);
+   }
+   else
+   {
+      exportWeights(best.net->getWeights(), outputFile);
+   }
+   cout << "Best weights saved to output file with name \"" << outputFile << "\"" << endl << endl;
+
+   for (int s = 0; s < survivors.size(); s++)
+   {
+      releaseRun(runs[survivors[s]]);
+   }
+   return 0;
+
+}  //int runSweep(...)
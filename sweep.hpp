@@ -0,0 +1,44 @@
+/*
+ * Header file for the hyperparameter sweep - Contains the declaration of the sweep
+ * runner that trains a grid of hyperparameter configurations on one copy of the
+ * training sets, several networks at a time on a pool of threads.
+ *
+ * Poor configurations are pruned with successive halving: every configuration trains for
+ * a short budget, the better half keeps training for twice as long, and so on until one
+ * configuration is left, which trains for its full maxIter.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/30/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <string>
+#include <vector>
+
+#include "network.hpp"
+
+using namespace std;
+
+/*
+ * Number of networks trained at once (0 for one per hardware thread - can be set
+ * in the config file)
+ */
+extern int sweepThreads;
+
+/*
+ * Runs the sweep described by sweepFile - each line naming a hyperparameter (lambda,
+ * maxIter, minWeight, maxWeight, minError, seed, init) is followed by a line of values to
+ * try, and every combination is a configuration. Hyperparameters that are not named keep their
+ * config file values. The best network's weights are exported to the output file.
+ * Returns 0, or 1 if the sweep file has no configurations.
+ */
+int runSweep(string sweepFile, int numLayers, int* layerSizes, LayerSpec* specs, int hasWeights,
+             vector<vector<vector<double> > >& weights, double** inputs, double** truths, long numSets);
+
+
+#endif /* SWEEP_H */
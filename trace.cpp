@@ -0,0 +1,143 @@
+/*
+ * Implementation of the timeline tracing. Each thread gets its own event buffer the
+ * first time it records an event; the buffers are registered in a global list (the only
+ * place a lock is taken) and outlive their threads, so worker threads that have already
+ * exited still show up in the trace.
+ *
+ * The output is the trace-event JSON format ("X" complete events with microsecond
+ * timestamps) that chrome://tracing and ui.perfetto.dev open directly.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/18/20
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <mutex>
+
+#include "trace.hpp"
+
+using namespace std;
+
+/*
+ * One recorded event
+ */
+struct TraceEvent
+{
+   const char* name;
+   int layer;
+   double start;
+   double end;
+};
+
+/*
+ * The events of one thread
+ */
+struct ThreadTrace
+{
+   int id;
+   vector<TraceEvent> events;
+};
+
+bool traceEnabled = false;
+
+static string traceFile;
+static chrono::steady_clock::time_point traceOrigin;
+static mutex registryLock;
+static vector<ThreadTrace*> registry;
+static thread_local ThreadTrace* threadTrace = NULL;
+
+
+/*
+ * Starts recording trace events
+ * @param fileName the file the events are written to by traceFinish()
+ */
+void traceStart(string fileName)
+{
+   traceFile = fileName;
+   traceOrigin = chrono::steady_clock::now();
+   traceEnabled = true;
+   return;
+}
+
+double traceNow()
+{
+   return chrono::duration<double, micro>(chrono::steady_clock::now() - traceOrigin).count();
+}
+
+/*
+ * Appends an event to the calling thread's buffer, registering the buffer
+ * on the thread's first event
+ */
+void traceRecord(const char* name, int layer, double start, double end)
+{
+   if (threadTrace == NULL)
+   {
+      lock_guard<mutex> guard(registryLock);
+      threadTrace = new ThreadTrace();
+      threadTrace->id = registry.size();
+      registry.push_back(threadTrace);
+   }
+
+   TraceEvent event;
+   event.name = name;
+   event.layer = layer;
+   event.start = start;
+   event.end = end;
+   threadTrace->events.push_back(event);
+
+   return;
+}
+
+/*
+ * Writes every recorded event to the trace file. Thread 0 is the first thread
+ * that recorded an event (normally the main thread).
+ */
+void traceFinish()
+{
+   if (!traceEnabled)
+   {
+      return;
+   }
+   traceEnabled = false;
+
+   lock_guard<mutex> guard(registryLock);
+   ofstream fout(traceFile);
+   fout << "{\"traceEvents\": [" << "\n";
+
+   bool first = true;
+   for (int t = 0; t < registry.size(); t++)
+   {
+      ThreadTrace* trace = registry[t];
+
+      fout << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+           << trace->id << ", \"args\": {\"name\": \"" << (trace->id == 0 ? "main" : "worker ")
+           << (trace->id == 0 ? "" : to_string(trace->id)) << "\"}}";
+      first = false;
+
+      for (int e = 0; e < trace->events.size(); e++)
+      {
+         TraceEvent& event = trace->events[e];
+         fout << ",\n{\"name\": \"" << event.name;
+         if (event.layer >= 0)
+         {
+            fout << " " << event.layer;
+         }
+         fout << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << trace->id << ", \"ts\": " << fixed
+              << event.start << ", \"dur\": " << event.end - event.start << "}";
+         fout.unsetf(ios::floatfield);
+      }
+      delete trace;
+   }
+   registry.clear();
+   threadTrace = NULL;
+
+   fout << "\n]}" << endl;
+   fout.close();
+   cout << "Trace saved to \"" << traceFile << "\"" << endl;
+
+   return;
+
+}  //void traceFinish()
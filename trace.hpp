@@ -0,0 +1,82 @@
+/*
+ * Header file for the timeline tracing - Contains declarations for scoped trace
+ * events that are written out as a Chrome/Perfetto trace-event JSON file.
+ *
+ * A TraceScope records how long the enclosing block took. When tracing is off, a scope
+ * costs one check of a global flag. When it is on, every thread appends to its own buffer,
+ * so threads never contend and show up as separate lanes in the viewer.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/18/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <chrono>
+
+using namespace std;
+
+/*
+ * Whether trace events are being recorded (set by traceStart)
+ */
+extern bool traceEnabled;
+
+/*
+ * Starts recording trace events that will be written to the given file
+ */
+void traceStart(string fileName);
+
+/*
+ * Writes all recorded events to the trace file (call once every traced thread is done)
+ */
+void traceFinish();
+
+/*
+ * Microseconds since tracing started
+ */
+double traceNow();
+
+/*
+ * Records a finished event on the calling thread's buffer
+ * (layer is appended to the name when it is not -1)
+ */
+void traceRecord(const char* name, int layer, double start, double end);
+
+/*
+ * Records the time from its construction to its destruction as one event
+ * Usage: TraceScope scope("updateWeights", n);
+ */
+class TraceScope
+{
+   const char* name;
+   int layer;
+   double start;
+
+   public:
+      inline TraceScope(const char* eventName, int eventLayer = -1)
+      {
+         name = NULL;
+         if (traceEnabled)
+         {
+            name = eventName;
+            layer = eventLayer;
+            start = traceNow();
+         }
+      }
+      inline ~TraceScope()
+      {
+         if (name != NULL)
+         {
+            traceRecord(name, layer, start, traceNow());
+         }
+      }
+
+};    //class TraceScope
+
+
+#endif /* TRACE_H */
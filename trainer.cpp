@@ -0,0 +1,439 @@
+/*
+ * Implementation of the trainer - the training loop that used to live in main.cpp,
+ * split into single epochs so that other drivers (the hyperparameter sweep) can train
+ * a network a few epochs at a time, and the small thread pool those drivers share.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/30/20
+ */
+
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <signal.h>
+#include <math.h>
+
+#include "trainer.hpp"
+#include "trace.hpp"
+#include "perfcounters.hpp"
+#include "memory.hpp"
+
+using namespace std;
+
+/*
+ * Time budget options - the seconds of wall clock the whole run may take (0 for no budget,
+ * counted from the start of the program so loading counts too) and the seconds of it kept
+ * for the training summary and exporting the weights
+ */
+double timeBudget = 0.0;
+double budgetReserve = 1.0;
+
+static const double BUDGET_AVERAGING = 0.3;     //Weight of the newest epoch in the moving averages
+static const double BUDGET_DEVIATIONS = 2.0;    //Deviations added to the predicted epoch time
+
+static const chrono::steady_clock::time_point programStart = chrono::steady_clock::now();
+static volatile sig_atomic_t receivedSignal = 0;
+
+/*
+ * The seconds since the program started
+ */
+static double elapsedSeconds()
+{
+   return chrono::duration<double>(chrono::steady_clock::now() - programStart).count();
+}
+
+/*
+ * Records the signal and puts its default action back, so a second one ends the program
+ */
+static void onStopSignal(int signalNumber)
+{
+   receivedSignal = signalNumber;
+   signal(signalNumber, SIG_DFL);
+}
+
+/*
+ * Makes SIGINT and SIGTERM stop training gracefully instead of ending the program
+ */
+void installStopHandlers()
+{
+   signal(SIGINT, onStopSignal);
+   signal(SIGTERM, onStopSignal);
+   return;
+}
+
+/*
+ * The signal that asked training to stop, 0 if there was none
+ */
+int stopSignal()
+{
+   return receivedSignal;
+}
+
+/*
+ * Whether training should stop after the current step - a stop signal came in or the time
+ * budget (less the reserve) is used up
+ */
+bool stopRequested()
+{
+   return receivedSignal != 0 || (timeBudget > 0.0 && elapsedSeconds() > timeBudget - budgetReserve);
+}
+
+
+/*
+ * Runs one epoch of training - every training set is forward propagated, its error
+ * is added up and the weights are updated right after it
+ * @param n the network to train
+ * @param data the training sets (resident, streamed, augmented or cached - the loop
+ * does not need to know which)
+ * @param epoch the index of the epoch (seeds the dataset's shuffling)
+ * @param metrics times each phase of every training step
+ * @param stoppedEarly set to whether training was asked to stop during the epoch (if not NULL)
+ * @return the mean error over the training sets of the epoch (estimated by the dataset if
+ * it skipped some of them, over the sets done if training was asked to stop during it)
+ */
+double trainEpoch(Network& n, Dataset& data, int epoch, Metrics& metrics, bool* stoppedEarly)
+{
+   if (stoppedEarly != NULL)
+   {
+      *stoppedEarly = false;
+   }
+   double error = 0.0; 
+   Sample sample; 
+   TraceScope epochScope("epoch", epoch);
+   data.startEpoch(epoch);
+   metrics.startEpoch(); 
+   long numDone = 0;
+   while (true)
+   {
+      {
+         TraceScope waitScope("next training set");
+         if (!data.next(sample))
+         {
+            break;
+         }
+      }
+      if (stopRequested())       //Stopping early (only with sets left) - the epoch's error is the mean of the sets done
+      {
+         if (stoppedEarly != NULL)
+         {
+            *stoppedEarly = true;
+         }
+         return error/max(numDone, 1L);
+      }
+
+      /*
+       * For each training set, the input values are forward propagated in the method
+       * run() and the weights are updated using whatever algorithm written in the
+       * network (currently backpropagation). Total iteration error is defined as
+       * the sum of the individual training set errors. 
+       * Each phase is timed for the metrics. 
+       */
+      n.setTruth(sample.truth);
+      metrics.start(); 
+      perfBegin(); 
+      if (sample.bits != NULL)
+      {
+         n.runBits(sample.bits);                   //Binarized inputs - no multiplies in the first layer
+      }
+      else
+      {
+         n.runFrom(sample.layer, sample.input);  //Skips the frozen layers if the input is cached
+      }
+      perfEnd(PERF_RUN); 
+      metrics.stop(PHASE_FORWARD); 
+      double setError = n.error();
+      error += setError;         // The error displayed is the sum of each training set's error   
+      data.reportLoss(sample, setError);
+      metrics.stop(PHASE_ERROR); 
+      perfBegin(); 
+      n.updateWeights();
+      perfEnd(PERF_UPDATE); 
+      metrics.stop(PHASE_UPDATE); 
+      metrics.countSample(); 
+      numDone++;
+
+   }
+   return data.epochError(error);
+
+}  //double trainEpoch(...)
+
+
+/*
+ * Runs the training loop for the given network given the training data
+ * and truth values (the maximum number of epochs and minimum error are the network's
+ * own hyperparameters)
+ * 
+ * @param n the network to train
+ * @param data the training sets to train the network on (resident or streamed from disk,
+ * the loop does not need to know which)
+ * @return 1 if the training goes below the minimum error, 0 is the maximum
+ * number of iterations is reached, 3 if it was stopped early (time budget or signal).
+ * The network is handed back with the weights of its best epoch.
+ */
+int train(int nOut, Network &n, Dataset& data)
+{
+   bool errorReachedThreshold = false; 
+   int isSuccessful = 0; 
+   Hyperparameters& params = n.hyperparameters();
+   /*
+    * Training the network - on each iteration, the network is run
+    * on all the training data and update the weights after each
+    * input is run. The total error is calculated and displayed
+    * after each training iteration and breaks when the error
+    * goes below the threshold or the maximum amount of iterations
+    * is reached (or the time budget or a signal stops it).
+    */ 
+   double error = 0.0;
+   double previousError = 2000000.0; 
+   Metrics metrics; 
+   TrainingBudget budget;
+   BestWeights best;
+   bool stopped = false;
+   for (int i = 0; i < params.maxIter && !errorReachedThreshold; i++)
+   {
+      if (!budget.allowsEpoch())
+      {
+         isSuccessful = 3;
+         data.stop();
+         break;
+      }
+      error = trainEpoch(n, data, i, metrics, &stopped);
+      if (!stopped)                          //An unfinished epoch's time says nothing about the next one
+      {
+         budget.endEpoch();
+      }
+      if (error > previousError)
+      {
+         params.lambda *= 1;
+      }
+      else
+      {
+         params.lambda *= 1; 
+      }
+      if (!stopped)                          //A partial epoch's error is not compared with full ones
+      {
+         previousError = error; 
+      }
+
+      if (error < params.minError && data.exactError() && !stopped)        // Break if the error goes below the threshold
+      {
+         errorReachedThreshold = true; 
+         isSuccessful = 1; 
+      }
+      if (data.exactError() && !stopped && best.improves(error))
+      {
+         best.keep(n, error, i);
+      }
+
+      /*
+       * Logging the epoch (rate limited on the console, every epoch in the metrics file)
+       */
+      metrics.endEpoch(i, error, params.lambda, errorReachedThreshold || stopped || i == params.maxIter - 1); 
+      if (stopped && !errorReachedThreshold)
+      {
+         budget.explainStop();
+         isSuccessful = 3;
+         data.stop();               //The rest of the epoch is not wanted (the sets are used again right away)
+         break;
+      }
+      
+   }  //for (int i = 0; i < params.maxIter && !errorReachedThreshold; i++)
+   metrics.summary(); 
+   best.restore(n, stopped ? INFINITY : previousError);      //An interrupted epoch always gives way to the best one
+
+   return isSuccessful; 
+
+}     //int train() method
+
+
+/*
+ * Runs job(0) to job(count-1) on numThreads worker threads - each worker takes the
+ * next job that has not been started until there are none left. With one thread the
+ * jobs run on the calling thread.
+ */
+void parallelFor(int count, int numThreads, function<void(int)> job)
+{
+   if (numThreads <= 1)
+   {
+      for (int j = 0; j < count; j++)
+      {
+         job(j);
+      }
+      return;
+   }
+
+   atomic<int> nextJob(0);
+   vector<thread> workers;
+   for (int t = 0; t < min(numThreads, count); t++)
+   {
+      workers.push_back(thread([&]()
+      {
+         int j;
+         while ((j = nextJob++) < count)
+         {
+            job(j);
+         }
+      }));
+   }
+   for (int t = 0; t < workers.size(); t++)
+   {
+      workers[t].join();
+   }
+   return;
+}
+
+
+/*
+ * Constructor - no epoch times yet
+ */
+TrainingBudget::TrainingBudget()
+{
+   meanSeconds = 0.0;
+   deviation = 0.0;
+   epochs = 0;
+}
+
+/*
+ * Whether the next epoch should start - not after a stop signal, and with a time budget
+ * only if the predicted epoch time (its moving average plus two moving average
+ * deviations) fits in what is left of it after the reserve. Prints the reason when not.
+ * Starts timing the epoch.
+ */
+bool TrainingBudget::allowsEpoch()
+{
+   if (receivedSignal != 0)
+   {
+      explainStop();
+      return false;
+   }
+   if (timeBudget > 0.0)
+   {
+      double left = timeBudget - budgetReserve - elapsedSeconds();
+      double predicted = meanSeconds + BUDGET_DEVIATIONS*deviation;
+      if (left <= 0.0 || (epochs > 0 && predicted > left))
+      {
+         explainStop();
+         return false;
+      }
+   }
+   epochStart = chrono::steady_clock::now();
+   return true;
+
+}  //bool TrainingBudget::allowsEpoch()
+
+/*
+ * Prints why training stopped (a stop signal or the time budget) after the finished epochs
+ */
+void TrainingBudget::explainStop()
+{
+   if (receivedSignal != 0)
+   {
+      cout << "Stopping training on signal " << receivedSignal << " after " << epochs << " epochs" << endl;
+      return;
+   }
+   double left = timeBudget - budgetReserve - elapsedSeconds();
+   cout << "Stopping training after " << epochs << " epochs - " << max(left, 0.0) << " s of the time budget left, "
+        << "an epoch takes about " << meanSeconds << " s" << endl;
+   return;
+}
+
+/*
+ * Adds the time of the epoch that just ended to the moving averages
+ */
+void TrainingBudget::endEpoch()
+{
+   double seconds = chrono::duration<double>(chrono::steady_clock::now() - epochStart).count();
+   if (epochs == 0)
+   {
+      meanSeconds = seconds;
+      deviation = seconds/2.0;         //Nothing to go on yet - allow for a slower second epoch
+   }
+   else
+   {
+      double difference = seconds - meanSeconds;
+      meanSeconds += BUDGET_AVERAGING*difference;
+      deviation += BUDGET_AVERAGING*(fabs(difference) - deviation);
+   }
+   epochs++;
+   return;
+}
+
+
+/*
+ * Constructor - nothing kept yet
+ */
+BestWeights::BestWeights()
+{
+   error = INFINITY;
+   epoch = -1;
+}
+
+/*
+ * Whether an epoch's error is lower than the best one so far
+ */
+bool BestWeights::improves(double epochError)
+{
+   return epochError < error;
+}
+
+/*
+ * Keeps a copy of the network's weights as the best ones
+ */
+void BestWeights::keep(Network& n, double epochError, int epochIndex)
+{
+   if (values.empty())
+   {
+      values.resize(n.numParameters());
+      trackAlloc(MEM_WEIGHTS, values.size()*sizeof(double));
+   }
+   n.getParameters(values.data());
+   error = epochError;
+   epoch = epochIndex;
+   return;
+}
+
+/*
+ * Keeps a copy of weights laid out like getParameters() as the best ones
+ */
+void BestWeights::keep(const vector<double>& parameters, double epochError, int epochIndex)
+{
+   if (values.empty())
+   {
+      trackAlloc(MEM_WEIGHTS, parameters.size()*sizeof(double));
+   }
+   values = parameters;
+   error = epochError;
+   epoch = epochIndex;
+   return;
+}
+
+/*
+ * Puts the best weights back into the network if the last epoch's error was higher
+ * (lastError is INFINITY when the last epoch was interrupted, so they always are)
+ */
+void BestWeights::restore(Network& n, double lastError)
+{
+   if (epoch >= 0 && error < lastError)
+   {
+      n.setParameters(values.data());
+      cout << "Keeping the weights of epoch " << epoch << " (error " << error;
+      if (isinf(lastError))
+      {
+         cout << ", the last epoch was not finished)" << endl;
+      }
+      else
+      {
+         cout << ", the last epoch's was " << lastError << ")" << endl;
+      }
+   }
+   return;
+}
+
+/*
+ * Destructor - frees the copy
+ */
+BestWeights::~BestWeights()
+{
+   trackFree(MEM_WEIGHTS, values.size()*sizeof(double));
+}
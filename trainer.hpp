@@ -0,0 +1,102 @@
+/*
+ * Header file for the trainer - Contains declarations for the training loop
+ * that trains a network on a dataset, one epoch at a time.
+ *
+ * The trainer only uses the hyperparameters of the network it is given, so several
+ * networks can be trained at once (on different threads) with different settings.
+ *
+ * @author Kailash Ranganathan
+ * @version 4/30/20
+ */
+
+
+#pragma once      //include guard
+
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include <functional>
+#include <chrono>
+#include <vector>
+
+#include "network.hpp"
+#include "dataset.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+
+/*
+ * Global variables storing the time budget options (can be set in the config file)
+ */
+extern double timeBudget;
+extern double budgetReserve;
+
+/*
+ * Runs one epoch of training (every training set of the dataset once)
+ * and returns the mean error of the epoch (stoppedEarly, if given, is set to whether
+ * training was asked to stop before the epoch was finished)
+ */
+double trainEpoch(Network& n, Dataset& data, int epoch, Metrics& metrics, bool* stoppedEarly = NULL);
+
+/*
+ * Trains until the network's maxIter epochs are done or the error goes below its
+ * minError. Returns 1 if the error went below minError, 3 if it was stopped early (time
+ * budget or signal), 0 otherwise.
+ */
+int train(int nOut, Network& n, Dataset& data);
+
+/*
+ * Stopping training early - after installStopHandlers(), SIGINT and SIGTERM ask the
+ * trainers to stop after the current training step (a second one ends the program), and
+ * with a timeBudget the deadline passing does the same
+ */
+void installStopHandlers();
+int stopSignal();
+bool stopRequested();
+
+/*
+ * Decides before each epoch whether it fits in the time budget, from moving averages of
+ * the times of the epochs so far
+ */
+class TrainingBudget
+{
+   chrono::steady_clock::time_point epochStart;
+   double meanSeconds;        //Moving average of the epoch times
+   double deviation;          //Moving average of their distance from it
+   int epochs;
+
+   public:
+      TrainingBudget();
+      bool allowsEpoch();
+      void endEpoch();
+      void explainStop();
+
+};    //class TrainingBudget
+
+/*
+ * The weights at the end of the epoch with the lowest error so far - the trainers hand the
+ * network back with them if training ended on a worse epoch
+ */
+class BestWeights
+{
+   vector<double> values;
+   double error;
+   int epoch;
+
+   public:
+      BestWeights();
+      bool improves(double epochError);
+      void keep(Network& n, double epochError, int epochIndex);
+      void keep(const vector<double>& parameters, double epochError, int epochIndex);
+      void restore(Network& n, double lastError);
+      ~BestWeights();
+
+};    //class BestWeights
+
+/*
+ * Runs job(0) to job(count-1) on a pool of numThreads threads and returns when all are done
+ */
+void parallelFor(int count, int numThreads, function<void(int)> job);
+
+
+#endif /* TRAINER_H */